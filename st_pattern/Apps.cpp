@@ -17,6 +17,26 @@
 #include <QTextStream>
 #include <QDateTime>
 #include <QApplication>
+#include <QThread>
+#include <QThreadPool>
+#include <QRunnable>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QScopedPointer>
+#include "TrajectoryCache.h"
+#include "DotsSimplifier.h"
+#include "DotsFleet.h"
+#include "BitmapMiner.h"
+#include "BudgetedMiner.h"
+#include "IncrementalMiner.h"
+#include <QTemporaryFile>
+#include <QMutex>
+#include <QWaitCondition>
+#include "TrieNode.h"
+#include <cstring>
+#include <cmath>
+#include <climits>
+#include <algorithm>
 
 const QString Apps::tinsSuffix(".tins");
 const QString Apps::segSuffix(".seg");
@@ -24,6 +44,7 @@ const QString Apps::s2cSuffix(".s2c");
 const QString Apps::clusterSuffix(".cluster");
 const QString Apps::tincSuffix(".tinc");
 const QString Apps::patternSuffix(".stp");
+const QString Apps::trcSuffix(".trc");
 
 Apps::Apps()
 {
@@ -35,25 +56,737 @@ Apps::~Apps()
 
 }
 
+namespace {
+
+// The segmentation result of one trajectory file. Segment ids are NOT assigned yet, since they
+// come from a global counter and have to follow the file order.
+struct FileSegmentation
+{
+    QString file;
+    int index;
+    QVector<Trajectory> subTrajs;
+    QString error;
+    bool failed;
+    bool done;
+};
+
+// Lets the thread serializing the files wait for the next one, while the workers go on with the others.
+class SegmentationWindow
+{
+public:
+    void markDone(FileSegmentation *result) {
+        QMutexLocker locker(&mutex);
+        result->done = true;
+        finished.wakeAll();
+    }
+
+    void waitFor(const FileSegmentation &result) {
+        QMutexLocker locker(&mutex);
+        while (!result.done)
+            finished.wait(&mutex);
+    }
+
+protected:
+    QMutex mutex;
+    QWaitCondition finished;
+};
+
+// Parses (or loads from the cache), preprocesses and simplifies one file on a worker thread.
+class SegmentationTask : public QRunnable
+{
+public:
+    SegmentationTask(FileSegmentation *result, const TrajectoryCache *cache, const SpatialTemporalPoint &reference,
+                     double segStep, bool useTemporal, bool useSEST, double dotsTh, bool pipelineSEST,
+                     SegmentationWindow *window = NULL)
+        : result(result), cache(cache), reference(reference), segStep(segStep), useTemporal(useTemporal),
+          useSEST(useSEST), dotsTh(dotsTh), pipelineSEST(pipelineSEST), window(window) {}
+
+    void run() {
+        result->failed = true;
+        try {
+            if (cache) {
+                Trajectory traj(*cache, result->index);
+                result->subTrajs = Apps::segmentTrajectory(traj, segStep, useTemporal, useSEST, dotsTh,
+                                                           pipelineSEST);
+            } else {
+                result->subTrajs = Apps::segmentTrajectory(result->file, reference, segStep,
+                                                           useTemporal, useSEST, dotsTh, pipelineSEST);
+            }
+            result->failed = false;
+        } catch (SpatialTemporalException &e) {
+            result->error = QString("Error occurs while segmenting trajectory: %1\nDetails: %2").
+                    arg(result->file).arg(e.getMessage());
+        } catch (DotsException &e) {
+            result->error = QString("Error occurs while simplifying trajectory: %1\nDetails: %2").
+                    arg(result->file).arg(e.getMessage());
+        } catch (...) {
+            result->error = QString("Unknown error occurs while segmenting trajectory: %1").
+                    arg(result->file);
+        }
+        if (window)
+            window->markDone(result);
+    }
+
+protected:
+    FileSegmentation *result;
+    const TrajectoryCache *cache;
+    SpatialTemporalPoint reference;
+    double segStep;
+    bool useTemporal;
+    bool useSEST;
+    double dotsTh;
+    bool pipelineSEST;
+    SegmentationWindow *window;
+};
+
+// Serializes the simplified trajectories of one file. This must run in file order.
+void storeFileSegmentation(const FileSegmentation &result, bool useSEST, double minLength,
+                           QDataStream &segOut, QDataStream &trajOut,
+                           QHash<unsigned int, unsigned int> &t2otMap,
+                           unsigned int &tCounter, unsigned int &otCounter)
+{
+    if (result.failed) {
+        qDebug()<<result.error;
+        return;
+    }
+    if (useSEST)
+        qDebug()<<"Used "<<result.subTrajs.count()<<" thresholds.";
+    foreach (Trajectory sim, result.subTrajs) {
+        QVector<SegmentLocation> segments = sim.getSegmentsAsEuclidPoints();
+        segments = Apps::filterSegments(segments, minLength);
+        if (segments.isEmpty()) {
+            qDebug()<<"Segments become empty after filtered.";
+            continue;
+        }
+        // Serialize the trajectory and its segments.
+        trajOut<<segments.count();
+        foreach (SegmentLocation l, segments) {
+            segOut<<l;
+            trajOut<<l.id;
+        }
+        t2otMap[tCounter] = otCounter;
+        ++tCounter;
+    }
+    ++otCounter;
+}
+
+// Collects the simplified indices of each stream of a fleet.
+class FleetCollector : public DotsFleet::Listener
+{
+public:
+    explicit FleetCollector(int numStreams) : indices(numStreams), numOutputs(0) {}
+
+    void onSimplifiedPoint(qint64 streamId, int index, double, double, double) {
+        indices[(int)streamId] << index;
+        ++numOutputs;
+    }
+
+    QVector<QVector<int> > indices;
+    qint64 numOutputs;
+};
+
+// A cluster in the uniform grid of getSpatialContinuityMap(), located by the cell of its start point.
+struct GridEntry
+{
+    qint64 cx;
+    qint64 cy;
+    int pos;
+
+    bool operator<(const GridEntry &other) const {
+        if (cx != other.cx)
+            return cx < other.cx;
+        if (cy != other.cy)
+            return cy < other.cy;
+        return pos < other.pos;
+    }
+};
+
+// Locates a range of clusters in the grid.
+class GridTask : public QRunnable
+{
+public:
+    GridTask(const QVector<SegmentLocation> &clusters, double cellSize, int from, int to, QVector<GridEntry> &grid)
+        : clusters(clusters), cellSize(cellSize), from(from), to(to), grid(grid) {}
+
+    void run() {
+        for (int i=from; i<to; ++i) {
+            const SegmentLocation &l = clusters.at(i);
+            GridEntry &e = grid[i];
+            e.cx = (qint64)std::floor(l.x/cellSize);
+            e.cy = (qint64)std::floor(l.y/cellSize);
+            e.pos = i;
+        }
+    }
+
+protected:
+    const QVector<SegmentLocation> &clusters;
+    double cellSize;
+    int from, to;
+    QVector<GridEntry> &grid;
+};
+
+// The scalar distances of BIRCH, which the vectorized kernels of CFTree should agree with bit by bit.
+typedef CFTreeND::CFEntry CFEntryND;
+
+double scalarDistD0(const CFEntryND &lhs, const CFEntryND &rhs)
+{
+    double dist = 0.0;
+    for (int i=0; i<CFTreeND::fdim; ++i) {
+        double tmp = lhs.sum[i]/lhs.n - rhs.sum[i]/rhs.n;
+        dist += tmp*tmp;
+    }
+    return qMax(dist, 0.0);
+}
+
+double scalarDistD1(const CFEntryND &lhs, const CFEntryND &rhs)
+{
+    double dist = 0.0;
+    for (int i=0; i<CFTreeND::fdim; ++i)
+        dist += std::abs(lhs.sum[i]/lhs.n - rhs.sum[i]/rhs.n);
+    return qMax(dist, 0.0);
+}
+
+double scalarDistD2(const CFEntryND &lhs, const CFEntryND &rhs)
+{
+    double dot = 0.0;
+    for (int i=0; i<CFTreeND::fdim; ++i)
+        dot += lhs.sum[i] * rhs.sum[i];
+    return qMax((rhs.n*lhs.sum_sq + lhs.n*rhs.sum_sq - 2*dot) / (lhs.n*rhs.n), 0.0);
+}
+
+double scalarDistD3(const CFEntryND &lhs, const CFEntryND &rhs)
+{
+    std::size_t tmpn = lhs.n+rhs.n;
+    double tmp2 = 0.0;
+    for (int i=0; i<CFTreeND::fdim; ++i) {
+        double tmp1 = lhs.sum[i] + rhs.sum[i];
+        tmp2 += tmp1/tmpn * tmp1/(tmpn-1);
+    }
+    return qMax(2 * ((lhs.sum_sq+rhs.sum_sq)/(tmpn-1) - tmp2), 0.0);
+}
+
+double scalarDiameter(const CFEntryND &e)
+{
+    if (e.n <= 1)
+        return 0.0;
+    double temp = 0.0;
+    for (int i=0; i<CFTreeND::fdim; ++i)
+        temp += e.sum[i]/e.n * e.sum[i]/(e.n - 1);
+    return qMax(2 * (e.sum_sq/(e.n - 1) - temp), 0.0);
+}
+
+double scalarRadius(const CFEntryND &e)
+{
+    if (e.n <= 1)
+        return 0.0;
+    double tmp1 = 0.0;
+    for (int i=0; i<CFTreeND::fdim; ++i) {
+        double tmp0 = e.sum[i] / e.n;
+        tmp1 += tmp0*tmp0;
+    }
+    return qMax(e.sum_sq/e.n - tmp1, 0.0);
+}
+
+double wardDistance(const CFEntryND &lhs, const CFEntryND &rhs)
+{
+    double dist = 0.0;
+    for (int i=0; i<CFTreeND::fdim; ++i) {
+        double tmp = lhs.sum[i]/lhs.n - rhs.sum[i]/rhs.n;
+        dist += tmp*tmp;
+    }
+    return (double)lhs.n*rhs.n/(lhs.n+rhs.n)*dist;
+}
+
+// Ward clustering by merging the closest pair at each step, which the nearest-neighbor chains of CFTree
+// should agree with. The hierarchy is split from the top the same way.
+void greedyWardClusters(CFTreeND::cfentry_vec_type &entries, double thresh)
+{
+    int n = (int)entries.size();
+    if (n <= 1)
+        return;
+    QVector<CFEntryND> nodes;
+    QVector<int> lhs, rhs, active;
+    for (int i=0; i<n; ++i) {
+        nodes << entries[i];
+        active << i;
+    }
+    while (active.count() > 1) {
+        int bestI = 0, bestJ = 1;
+        double bestDist = wardDistance(nodes.at(active.at(0)), nodes.at(active.at(1)));
+        for (int i=0; i<active.count(); ++i) {
+            for (int j=i+1; j<active.count(); ++j) {
+                double dist = wardDistance(nodes.at(active.at(i)), nodes.at(active.at(j)));
+                if (dist < bestDist) {
+                    bestDist = dist;
+                    bestI = i;
+                    bestJ = j;
+                }
+            }
+        }
+        lhs << active.at(bestI);
+        rhs << active.at(bestJ);
+        nodes << nodes[active.at(bestI)] + nodes.at(active.at(bestJ));
+        active.remove(bestJ);
+        active[bestI] = nodes.count()-1;
+    }
+
+    CFTreeND::cfentry_vec_type clusters;
+    QVector<int> stack;
+    stack << nodes.count()-1;
+    while (!stack.isEmpty()) {
+        int id = stack.last();
+        stack.removeLast();
+        if (id >= n && CFTreeND::_Diameter(nodes.at(id)) > thresh)
+            stack << rhs.at(id-n) << lhs.at(id-n);
+        else
+            clusters.push_back(nodes.at(id));
+    }
+    entries.swap(clusters);
+}
+
+// Orders the clusters by size and then sums, for comparing the results of two algorithms.
+bool clusterLessThan(const CFEntryND &lhs, const CFEntryND &rhs)
+{
+    if (lhs.n != rhs.n)
+        return lhs.n < rhs.n;
+    for (int i=0; i<CFTreeND::fdim; ++i) {
+        if (lhs.sum[i] != rhs.sum[i])
+            return lhs.sum[i] < rhs.sum[i];
+    }
+    return lhs.sum_sq < rhs.sum_sq;
+}
+
+// Redistributes a range of the buffered segments to their nearest clusters.
+class RedistTask : public QRunnable
+{
+public:
+    RedistTask(const CentroidIndex &index, const QVector<ItemND> &buffer, int from, int to,
+               std::vector<int> &item_cids)
+        : index(index), buffer(buffer), from(from), to(to), item_cids(item_cids) {}
+
+    void run() {
+        for (int i=from; i<to; ++i)
+            item_cids[i] = index.nearest(buffer.at(i).item);
+    }
+
+protected:
+    const CentroidIndex &index;
+    const QVector<ItemND> &buffer;
+    int from, to;
+    std::vector<int> &item_cids;
+};
+
+// Size of a record of a segment file, the location and the id of a segment as QDataStream writes them.
+const qint64 SEG_RECORD_SIZE = CFTreeND::fdim*sizeof(double) + sizeof(qint32);
+
+// Builds a tree of its own from a range of the records of a segment file, which it reads by itself so that
+// the shards parse the file in parallel too. The records read are counted, since a worker cannot raise.
+class ShardTask : public QRunnable
+{
+public:
+    ShardTask(CFTreeND &tree, const QString &segFileName, const QVector<double> &weights, qint64 from, qint64 to,
+              qint64 &numRead)
+        : tree(tree), segFileName(segFileName), weights(weights), from(from), to(to), numRead(numRead) {}
+
+    void run() {
+        numRead = 0;
+        QFile segFile(segFileName);
+        if (!segFile.open(QIODevice::ReadOnly) || !segFile.seek(from*SEG_RECORD_SIZE))
+            return;
+        QDataStream segIn(&segFile);
+        double item[CFTreeND::fdim];
+        int lid = 0;
+        for (qint64 r=from; r<to; ++r) {
+            for (int i=0; i<CFTreeND::fdim; ++i) {
+                segIn>>item[i];
+                item[i] *= weights.at(i);
+            }
+            segIn>>lid;
+            if (segIn.status() != QDataStream::Ok)
+                return;
+            tree.insert(&item[0]);
+            ++numRead;
+        }
+    }
+
+protected:
+    CFTreeND &tree;
+    QString segFileName;
+    const QVector<double> &weights;
+    qint64 from, to;
+    qint64 &numRead;
+};
+
+// Finds the continuous clusters of a range of clusters by querying the grid around their end points.
+class ContinuityTask : public QRunnable
+{
+public:
+    ContinuityTask(const QVector<SegmentLocation> &clusters, const QVector<GridEntry> &grid, double radius,
+                   int from, int to, QVector<QVector<unsigned int> > &neighbors)
+        : clusters(clusters), grid(grid), radius(radius), from(from), to(to), neighbors(neighbors) {}
+
+    void run() {
+        QVector<int> candidates;
+        for (int i=from; i<to; ++i) {
+            const SegmentLocation &l1 = clusters.at(i);
+            double ex = l1.x+l1.rx, ey = l1.y+l1.ry;
+            if (!std::isfinite(ex) || !std::isfinite(ey))
+                continue;
+
+            // The cells covering the circle, plus one more on each side in case the end point rounds differently
+            // from the exact test below.
+            qint64 cxLo = (qint64)std::floor((ex-radius)/radius)-1, cxHi = (qint64)std::floor((ex+radius)/radius)+1;
+            qint64 cyLo = (qint64)std::floor((ey-radius)/radius)-1, cyHi = (qint64)std::floor((ey+radius)/radius)+1;
+            const GridEntry *begin = grid.constData(), *end = begin+grid.count();
+            candidates.resize(0);
+            for (qint64 cx=cxLo; cx<=cxHi; ++cx) {
+                GridEntry lo = {cx, cyLo, -1}, hi = {cx, cyHi+1, -1};
+                const GridEntry *first = std::lower_bound(begin, end, lo);
+                const GridEntry *last = std::lower_bound(first, end, hi);
+                for (const GridEntry *e=first; e<last; ++e)
+                    candidates << e->pos;
+            }
+
+            // Test the candidates in the order of clusters, the same way as the brute force search.
+            std::sort(candidates.begin(), candidates.end());
+            QVector<unsigned int> &nb = neighbors[i];
+            foreach (int j, candidates) {
+                const SegmentLocation &l2 = clusters.at(j);
+                if (l1.id != l2.id) {
+                    double diffX = l2.x-l1.x-l1.rx;
+                    double diffY = l2.y-l1.y-l1.ry;
+                    if (qSqrt(diffX*diffX+diffY*diffY) < radius)
+                        nb << l2.id;
+                }
+            }
+        }
+    }
+
+protected:
+    const QVector<SegmentLocation> &clusters;
+    const QVector<GridEntry> &grid;
+    double radius;
+    int from, to;
+    QVector<QVector<unsigned int> > &neighbors;
+};
+
+// A subtree of the parallel PrefixSpan. The pattern of the node itself is not included, since it follows all
+// the patterns of the subtree in the serial order.
+struct MiningNode
+{
+    MiningNode() : depth(0) {}
+    ~MiningNode() { qDeleteAll(children); }
+
+    QVector<unsigned int> prefix;
+    QVector<PseudoProjection> projs;
+    int depth;
+    // Patterns mined serially, or the child subtrees if the node was split.
+    QVector<QVector<unsigned int> > patterns;
+    QVector<MiningNode *> children;
+    QString error;
+};
+
+// Mines one subtree. Subtrees near the root are split into child tasks, since a few of them usually hold most of
+// the patterns.
+class MiningTask : public QRunnable
+{
+public:
+    MiningTask(MiningNode *node, QThreadPool *pool, const TincIndex &index,
+               const QHash<unsigned int, QVector<unsigned int> > &scMap,
+               const QHash<unsigned int, unsigned int> &t2otMap, int minSup, bool maximal)
+        : node(node), pool(pool), index(index), scMap(scMap), t2otMap(t2otMap), minSup(minSup),
+          maximal(maximal) {}
+
+    void run() {
+        try {
+            if (node->depth == 0 || (node->depth < MAX_SPLIT_DEPTH && node->projs.count() >= MIN_SPLIT_PROJECTIONS))
+                split();
+            else
+                Apps::prefixSpan(node->prefix, index, node->projs, scMap, t2otMap, node->patterns, minSup,
+                                 maximal);
+        } catch (SpatialTemporalException &e) {
+            node->error = e.getMessage();
+        }
+        node->projs = QVector<PseudoProjection>();
+    }
+
+protected:
+    static const int MAX_SPLIT_DEPTH = 3;
+    static const int MIN_SPLIT_PROJECTIONS = 64;
+
+    // Expands the node the way prefixSpan() does, but leaves each frequent child to a new task.
+    void split() {
+        if (node->projs.count() < minSup)
+            return;
+        QVector<unsigned int> toCheck;
+        if (node->prefix.isEmpty()) {
+            toCheck = scMap.keys().toVector();
+            std::sort(toCheck.begin(), toCheck.end());
+        } else {
+            toCheck = scMap.value(node->prefix.last());
+        }
+        QVector<PseudoProjection> newProjs;
+        foreach (unsigned int c, toCheck) {
+            if (index.project(c, node->projs, t2otMap, newProjs) >= minSup) {
+                MiningNode *child = new MiningNode();
+                child->prefix = node->prefix;
+                child->prefix.append(c);
+                child->projs = newProjs;
+                child->depth = node->depth+1;
+                node->children << child;
+            }
+        }
+        // The larger subtrees start first.
+        foreach (MiningNode *child, node->children) {
+            pool->start(new MiningTask(child, pool, index, scMap, t2otMap, minSup, maximal),
+                        child->projs.count());
+        }
+    }
+
+    MiningNode *node;
+    QThreadPool *pool;
+    const TincIndex &index;
+    const QHash<unsigned int, QVector<unsigned int> > &scMap;
+    const QHash<unsigned int, unsigned int> &t2otMap;
+    int minSup;
+    bool maximal;
+};
+
+// Writes one pattern to an st-pattern file.
+void writePattern(QDataStream &patternOut, const QVector<unsigned int> &pattern,
+                  const QVector<SegmentLocation> &clusters)
+{
+    patternOut << pattern.count();
+    foreach (unsigned int id, pattern) {
+        patternOut << clusters[id];
+    }
+}
+
+// The rank of a top-k pattern: by support, then by length, then by the order it was found in.
+struct TopKRank
+{
+    int support;
+    int length;
+    qint64 order;
+
+    bool operator<(const TopKRank &other) const {
+        if (support != other.support)
+            return support > other.support;
+        if (length != other.length)
+            return length > other.length;
+        return order < other.order;
+    }
+};
+
+// Mines the k best patterns with PrefixSpan, keeping only them in a bounded heap.
+//
+// Once the heap is full, the support of its worst pattern becomes the threshold, and the subtrees
+// below it are pruned since extending a pattern never raises its support. The first-level items are
+// visited by descending support, so after each of them no pattern to come could have a higher
+// support than the next item. The patterns above that bound are final, and are streamed out right
+// away in the order of their ranks.
+class TopKMiner
+{
+public:
+    TopKMiner(const TincIndex &index, const QHash<unsigned int, QVector<unsigned int> > &scMap,
+              const QHash<unsigned int, unsigned int> &t2otMap, int minSup, int minLen, int k)
+        : index(index), scMap(scMap), t2otMap(t2otMap), minSup(minSup), minLen(minLen), k(k),
+          numStreamed(0), numFound(0), patternOut(NULL), clusters(NULL) {}
+
+    // Streams the confirmed patterns to an st-pattern file, besides keeping them.
+    void setOutput(QDataStream *patternOut, const QVector<SegmentLocation> *clusters) {
+        this->patternOut = patternOut;
+        this->clusters = clusters;
+    }
+
+    void mine(const QVector<PseudoProjection> &projs) {
+        if (k <= 0 || projs.count() < minSup)
+            return;
+
+        // Rank the first-level items by their supports.
+        QVector<unsigned int> items = scMap.keys().toVector();
+        std::sort(items.begin(), items.end());
+        QVector<TopKRank> itemRanks;
+        QVector<PseudoProjection> newProjs;
+        for (int i=0; i<items.count(); ++i) {
+            TopKRank r;
+            r.support = index.project(items.at(i), projs, t2otMap, newProjs);
+            r.length = 1;
+            r.order = i;
+            if (r.support >= minSup)
+                itemRanks << r;
+        }
+        std::sort(itemRanks.begin(), itemRanks.end());
+
+        for (int i=0; i<itemRanks.count() && itemRanks.at(i).support >= threshold(); ++i) {
+            QVector<unsigned int> prefix;
+            prefix << items.at(itemRanks.at(i).order);
+            index.project(prefix.last(), projs, t2otMap, newProjs);
+            offer(prefix, itemRanks.at(i).support);
+            search(prefix, newProjs);
+            confirm(i+1 < itemRanks.count() ? itemRanks.at(i+1).support : -1);
+        }
+        confirm(-1);
+    }
+
+    // The patterns in the order of their ranks, with their supports.
+    QVector<QVector<unsigned int> > patterns;
+    QVector<int> supports;
+
+protected:
+    void search(const QVector<unsigned int> &prefix, const QVector<PseudoProjection> &projs) {
+        if (projs.count() < threshold())
+            return;
+        QVector<unsigned int> toCheck = scMap.value(prefix.last());
+        QVector<PseudoProjection> newProjs;
+        foreach (unsigned int c, toCheck) {
+            int support = index.project(c, projs, t2otMap, newProjs);
+            if (support < threshold())
+                continue;
+            QVector<unsigned int> newPrefix = prefix;
+            newPrefix.append(c);
+            offer(newPrefix, support);
+            search(newPrefix, newProjs);
+        }
+    }
+
+    // The minimum support a pattern needs to enter the heap, or to have an extension entering it.
+    int threshold() const {
+        if (numStreamed+heap.count() < k)
+            return minSup;
+        if (heap.isEmpty())
+            return INT_MAX;
+        return qMax(minSup, heap.lastKey().support);
+    }
+
+    void offer(const QVector<unsigned int> &pattern, int support) {
+        if (pattern.count() < minLen)
+            return;
+        TopKRank r;
+        r.support = support;
+        r.length = pattern.count();
+        r.order = numFound++;
+        if (numStreamed+heap.count() >= k) {
+            if (heap.isEmpty() || !(r < heap.lastKey()))
+                return;
+            heap.remove(heap.lastKey());
+        }
+        heap.insert(r, pattern);
+    }
+
+    // Streams the patterns with supports above the bound, which nothing could outrank any more.
+    void confirm(int bound) {
+        while (!heap.isEmpty() && heap.firstKey().support > bound) {
+            QVector<unsigned int> pattern = heap.first();
+            patterns << pattern;
+            supports << heap.firstKey().support;
+            if (patternOut)
+                writePattern(*patternOut, pattern, *clusters);
+            heap.remove(heap.firstKey());
+            ++numStreamed;
+        }
+    }
+
+    const TincIndex &index;
+    const QHash<unsigned int, QVector<unsigned int> > &scMap;
+    const QHash<unsigned int, unsigned int> &t2otMap;
+    int minSup;
+    int minLen;
+    int k;
+    QMap<TopKRank, QVector<unsigned int> > heap;
+    int numStreamed;
+    qint64 numFound;
+    QDataStream *patternOut;
+    const QVector<SegmentLocation> *clusters;
+};
+
+// Collects the (support, length) of every frequent pattern, negated so that the best ones sort first.
+// This is the reference of the top-k mode.
+void collectAllRanks(int length, const QVector<unsigned int> &toCheck, const QVector<PseudoProjection> &projs,
+                     const TincIndex &index, const QHash<unsigned int, QVector<unsigned int> > &scMap,
+                     const QHash<unsigned int, unsigned int> &t2otMap, int minSup,
+                     QVector<QPair<int, int> > &allRanks)
+{
+    QVector<PseudoProjection> newProjs;
+    foreach (unsigned int c, toCheck) {
+        int support = index.project(c, projs, t2otMap, newProjs);
+        if (support >= minSup) {
+            allRanks << qMakePair(-support, -(length+1));
+            collectAllRanks(length+1, scMap.value(c), newProjs, index, scMap, t2otMap, minSup, allRanks);
+        }
+    }
+}
+
+// Flattens the patterns of a mined subtree in the order of the serial PrefixSpan.
+void collectPatterns(const MiningNode *node, bool maximal, QVector<QVector<unsigned int> > &allPatterns,
+                     QString &error)
+{
+    if (error.isEmpty())
+        error = node->error;
+    allPatterns << node->patterns;
+    foreach (const MiningNode *child, node->children) {
+        int beforePatternsCount = allPatterns.count();
+        collectPatterns(child, maximal, allPatterns, error);
+        if (!maximal || beforePatternsCount == allPatterns.count())
+            allPatterns << child->prefix;
+    }
+}
+
+// Preprocesses the trajectories the same way as the segmentation phase does.
+QVector<Trajectory> loadNormalizedTrajectories(const QStringList &files)
+{
+    QVector<Trajectory> trajs;
+    SpatialTemporalPoint reference = Trajectory(files.first()).estimateReferencePoint();
+    foreach (QString file, files) {
+        try {
+            Trajectory traj(file);
+            traj.setReferencePoint(reference);
+            traj.doMercatorProject();
+            traj.doNormalize();
+            if (traj.count() > 2)
+                trajs << traj;
+        } catch (SpatialTemporalException &e) {
+            qDebug()<<"Skip trajectory "<<file<<": "<<e.getMessage();
+        } catch (DotsException &e) {
+            qDebug()<<"Skip trajectory "<<file<<": "<<e.getMessage();
+        }
+    }
+    return trajs;
+}
+
+}
+
 void Apps::segmentTrajectories(const QString &fileDir, const QString &suffix,
                                const QString &outputFile,
                                double segStep, bool useTemporal, double minLength,
-                               bool useSEST, double dotsTh)
+                               bool useSEST, double dotsTh, int numThreads, bool pipelineSEST)
 {
-    // Retrieve all the files.
-    QStringList files = Helper::retrieveFilesWithSuffix(fileDir, suffix);
-    qDebug()<<"The folder "<<fileDir<<" contains "<<files.count()<<" trajectory file(s).";
+    // Retrieve all the files, or the ones imported into a trajectory cache.
+    QScopedPointer<TrajectoryCache> cache;
+    QStringList files;
+    if (fileDir.endsWith(trcSuffix) && QFileInfo(fileDir).isFile()) {
+        cache.reset(new TrajectoryCache(fileDir));
+        files = cache->getFileNames();
+        qDebug()<<"The cache "<<fileDir<<" contains "<<files.count()<<" trajectory file(s).";
+    } else {
+        files = Helper::retrieveFilesWithSuffix(fileDir, suffix);
+        qDebug()<<"The folder "<<fileDir<<" contains "<<files.count()<<" trajectory file(s).";
+    }
     if (files.isEmpty())
     {
         return;
     }
 
-    // Retrieve one file to estimate the reference point.
+    // Retrieve one file to estimate the reference point. A cache keeps the one it was projected by.
     SpatialTemporalPoint reference;
     try {
-        Trajectory ref(files.first());
-        //ref.validate();
-        reference = ref.estimateReferencePoint();
+        if (!cache.isNull()) {
+            reference = cache->getReferencePoint();
+        } else {
+            Trajectory ref(files.first());
+            //ref.validate();
+            reference = ref.estimateReferencePoint();
+        }
     } catch (SpatialTemporalException &e) {
         qDebug()<<"Error occurs while estimating reference point. Details:\n"<<e.getMessage();
         return;
@@ -74,64 +807,49 @@ void Apps::segmentTrajectories(const QString &fileDir, const QString &suffix,
     QDataStream trajOut(&trajFile);
     QHash<unsigned int, unsigned int> t2otMap;
     unsigned int tCounter = 0, otCounter = 0;
-    foreach (QString file, files) {
-        try {
-            qDebug()<<"Processing "<<file;
-            Trajectory traj(file);
-            // Preprocessing.
-            traj.setReferencePoint(reference);
-            traj.doMercatorProject();
-            //traj.validate();
-            traj.doNormalize();
-            // Do multi-threshold segmentation.
-            if (useSEST) {
-                QVector<Trajectory> subTrajs = traj.simplifyWithSEST(dotsTh, segStep, useTemporal);
-                qDebug()<<"Used "<<subTrajs.count()<<" thresholds.";
-                foreach (Trajectory sim, subTrajs) {
-//                    QString curveName = QString("M=%1").arg(sim.count());
-//                    sim.visualize("r--", curveName);
-//                    qApp->exec();
-                    QVector<SegmentLocation> segments = sim.getSegmentsAsEuclidPoints();
-                    segments = filterSegments(segments, minLength);
-                    if (segments.isEmpty()) {
-                        qDebug()<<"Segments become empty after filtered.";
-                        continue;
-                    }
-                    // Serialize the trajectory and its segments.
-                    trajOut<<segments.count();
-                    foreach (SegmentLocation l, segments) {
-                        segOut<<l;
-                        trajOut<<l.id;
-                    }
-                    t2otMap[tCounter] = otCounter;
-                    ++tCounter;
-                }
-            } else {
-                QVector<SegmentLocation> segments = traj.simplify(dotsTh).getSegmentsAsEuclidPoints();
-                segments = filterSegments(segments, minLength);
-                if (segments.isEmpty()) {
-                    qDebug()<<"Segments become empty after filtered.";
-                } else {
-                    // Serialize the trajectory and its segments.
-                    trajOut<<segments.count();
-                    foreach (SegmentLocation l, segments) {
-                        segOut<<l;
-                        trajOut<<l.id;
-                    }
-                    t2otMap[tCounter] = otCounter;
-                    ++tCounter;
-                }
+    if (numThreads <= 0)
+        numThreads = QThread::idealThreadCount();
+    if (numThreads <= 1) {
+        FileSegmentation result;
+        for (int i=0; i<files.count(); ++i) {
+            qDebug()<<"Processing "<<files.at(i);
+            result.file = files.at(i);
+            result.index = i;
+            SegmentationTask(&result, cache.data(), reference, segStep, useTemporal, useSEST, dotsTh,
+                             pipelineSEST).run();
+            storeFileSegmentation(result, useSEST, minLength, segOut, trajOut,
+                                  t2otMap, tCounter, otCounter);
+        }
+    } else {
+        // Files are simplified by the workers within a sliding window, while the results are serialized
+        // in file order by this thread. So the output is the same as the one of the serial run. A new file
+        // is started as soon as the first one of the window is stored, so no worker waits for a slow file.
+        qDebug()<<"Segmenting with "<<numThreads<<" worker threads.";
+        static const int WINDOW_PER_THREAD = 4;
+        QThreadPool pool;
+        pool.setMaxThreadCount(numThreads);
+        int windowSize = numThreads*WINDOW_PER_THREAD;
+        QVector<FileSegmentation> inFlight(windowSize);
+        SegmentationWindow window;
+        int numStarted = 0;
+        for (int i=0; i<files.count(); ++i) {
+            for (; numStarted<files.count() && numStarted<i+windowSize; ++numStarted) {
+                FileSegmentation &slot = inFlight[numStarted%windowSize];
+                slot = FileSegmentation();
+                slot.file = files.at(numStarted);
+                slot.index = numStarted;
+                slot.done = false;
+                pool.start(new SegmentationTask(&slot, cache.data(), reference, segStep,
+                                                useTemporal, useSEST, dotsTh, pipelineSEST, &window));
             }
-            ++otCounter;
-        } catch (SpatialTemporalException &e) {
-            qDebug()<<"Error occurs while segmenting trajectory: "<<file<<"\nDetails: "
-                   << e.getMessage();
-        } catch (DotsException &e) {
-            qDebug()<<"Error occurs while simplifying trajectory: "<<file<<"\nDetails: "
-                   <<e.getMessage();
-        } catch (...) {
-            qDebug()<<"Unknown error occurs while segmenting trajectory: "<<file;
+            FileSegmentation &result = inFlight[i%windowSize];
+            window.waitFor(result);
+            qDebug()<<"Processing "<<result.file;
+            storeFileSegmentation(result, useSEST, minLength, segOut, trajOut,
+                                  t2otMap, tCounter, otCounter);
+            result.subTrajs.clear();
         }
+        pool.waitForDone();
     }
     segFile.close();
     trajFile.close();
@@ -148,6 +866,43 @@ void Apps::segmentTrajectories(const QString &fileDir, const QString &suffix,
     }
 }
 
+QVector<Trajectory> Apps::segmentTrajectory(const QString &file, const SpatialTemporalPoint &reference,
+                                            double segStep, bool useTemporal, bool useSEST, double dotsTh,
+                                            bool pipelineSEST)
+{
+    Trajectory traj(file);
+    // Preprocessing.
+    traj.setReferencePoint(reference);
+    traj.doMercatorProject();
+    return segmentTrajectory(traj, segStep, useTemporal, useSEST, dotsTh, pipelineSEST);
+}
+
+QVector<Trajectory> Apps::segmentTrajectory(Trajectory &projected,
+                                            double segStep, bool useTemporal, bool useSEST, double dotsTh,
+                                            bool pipelineSEST)
+{
+    //projected.validate();
+    projected.doNormalize();
+    // Do multi-threshold segmentation.
+    if (useSEST)
+        return projected.simplifyWithSEST(dotsTh, segStep, useTemporal, pipelineSEST);
+
+    QVector<Trajectory> subTrajs;
+    subTrajs.append(projected.simplify(dotsTh));
+    return subTrajs;
+}
+
+void Apps::importTrajectories(const QString &fileDir, const QString &suffix, const QString &outputFile)
+{
+    QStringList files = Helper::retrieveFilesWithSuffix(fileDir, suffix);
+    qDebug()<<"The folder "<<fileDir<<" contains "<<files.count()<<" trajectory file(s).";
+    if (files.isEmpty())
+        return;
+
+    int count = TrajectoryCache::build(files, outputFile + trcSuffix);
+    qDebug()<<"Imported "<<count<<" trajectories into "<<(outputFile + trcSuffix);
+}
+
 QVector<SegmentLocation> Apps::filterSegments(const QVector<SegmentLocation> &segments, double minLength)
 {
     QVector<SegmentLocation> filtered;
@@ -182,6 +937,216 @@ void Apps::testSegmentation()
     RobustnessTester::testMaximalStableSegmentation(traj, sampleRates, 100000);
 }
 
+namespace {
+
+typedef void (*TrajectoryParser)(QString, QVector<double> &, QVector<double> &, QVector<double> &, bool, bool);
+
+// Parses all the files the way the Trajectory constructor does and returns the number of points.
+qint64 parseFiles(const QStringList &files, TrajectoryParser mopsi, TrajectoryParser geoLife,
+                  QVector<QVector<double> > *values = NULL)
+{
+    qint64 numPoints = 0;
+    QVector<double> x, y, t;
+    foreach (QString file, files) {
+        (file.endsWith(".plt") ? geoLife : mopsi)(file, x, y, t, false, false);
+        numPoints += t.count();
+        if (values)
+            *values << x << y << t;
+    }
+    return numPoints;
+}
+
+}
+
+void Apps::benchParsers(const QString &fileDir, const QString &suffix, int rounds)
+{
+    QStringList files = Helper::retrieveFilesWithSuffix(fileDir, suffix);
+    qDebug()<<"The folder "<<fileDir<<" contains "<<files.count()<<" trajectory file(s).";
+    if (files.isEmpty())
+        return;
+
+    // Both parsers have to produce exactly the same values.
+    QVector<QVector<double> > expected, actual;
+    parseFiles(files, Helper::parseMOPSI, Helper::parseGeoLife, &expected);
+    parseFiles(files, Helper::parseMOPSIMapped, Helper::parseGeoLifeMapped, &actual);
+    for (int i=0; i<expected.count(); ++i) {
+        if (expected[i].count() != actual[i].count() ||
+                memcmp(expected[i].constData(), actual[i].constData(), expected[i].count()*sizeof(double)) != 0) {
+            qDebug()<<"Mapped parser differs on file "<<files.at(i/3);
+            return;
+        }
+    }
+    qDebug()<<"Mapped parser produces identical values.";
+
+    QElapsedTimer timer;
+    qint64 numPoints = 0;
+    timer.start();
+    for (int r=0; r<rounds; ++r)
+        numPoints += parseFiles(files, Helper::parseMOPSI, Helper::parseGeoLife);
+    double lineElapsed = timer.nsecsElapsed()*1e-9;
+    timer.restart();
+    for (int r=0; r<rounds; ++r)
+        parseFiles(files, Helper::parseMOPSIMapped, Helper::parseGeoLifeMapped);
+    double mappedElapsed = timer.nsecsElapsed()*1e-9;
+    qDebug()<<"Line parser:   "<<numPoints<<" points in "<<lineElapsed<<" s, "<<numPoints/lineElapsed<<" points/s.";
+    qDebug()<<"Mapped parser: "<<numPoints<<" points in "<<mappedElapsed<<" s, "<<numPoints/mappedElapsed<<" points/s.";
+}
+
+void Apps::benchDots(const QString &fileDir, const QString &suffix, double dotsTh, int rounds)
+{
+    QStringList files = Helper::retrieveFilesWithSuffix(fileDir, suffix);
+    qDebug()<<"The folder "<<fileDir<<" contains "<<files.count()<<" trajectory file(s).";
+    if (files.isEmpty())
+        return;
+
+    QVector<Trajectory> trajs = loadNormalizedTrajectories(files);
+
+    // Simplify with the scalar and the SIMD LSSD kernels.
+    bool simdEnabled = DotsSimplifier::isSimdEnabled();
+    QVector<QVector<SpatialTemporalPoint> > results[2];
+    double elapsed[2];
+    qint64 numPoints = 0;
+    for (int simd=0; simd<2; ++simd) {
+        DotsSimplifier::setSimdEnabled(simd == 1);
+        numPoints = 0;
+        QElapsedTimer timer;
+        timer.start();
+        for (int r=0; r<rounds; ++r) {
+            foreach (Trajectory traj, trajs) {
+                Trajectory simplified = traj.simplify(dotsTh);
+                numPoints += traj.count();
+                if (r == 0)
+                    results[simd] << simplified.getPoints();
+            }
+        }
+        elapsed[simd] = timer.nsecsElapsed()*1e-9;
+    }
+    DotsSimplifier::setSimdEnabled(simdEnabled);
+
+    for (int i=0; i<trajs.count(); ++i) {
+        const QVector<SpatialTemporalPoint> &a = results[0].at(i), &b = results[1].at(i);
+        bool same = a.count() == b.count();
+        for (int k=0; same && k<a.count(); ++k)
+            same = a[k].x == b[k].x && a[k].y == b[k].y && a[k].t == b[k].t;
+        if (!same) {
+            qDebug()<<"SIMD kernel differs from scalar kernel on trajectory "<<i;
+            return;
+        }
+    }
+    qDebug()<<"SIMD kernel produces identical simplifications.";
+    qDebug()<<"Scalar LSSD: "<<numPoints<<" points in "<<elapsed[0]<<" s, "<<numPoints/elapsed[0]<<" points/s.";
+    qDebug()<<"SIMD LSSD:   "<<numPoints<<" points in "<<elapsed[1]<<" s, "<<numPoints/elapsed[1]<<" points/s.";
+}
+
+void Apps::benchFleet(int numStreams, int pointsPerStream, double dotsTh, int numThreads)
+{
+    if (numStreams <= 0 || pointsPerStream <= 0)
+        return;
+
+    // Simulate vehicles moving around at 10~30m/s, sampled every 2~5s. The coordinates are in kilometers and kiloseconds
+    // as what Trajectory::simplify() feeds to DOTS.
+    double dotsScale = 0.001;
+    quint32 seed = 20160602;
+    QVector<QVector<double> > xs(numStreams), ys(numStreams), ts(numStreams);
+    for (int s=0; s<numStreams; ++s) {
+        double x = 0, y = 0, t = 0, heading = 0;
+        for (int i=0; i<pointsPerStream; ++i) {
+            xs[s] << x*dotsScale;
+            ys[s] << y*dotsScale;
+            ts[s] << t*dotsScale;
+            seed = seed*1664525u+1013904223u;
+            heading += (seed/4294967296.0-0.5)*0.6;
+            seed = seed*1664525u+1013904223u;
+            double dt = 2.0+3.0*(seed/4294967296.0);
+            seed = seed*1664525u+1013904223u;
+            double speed = 10.0+20.0*(seed/4294967296.0);
+            x += speed*dt*cos(heading);
+            y += speed*dt*sin(heading);
+            t += dt;
+        }
+    }
+
+    // Feed one point of each vehicle per batch.
+    FleetCollector collector(numStreams);
+    QElapsedTimer timer;
+    timer.start();
+    {
+        DotsFleet fleet(dotsTh*dotsScale*dotsScale, &collector, numThreads);
+        QVector<DotsFleet::Point> batch(numStreams);
+        for (int i=0; i<pointsPerStream; ++i) {
+            for (int s=0; s<numStreams; ++s) {
+                DotsFleet::Point &p = batch[s];
+                p.streamId = s;
+                p.x = xs.at(s).at(i);
+                p.y = ys.at(s).at(i);
+                p.t = ts.at(s).at(i);
+            }
+            fleet.feed(batch);
+        }
+        fleet.finish();
+    }
+    double elapsed = timer.nsecsElapsed()*1e-9;
+    qint64 numPoints = (qint64)numStreams*pointsPerStream;
+
+    // Compare with the batch mode.
+    int numDiffer = 0;
+    for (int s=0; s<numStreams; ++s) {
+        QVector<int> batchIndex;
+        DotsSimplifier::batchDotsByIndex(xs.at(s), ys.at(s), ts.at(s), batchIndex, dotsTh*dotsScale*dotsScale);
+        if (batchIndex != collector.indices.at(s))
+            ++numDiffer;
+    }
+    qDebug()<<"Fleet differs from batch mode on "<<numDiffer<<" of "<<numStreams<<" streams.";
+    qDebug()<<"Simplified "<<numPoints<<" points into "<<collector.numOutputs<<" points in "<<elapsed<<" s, "
+           <<numPoints/elapsed<<" points/s.";
+}
+
+void Apps::testDotsStreaming(const QString &fileDir, const QString &suffix, double dotsTh, int minEviction,
+                             bool rebaseSums)
+{
+    QStringList files = Helper::retrieveFilesWithSuffix(fileDir, suffix);
+    qDebug()<<"The folder "<<fileDir<<" contains "<<files.count()<<" trajectory file(s).";
+    if (files.isEmpty())
+        return;
+    QVector<Trajectory> trajs = loadNormalizedTrajectories(files);
+
+    // Simplify each trajectory in the batch mode and in the streaming mode, with the same scaling as simplify().
+    double dotsScale = 0.001;
+    int numDiffer = 0, maxWindow = 0;
+    qint64 numPoints = 0;
+    foreach (Trajectory traj, trajs) {
+        QVector<SpatialTemporalPoint> points = traj.getPoints();
+        QVector<double> x, y, t;
+        foreach (SpatialTemporalPoint p, points) {
+            x << (p.x-points.first().x)*dotsScale;
+            y << (p.y-points.first().y)*dotsScale;
+            t << (p.t-points.first().t)*dotsScale;
+        }
+        QVector<int> batchIndex, streamIndex;
+        DotsSimplifier::batchDotsByIndex(x, y, t, batchIndex, dotsTh*dotsScale*dotsScale);
+
+        DotsSimplifier simplifier;
+        simplifier.setParameters(dotsTh*dotsScale*dotsScale);
+        simplifier.setStreaming(true, minEviction, rebaseSums);
+        int idx;
+        for (int i=0; i<x.count(); ++i) {
+            simplifier.feedData(x.at(i), y.at(i), t.at(i));
+            if (simplifier.readOutputIndex(idx))
+                streamIndex << idx;
+            maxWindow = qMax(maxWindow, simplifier.getWindowSize());
+        }
+        simplifier.finish();
+        while (simplifier.readOutputIndex(idx))
+            streamIndex << idx;
+
+        numPoints += x.count();
+        if (batchIndex != streamIndex)
+            ++numDiffer;
+    }
+    qDebug()<<"Streaming mode differs from batch mode on "<<numDiffer<<" of "<<trajs.count()<<" trajectories.";
+    qDebug()<<"Kept at most "<<maxWindow<<" of "<<numPoints<<" points in the window.";
+}
+
 void Apps::visualizeDataset(const QString &fileDir, const QString &suffix,
                             double range, const QString &patternFile)
 {
@@ -249,7 +1214,8 @@ void Apps::visualizeDataset(const QString &fileDir, const QString &suffix,
 }
 
 void Apps::clusterSegments(const QString &segmentsFile, const QVector<double> &weights,
-                           const QString &outputFile, double thresh, int memoryLim)
+                           const QString &outputFile, double thresh, int memoryLim, int numThreads,
+                           bool useNNChain, int numShards)
 {
     // Checking.
     if (weights.count() != 6) {
@@ -280,10 +1246,24 @@ void Apps::clusterSegments(const QString &segmentsFile, const QVector<double> &w
     try {
         qDebug()<<"Running BIRCH with thresh: "<<thresh
                <<", memory limit: "<<memoryLim<<" bytes.";
-        CFTreeND tree(thresh, memoryLim);
+        if (numShards <= 0)
+            numShards = QThread::idealThreadCount();
         // phase 1 and 2: building, compacting when overflows memory limit
+        // With several shards, each one is a tree built by a thread of its own from a share of the segments,
+        // sharing the memory limit. Their leaf entries are then inserted into the tree, which starts from the
+        // largest threshold the shards have grown to.
+        QVector<CFTreeND *> shards;
         unsigned int numSegments = 0;
-        {
+        double treeThresh = thresh;
+        if (numShards > 1) {
+            numSegments = (unsigned int)buildShards(segFile.fileName(), weights, thresh, memoryLim, numShards, shards);
+            for (int k=0; k<shards.count(); ++k)
+                treeThresh = qMax(treeThresh, shards.at(k)->threshold());
+        }
+        CFTreeND tree(treeThresh, memoryLim);
+        if (!shards.isEmpty()) {
+            mergeShards(shards, tree);
+        } else {
             static const int DIM = CFTreeND::fdim;
             double item[DIM];
             int lid = 0;
@@ -297,8 +1277,8 @@ void Apps::clusterSegments(const QString &segmentsFile, const QVector<double> &w
                 ++numSegments;
                 tree.insert(&item[0]);
             }
-            qDebug()<<"#segments: "<<numSegments;
         }
+        qDebug()<<"#segments: "<<numSegments<<", the tree nodes take "<<tree.memory_usage()<<" bytes.";
 
         // phase 2 or 3: compacting? or clustering?
         // merging overlayed sub-clusters by rebuilding true
@@ -306,7 +1286,7 @@ void Apps::clusterSegments(const QString &segmentsFile, const QVector<double> &w
 
         // phase 3: clustering sub-clusters using the existing clustering algorithm
         CFTreeND::cfentry_vec_type entries;
-        tree.cluster(entries);
+        tree.cluster(entries, useNNChain ? CFTreeND::CLUSTER_NN_CHAIN : CFTreeND::CLUSTER_DEFAULT);
         {
             // Visualize the clusters.
             qDebug()<<"Comment visualization of clusters for time measure.";
@@ -351,8 +1331,12 @@ void Apps::clusterSegments(const QString &segmentsFile, const QVector<double> &w
         //				for example, we have k initial points for k-means clustering algorithm
         //tree.redist_kmeans( items, entries, 0 );
         {
+            // The centroids are computed and indexed once.
+            CentroidIndex centroidIndex(getCentroids(entries), CFTreeND::fdim);
+            if (numThreads <= 0)
+                numThreads = QThread::idealThreadCount();
             std::vector<int> item_cids;
-            static const int BUFFER_SIZE = 1024;
+            static const int BUFFER_SIZE = 1<<16;
             static const int DIM = CFTreeND::fdim;
             segFile.seek(0);
             ItemND itemND;
@@ -372,7 +1356,7 @@ void Apps::clusterSegments(const QString &segmentsFile, const QVector<double> &w
 
                 if (buffer.count() == BUFFER_SIZE || segIn.atEnd()) {
                     //tree.redist( buffer.begin(), buffer.end(), entries, item_cids );
-                    myRedist(entries, buffer, item_cids);
+                    myRedist(centroidIndex, buffer, item_cids, numThreads);
                     for( unsigned int i = 0 ; i < item_cids.size() ; i++ ) {
                         s2cOut<<segIds.at(i)<<item_cids[i];
                     }
@@ -396,30 +1380,268 @@ void Apps::clusterSegments(const QString &segmentsFile, const QVector<double> &w
 
 }
 
-void Apps::myRedist(const CFTreeND::cfentry_vec_type &entries,
+QVector<double> Apps::getCentroids(const CFTreeND::cfentry_vec_type &entries)
+{
+    QVector<double> centroids(entries.size()*CFTreeND::fdim);
+    for (std::size_t k=0; k<entries.size(); ++k) {
+        for (int i=0; i<CFTreeND::fdim; ++i)
+            centroids[k*CFTreeND::fdim+i] = entries[k].sum[i]/entries[k].n;
+    }
+    return centroids;
+}
+
+void Apps::myRedist(const CentroidIndex &index,
                     const QVector<ItemND> &buffer,
-                    std::vector<int> &item_cids)
-{
-    item_cids.clear();
-    foreach (const ItemND &item, buffer) {
-        double minDiff = Helper::INF;
-        std::size_t minIdx = 0;
-        for (std::size_t k=0; k<entries.size(); ++k) {
-            CFTreeND::float_type diff = 0;
-            CFTreeND::float_type avg = 0;
-            for (int i=0; i<CFTreeND::fdim; ++i) {
-                avg = entries[k].sum[i]/entries[k].n;
-                diff += (avg-item[i])*(avg-item[i]);
-            }
-            if (diff < minDiff) {
-                minDiff = diff;
-                minIdx = k;
-            }
+                    std::vector<int> &item_cids,
+                    int numThreads)
+{
+    item_cids.resize(buffer.count());
+    numThreads = qMax(numThreads, 1);
+    int chunk = qMax(256, (buffer.count()+numThreads*4-1)/(numThreads*4));
+    if (numThreads == 1 || buffer.count() <= chunk) {
+        for (int i=0; i<buffer.count(); ++i)
+            item_cids[i] = index.nearest(buffer.at(i).item);
+        return;
+    }
+    QThreadPool pool;
+    pool.setMaxThreadCount(numThreads);
+    for (int from=0; from<buffer.count(); from+=chunk)
+        pool.start(new RedistTask(index, buffer, from, qMin(from+chunk, buffer.count()), item_cids));
+    pool.waitForDone();
+}
+
+qint64 Apps::buildShards(const QString &segFileName, const QVector<double> &weights, double thresh,
+                         int memoryLim, int numShards, QVector<CFTreeND *> &shards)
+{
+    QFileInfo segInfo(segFileName);
+    if (!segInfo.exists() || segInfo.size() % SEG_RECORD_SIZE != 0) {
+        SpatialTemporalException(QString("Malformed segment file %1.").arg(segFileName)).raise();
+    }
+    qint64 numRecords = segInfo.size()/SEG_RECORD_SIZE;
+    QVector<qint64> numRead(numShards, 0);
+    for (int k=0; k<numShards; ++k)
+        shards << new CFTreeND(thresh, memoryLim/numShards);
+    QThreadPool pool;
+    pool.setMaxThreadCount(numShards);
+    for (int k=0; k<numShards; ++k)
+        pool.start(new ShardTask(*shards.at(k), segFileName, weights, numRecords*k/numShards,
+                                 numRecords*(k+1)/numShards, numRead[k]));
+    pool.waitForDone();
+
+    qint64 total = 0;
+    for (int k=0; k<numShards; ++k)
+        total += numRead.at(k);
+    if (total != numRecords) {
+        qDeleteAll(shards);
+        shards.clear();
+        SpatialTemporalException(QString("Read file %1 error.").arg(segFileName)).raise();
+    }
+    return total;
+}
+
+void Apps::mergeShards(QVector<CFTreeND *> &shards, CFTreeND &tree)
+{
+    CFTreeND::cfentry_vec_type entries;
+    for (int k=0; k<shards.count(); ++k) {
+        shards.at(k)->get_entries(entries);
+        delete shards.at(k);
+        shards[k] = NULL;
+        for (unsigned int i=0; i<entries.size(); ++i)
+            tree.insert(entries[i]);
+    }
+    shards.clear();
+}
+
+void Apps::benchCFTree(int numItems, double thresh, int numShards)
+{
+    // Segments around a few hundred centers, weighted the way clusterSegments() does.
+    qsrand(1);
+    static const int DIM = CFTreeND::fdim;
+    static const int NUM_CENTERS = 500;
+    QVector<double> centers(NUM_CENTERS*DIM);
+    for (int i=0; i<centers.count(); ++i)
+        centers[i] = qrand()*20.0/RAND_MAX;
+    QVector<double> items(numItems*DIM);
+    for (int n=0; n<numItems; ++n) {
+        int c = qrand()%NUM_CENTERS;
+        for (int i=0; i<DIM; ++i)
+            items[n*DIM+i] = centers.at(c*DIM+i) + qrand()*1.0/RAND_MAX - 0.5;
+    }
+
+    // The kernels against the scalar distances, on entries of a few items each.
+    int numPairs = qMin(numItems/8, 100000), numDiffs = 0;
+    for (int k=0; k<numPairs; ++k) {
+        CFEntryND lhs(&items[(8*k)*DIM]), rhs(&items[(8*k+1)*DIM]);
+        for (int j=2; j<2+k%6; ++j) {
+            CFEntryND e(&items[(8*k+j)*DIM]);
+            if (j%2 == 0)
+                lhs += e;
+            else
+                rhs += e;
         }
-        item_cids.push_back(minIdx);
+        if (CFTreeND::_DistD0(lhs, rhs) != scalarDistD0(lhs, rhs) ||
+                CFTreeND::_DistD1(lhs, rhs) != scalarDistD1(lhs, rhs) ||
+                CFTreeND::_DistD2(lhs, rhs) != scalarDistD2(lhs, rhs) ||
+                CFTreeND::_DistD3(lhs, rhs) != scalarDistD3(lhs, rhs) ||
+                CFTreeND::_Diameter(lhs) != scalarDiameter(lhs) ||
+                CFTreeND::_Radius(rhs) != scalarRadius(rhs))
+            ++numDiffs;
+    }
+    if (numDiffs == 0)
+        qDebug()<<"The distance kernels agree on "<<numPairs<<" pairs of entries.";
+    else
+        qDebug()<<"The distance kernels DIFFER on "<<numDiffs<<" of "<<numPairs<<" pairs of entries.";
+
+    QElapsedTimer timer;
+    timer.start();
+    CFTreeND tree(thresh, 0);
+    for (int n=0; n<numItems; ++n)
+        tree.insert(&items[n*DIM]);
+    double elapsed = timer.nsecsElapsed()/1e9;
+    CFTreeND::cfentry_vec_type entries;
+    tree.get_entries(entries);
+    qDebug()<<"Built a tree of "<<entries.size()<<" leaf entries from "<<numItems<<" items in "<<elapsed
+           <<" s, "<<numItems/qMax(elapsed, 1e-9)<<" items/s, its nodes taking "<<tree.memory_usage()/1024<<" KB.";
+
+    // The same items from a segment file, by one shard and then by numShards shards the way clusterSegments()
+    // builds with several, parsing included.
+    if (numShards <= 0)
+        numShards = QThread::idealThreadCount();
+    if (numShards <= 1)
+        return;
+    QTemporaryFile segFile;
+    if (!segFile.open()) {
+        SpatialTemporalException("Open temporary segment file error.").raise();
+    }
+    {
+        QDataStream segOut(&segFile);
+        for (int n=0; n<numItems; ++n) {
+            for (int i=0; i<DIM; ++i)
+                segOut<<items.at(n*DIM+i);
+            segOut<<(qint32)n;
+        }
+        segFile.flush();
+    }
+    QVector<double> weights(DIM, 1.0);
+    double baseElapsed = 0;
+    QVector<int> shardCounts;
+    shardCounts << 1 << numShards;
+    foreach (int s, shardCounts) {
+        timer.restart();
+        QVector<CFTreeND *> shards;
+        buildShards(segFile.fileName(), weights, thresh, 0, s, shards);
+        double shardElapsed = timer.nsecsElapsed()/1e9;
+        unsigned int numShardEntries = 0;
+        for (int k=0; k<shards.count(); ++k) {
+            shards.at(k)->get_entries(entries);
+            numShardEntries += entries.size();
+        }
+        CFTreeND mergedTree(thresh, 0);
+        mergeShards(shards, mergedTree);
+        elapsed = timer.nsecsElapsed()/1e9;
+        if (s == 1)
+            baseElapsed = elapsed;
+        mergedTree.get_entries(entries);
+        qDebug()<<"Built "<<s<<" shards of "<<numShardEntries<<" leaf entries in "<<shardElapsed
+               <<" s, and merged them into a tree of "<<entries.size()<<" leaf entries in "<<elapsed-shardElapsed
+               <<" s, "<<numItems/qMax(elapsed, 1e-9)<<" items/s, "<<baseElapsed/qMax(elapsed, 1e-9)
+               <<" times as fast as one shard on "<<QThread::idealThreadCount()<<" cores.";
     }
 }
 
+void Apps::testNNChain(int numItems, double thresh)
+{
+    // Segments around a few hundred centers, as in benchCFTree().
+    qsrand(1);
+    static const int DIM = CFTreeND::fdim;
+    static const int NUM_CENTERS = 500;
+    QVector<double> centers(NUM_CENTERS*DIM);
+    for (int i=0; i<centers.count(); ++i)
+        centers[i] = qrand()*20.0/RAND_MAX;
+    CFTreeND tree(thresh, 0);
+    QVector<double> item(DIM);
+    for (int n=0; n<numItems; ++n) {
+        int c = qrand()%NUM_CENTERS;
+        for (int i=0; i<DIM; ++i)
+            item[i] = centers.at(c*DIM+i) + qrand()*1.0/RAND_MAX - 0.5;
+        tree.insert(item.data());
+    }
+    CFTreeND::cfentry_vec_type leaves;
+    tree.get_entries(leaves);
+    qDebug()<<"Clustering "<<leaves.size()<<" leaf entries.";
+
+    QElapsedTimer timer;
+    timer.start();
+    CFTreeND::cfentry_vec_type entries;
+    tree.cluster(entries);
+    qDebug()<<"The default clustering found "<<entries.size()<<" clusters in "<<timer.elapsed()<<" ms.";
+    timer.restart();
+    tree.cluster(entries, CFTreeND::CLUSTER_NN_CHAIN);
+    qDebug()<<"The nearest-neighbor chains found "<<entries.size()<<" clusters in "<<timer.elapsed()<<" ms.";
+
+    // The greedy reference takes cubic time, so it runs on small trees only.
+    static const unsigned int MAX_REFERENCE_SIZE = 2000;
+    if (leaves.size() > MAX_REFERENCE_SIZE) {
+        qDebug()<<"Too many leaf entries to check against the greedy ward clustering.";
+        return;
+    }
+    greedyWardClusters(leaves, thresh);
+    std::sort(leaves.begin(), leaves.end(), clusterLessThan);
+    std::sort(entries.begin(), entries.end(), clusterLessThan);
+    bool same = leaves.size() == entries.size();
+    for (unsigned int i=0; same && i<entries.size(); ++i) {
+        same = entries[i].n == leaves[i].n && entries[i].sum_sq == leaves[i].sum_sq;
+        for (int j=0; same && j<DIM; ++j)
+            same = entries[i].sum[j] == leaves[i].sum[j];
+    }
+    if (same)
+        qDebug()<<"The nearest-neighbor chains agree with the greedy ward clustering.";
+    else
+        qDebug()<<"The nearest-neighbor chains DIFFER from the greedy ward clustering, which found "
+               <<leaves.size()<<" clusters.";
+}
+
+void Apps::testRedist(int numClusters, int numItems, int numThreads)
+{
+    // Coordinates on a coarse lattice, so that there are plenty of equally near clusters, and the last two
+    // dimensions are weighted by zero as they often are.
+    qsrand(1);
+    QVector<double> centroids(numClusters*CFTreeND::fdim, 0.0);
+    for (int k=0; k<numClusters; ++k) {
+        for (int i=0; i<CFTreeND::fdim-2; ++i)
+            centroids[k*CFTreeND::fdim+i] = (qrand()%64)*0.5;
+    }
+    QVector<ItemND> buffer;
+    ItemND item;
+    for (int n=0; n<numItems; ++n) {
+        for (int i=0; i<CFTreeND::fdim-2; ++i)
+            item[i] = (n%2 == 0) ? (qrand()%64)*0.5 : qrand()*32.0/RAND_MAX;
+        buffer << item;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    CentroidIndex index(centroids, CFTreeND::fdim);
+    double buildElapsed = timer.nsecsElapsed()/1e9;
+    timer.restart();
+    std::vector<int> item_cids;
+    myRedist(index, buffer, item_cids, numThreads);
+    double indexElapsed = timer.nsecsElapsed()/1e9;
+    timer.restart();
+    int numDiffs = 0;
+    for (int n=0; n<numItems; ++n) {
+        if (index.nearestBruteForce(buffer.at(n).item) != item_cids[n])
+            ++numDiffs;
+    }
+    double bruteElapsed = timer.nsecsElapsed()/1e9;
+    qDebug()<<"Indexed "<<numClusters<<" clusters in "<<buildElapsed<<" s, and redistributed "<<numItems
+           <<" items in "<<indexElapsed<<" s, against "<<bruteElapsed<<" s by brute force.";
+    if (numDiffs == 0)
+        qDebug()<<"The redistributions agree.";
+    else
+        qDebug()<<"The redistributions DIFFER at "<<numDiffs<<" items.";
+}
+
 QVector<ItemND> Apps::random(ItemND _inf, ItemND _sup, int num)
 {
     QVector<ItemND> data;
@@ -610,21 +1832,10 @@ void Apps::visualizePatternsFromSPMF(const QString &patterFileName, const QStrin
 
 void Apps::scpm(const QString &clusterFileName, const QString &tincFileName,
                 const QString &outputFileName, double continuityRadius, int minSup,
-                int minLen)
+                int minLen, int numThreads, bool useBitmap, int topK, qint64 memoryBudget)
 {
     // retrieve t2ot.
-    QHash<unsigned int, unsigned int> t2otMap;
-    {
-        QFile t2otFile(tincFileName + ".t2ot");// This should be fixed. not tincFileName.
-        t2otFile.open(QIODevice::ReadOnly);
-        QDataStream fin(&t2otFile);
-        while (!fin.atEnd()) {
-            unsigned k,v;
-            fin >> k >> v;
-            t2otMap[k] = v;
-        }
-        t2otFile.close();
-    }
+    QHash<unsigned int, unsigned int> t2otMap = retrieveT2ot(tincFileName + ".t2ot");// This should be fixed. not tincFileName.
 
     QVector<SegmentLocation> clusters = retrieveClusters(clusterFileName + clusterSuffix);
     QHash<unsigned int, QVector<unsigned int> > scMap =
@@ -648,25 +1859,300 @@ void Apps::scpm(const QString &clusterFileName, const QString &tincFileName,
 //            qApp->exec();
 //        }
 //    }
-    QVector<QVector<unsigned int> > allPatterns;
-    QVector<int> projsFrom;
-    for (int i=0; i<tinc.count(); ++i)
-        projsFrom<<0;
+    // The command line rejects these combinations, so this only tells the other callers which setting wins.
+    if (memoryBudget > 0 && (topK > 0 || useBitmap))
+        qDebug()<<"The memory budget is ignored by the "<<(topK > 0 ? "top-k" : "bitmap")<<" mining.";
+    else if (memoryBudget > 0 && numThreads != 1)
+        qDebug()<<"The memory budget mines on one thread, instead of "<<numThreads<<".";
+    if (topK > 0) {
+        scpmTopK(clusters, tinc, scMap, t2otMap, outputFileName, minSup, minLen, topK);
+        return;
+    }
 
-    prefixSpan(QVector<unsigned int>(),
-               tinc,
-               projsFrom,
-               scMap,
-               t2otMap,
-               allPatterns,
-               minSup);
-    allPatterns = cleanShortPatterns(allPatterns);
+    // Only the maximal patterns are mined, so the ones being prefixes of others are never stored.
+    QVector<QVector<unsigned int> > allPatterns;
+    if (useBitmap) {
+        qDebug()<<"Mining with the bitmap engine.";
+        BitmapMiner(tinc, t2otMap).mine(scMap, minSup, allPatterns, true);
+    } else if (memoryBudget > 0) {
+        qDebug()<<"Mining within a memory budget of "<<(memoryBudget>>20)<<" MB.";
+        BudgetedMiner miner(tinc, t2otMap, memoryBudget);
+        miner.mine(scMap, minSup, allPatterns, true);
+        miner.report();
+    } else {
+        mineWithPrefixSpan(tinc, scMap, t2otMap, allPatterns, minSup, numThreads, true);
+    }
+    allPatterns = cleanSuffixPatterns(allPatterns);
     qDebug()<<"Totally "<<allPatterns.count()<<" patterns were found.";
     storePatterns(allPatterns, clusters, outputFileName);
     qDebug()<<"Comment visualization of patterns for time measure.";
     //visualizePatterns(allPatterns, clusters, minLen);
 }
 
+void Apps::scpmTopK(const QVector<SegmentLocation> &clusters, const QVector<QVector<unsigned int> > &tinc,
+                    const QHash<unsigned int, QVector<unsigned int> > &scMap,
+                    const QHash<unsigned int, unsigned int> &t2otMap,
+                    const QString &outputFileName, int minSup, int minLen, int topK)
+{
+    QFile patternFile(outputFileName + patternSuffix);
+    if (!patternFile.open(QIODevice::WriteOnly)) {
+        SpatialTemporalException(QString("Open st-pattern file %1 error.").arg(outputFileName)).raise();
+    }
+    QDataStream patternOut(&patternFile);
+
+    qDebug()<<"Mining the top "<<topK<<" patterns.";
+    TincIndex index(tinc);
+    QVector<PseudoProjection> projs(tinc.count());
+    for (int i=0; i<tinc.count(); ++i) {
+        projs[i].seqId = i;
+        projs[i].offset = 0;
+    }
+    TopKMiner miner(index, scMap, t2otMap, minSup, minLen, topK);
+    miner.setOutput(&patternOut, &clusters);
+    miner.mine(projs);
+    patternFile.close();
+    qDebug()<<"Totally "<<miner.patterns.count()<<" patterns were found.";
+    if (!miner.supports.isEmpty()) {
+        qDebug()<<"Supports range from "<<miner.supports.first()<<" to "<<miner.supports.last()<<".";
+    }
+}
+
+void Apps::testTopK(const QString &clusterFileName, const QString &tincFileName,
+                    double continuityRadius, int minSup, int minLen, int topK)
+{
+    QHash<unsigned int, unsigned int> t2otMap = retrieveT2ot(tincFileName + ".t2ot");
+    QVector<SegmentLocation> clusters = retrieveClusters(clusterFileName + clusterSuffix);
+    QHash<unsigned int, QVector<unsigned int> > scMap =
+            getSpatialContinuityMap(clusters, continuityRadius);
+    QVector<QVector<unsigned int> > tinc = retrieveTinC(tincFileName + tincSuffix);
+    TincIndex index(tinc);
+    QVector<PseudoProjection> projs(tinc.count());
+    for (int i=0; i<tinc.count(); ++i) {
+        projs[i].seqId = i;
+        projs[i].offset = 0;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    TopKMiner miner(index, scMap, t2otMap, minSup, minLen, topK);
+    miner.mine(projs);
+    double topKElapsed = timer.nsecsElapsed()/1e9;
+    timer.restart();
+    QVector<QPair<int, int> > allRanks;
+    if (tinc.count() >= minSup)
+        collectAllRanks(0, scMap.keys().toVector(), projs, index, scMap, t2otMap, minSup, allRanks);
+    double allElapsed = timer.nsecsElapsed()/1e9;
+
+    // The best ranks among all the patterns. The patterns of equal ranks may differ by the order they
+    // were found in, so only their supports and lengths are compared, and the supports are recounted.
+    int numPatterns = allRanks.count();
+    QVector<QPair<int, int> > expected;
+    for (int i=0; i<allRanks.count(); ++i) {
+        if (-allRanks.at(i).second >= minLen)
+            expected << allRanks.at(i);
+    }
+    std::sort(expected.begin(), expected.end());
+    expected.resize(qMin(expected.count(), qMax(topK, 0)));
+    bool agree = expected.count() == miner.patterns.count();
+    for (int i=0; agree && i<expected.count(); ++i) {
+        const QVector<unsigned int> &pattern = miner.patterns.at(i);
+        QVector<PseudoProjection> patternProjs = projs, newProjs;
+        int support = 0;
+        foreach (unsigned int c, pattern) {
+            support = index.project(c, patternProjs, t2otMap, newProjs);
+            patternProjs = newProjs;
+        }
+        agree = expected.at(i) == qMakePair(-miner.supports.at(i), -pattern.count()) &&
+                support == miner.supports.at(i);
+    }
+    qDebug()<<"Top-k mode kept "<<miner.patterns.count()<<" patterns in "<<topKElapsed<<" s.";
+    qDebug()<<"Exhaustive search found "<<numPatterns<<" patterns in "<<allElapsed<<" s.";
+    qDebug()<<(agree ? "The top patterns agree." : "The top patterns DIFFER.");
+}
+
+void Apps::scpmIncremental(const QString &clusterFileName, const QString &tincFileName,
+                           const QString &stateFileName, const QString &outputFileName,
+                           double continuityRadius, int minSup)
+{
+    QHash<unsigned int, unsigned int> t2otMap = retrieveT2ot(tincFileName + ".t2ot");
+    QVector<SegmentLocation> clusters = retrieveClusters(clusterFileName + clusterSuffix);
+    QHash<unsigned int, QVector<unsigned int> > scMap =
+            getSpatialContinuityMap(clusters, continuityRadius);
+    QVector<QVector<unsigned int> > tinc = retrieveTinC(tincFileName + tincSuffix);
+
+    IncrementalMiner miner(scMap, continuityRadius, clusters.count(), minSup);
+    if (QFile::exists(stateFileName)) {
+        miner.load(stateFileName);
+        qDebug()<<"Appending "<<tinc.count()<<" transactions to the "<<miner.transactionCount()
+               <<" ones having "<<miner.patternCount()<<" frequent patterns.";
+    }
+    miner.append(tinc, t2otMap);
+    miner.save(stateFileName);
+
+    QVector<QVector<unsigned int> > allPatterns;
+    miner.collectMaximalPatterns(allPatterns);
+    allPatterns = cleanSuffixPatterns(allPatterns);
+    qDebug()<<"Totally "<<allPatterns.count()<<" patterns were found.";
+    storePatterns(allPatterns, clusters, outputFileName);
+}
+
+void Apps::testIncrementalMining(const QString &clusterFileName, const QString &tincFileName,
+                                 double continuityRadius, int minSup, int numParts)
+{
+    QHash<unsigned int, unsigned int> t2otMap = retrieveT2ot(tincFileName + ".t2ot");
+    QVector<SegmentLocation> clusters = retrieveClusters(clusterFileName + clusterSuffix);
+    QHash<unsigned int, QVector<unsigned int> > scMap =
+            getSpatialContinuityMap(clusters, continuityRadius);
+    QVector<QVector<unsigned int> > tinc = retrieveTinC(tincFileName + tincSuffix);
+    numParts = qMax(numParts, 1);
+
+    // Split the trajectories into parts, each of which numbers its own trajectories from 0 the way a new
+    // tinc does. The parts are appended one by one, and all of them are mined at once as the reference.
+    QHash<unsigned int, int> otRanks;
+    for (int i=0; i<tinc.count(); ++i) {
+        QHash<unsigned int, unsigned int>::const_iterator it = t2otMap.constFind(i);
+        if (it == t2otMap.constEnd()) {
+            SpatialTemporalException("Found t2otMap does not contain one id.").raise();
+        }
+        if (!otRanks.contains(it.value()))
+            otRanks.insert(it.value(), otRanks.count());
+    }
+    QVector<QVector<QVector<unsigned int> > > partTincs(numParts);
+    QVector<QHash<unsigned int, unsigned int> > partT2otMaps(numParts);
+    QVector<QHash<unsigned int, unsigned int> > partOtIds(numParts);
+    for (int i=0; i<tinc.count(); ++i) {
+        unsigned int ot = t2otMap.value(i);
+        int part = (int)((qint64)otRanks.value(ot)*numParts/otRanks.count());
+        if (!partOtIds[part].contains(ot))
+            partOtIds[part].insert(ot, partOtIds[part].count());
+        partT2otMaps[part].insert(partTincs[part].count(), partOtIds[part].value(ot));
+        partTincs[part] << tinc.at(i);
+    }
+    QVector<QVector<unsigned int> > allTinc;
+    QHash<unsigned int, unsigned int> allT2otMap;
+    unsigned int otBase = 0;
+    for (int p=0; p<numParts; ++p) {
+        for (int i=0; i<partTincs.at(p).count(); ++i) {
+            allT2otMap.insert(allTinc.count(), partT2otMaps.at(p).value(i) + otBase);
+            allTinc << partTincs.at(p).at(i);
+        }
+        otBase += partOtIds.at(p).count();
+    }
+
+    QTemporaryFile stateFile;
+    if (!stateFile.open()) {
+        SpatialTemporalException("Open temporary mining state file error.").raise();
+    }
+    stateFile.close();
+    QElapsedTimer timer;
+    bool agree = true;
+    for (int p=0; p<numParts; ++p) {
+        timer.start();
+        IncrementalMiner miner(scMap, continuityRadius, clusters.count(), minSup);
+        if (p > 0)
+            miner.load(stateFile.fileName());
+        miner.append(partTincs.at(p), partT2otMaps.at(p));
+        miner.save(stateFile.fileName());
+        QVector<QVector<unsigned int> > patterns;
+        miner.collectMaximalPatterns(patterns);
+        double incElapsed = timer.nsecsElapsed()/1e9;
+
+        // Mine the transactions appended so far from scratch.
+        timer.restart();
+        QVector<QVector<unsigned int> > expected;
+        mineWithPrefixSpan(allTinc.mid(0, miner.transactionCount()), scMap, allT2otMap, expected, minSup, 1, true);
+        double fullElapsed = timer.nsecsElapsed()/1e9;
+        bool partAgree = patterns == expected;
+        agree = agree && partAgree;
+        qDebug()<<"Part "<<p<<": "<<miner.transactionCount()<<" transactions, "<<miner.patternCount()
+               <<" frequent patterns, "<<patterns.count()<<" maximal ones"<<(partAgree ? "" : " DIFFER")
+              <<". Incremental "<<incElapsed<<" s, full "<<fullElapsed<<" s.";
+    }
+    qDebug()<<(agree ? "The incremental patterns agree." : "The incremental patterns DIFFER.");
+}
+
+void Apps::mineWithPrefixSpan(const QVector<QVector<unsigned int> > &tinc,
+                              const QHash<unsigned int, QVector<unsigned int> > &scMap,
+                              const QHash<unsigned int, unsigned int> &t2otMap,
+                              QVector<QVector<unsigned int> > &allPatterns,
+                              int minSup, int numThreads, bool maximal)
+{
+    TincIndex index(tinc);
+    QVector<PseudoProjection> projs(tinc.count());
+    for (int i=0; i<tinc.count(); ++i) {
+        projs[i].seqId = i;
+        projs[i].offset = 0;
+    }
+
+    if (numThreads <= 0)
+        numThreads = QThread::idealThreadCount();
+    if (numThreads <= 1) {
+        prefixSpan(QVector<unsigned int>(),
+                   index,
+                   projs,
+                   scMap,
+                   t2otMap,
+                   allPatterns,
+                   minSup,
+                   maximal);
+    } else {
+        qDebug()<<"Mining with "<<numThreads<<" worker threads.";
+        parallelPrefixSpan(index, projs, scMap, t2otMap, allPatterns, minSup, numThreads, maximal);
+    }
+}
+
+void Apps::checkMiningEngines(const QString &clusterFileName, const QString &tincFileName,
+                              double continuityRadius, int minSup)
+{
+    QHash<unsigned int, unsigned int> t2otMap = retrieveT2ot(tincFileName + ".t2ot");
+    QVector<SegmentLocation> clusters = retrieveClusters(clusterFileName + clusterSuffix);
+    QHash<unsigned int, QVector<unsigned int> > scMap =
+            getSpatialContinuityMap(clusters, continuityRadius);
+    QVector<QVector<unsigned int> > tinc = retrieveTinC(tincFileName + tincSuffix);
+
+    // Both engines should find the same patterns in the same order, before they are cleaned.
+    QElapsedTimer timer;
+    timer.start();
+    QVector<QVector<unsigned int> > prefixSpanPatterns;
+    mineWithPrefixSpan(tinc, scMap, t2otMap, prefixSpanPatterns, minSup, 1, false);
+    double prefixSpanElapsed = timer.nsecsElapsed()/1e9;
+    timer.restart();
+    QVector<QVector<unsigned int> > bitmapPatterns;
+    BitmapMiner(tinc, t2otMap).mine(scMap, minSup, bitmapPatterns, false);
+    double bitmapElapsed = timer.nsecsElapsed()/1e9;
+    // No budget at all, so that every projected database is spilled.
+    timer.restart();
+    QVector<QVector<unsigned int> > spilledPatterns;
+    BudgetedMiner spillingMiner(tinc, t2otMap, 0);
+    spillingMiner.mine(scMap, minSup, spilledPatterns, false);
+    double spilledElapsed = timer.nsecsElapsed()/1e9;
+
+    qDebug()<<"PrefixSpan found "<<prefixSpanPatterns.count()<<" patterns in "<<prefixSpanElapsed<<" s.";
+    qDebug()<<"Bitmap engine found "<<bitmapPatterns.count()<<" patterns in "<<bitmapElapsed<<" s.";
+    qDebug()<<"Spilling PrefixSpan found "<<spilledPatterns.count()<<" patterns in "<<spilledElapsed<<" s.";
+    spillingMiner.report();
+    qDebug()<<(prefixSpanPatterns == bitmapPatterns && prefixSpanPatterns == spilledPatterns ?
+                   "The engines agree." : "The engines DIFFER.");
+
+    // The maximal mode should end up with the same patterns as cleaning up all of them.
+    timer.restart();
+    QVector<QVector<unsigned int> > cleaned = cleanShortPatterns(prefixSpanPatterns);
+    double cleanElapsed = timer.nsecsElapsed()/1e9;
+    timer.restart();
+    QVector<QVector<unsigned int> > maximalPatterns, bitmapMaximalPatterns;
+    mineWithPrefixSpan(tinc, scMap, t2otMap, maximalPatterns, minSup, 1, true);
+    int numMaximal = maximalPatterns.count();
+    maximalPatterns = cleanSuffixPatterns(maximalPatterns);
+    double maximalElapsed = timer.nsecsElapsed()/1e9;
+    BitmapMiner(tinc, t2otMap).mine(scMap, minSup, bitmapMaximalPatterns, true);
+    bitmapMaximalPatterns = cleanSuffixPatterns(bitmapMaximalPatterns);
+    qDebug()<<"Cleaned "<<prefixSpanPatterns.count()<<" patterns into "<<cleaned.count()<<" in "<<cleanElapsed<<" s.";
+    qDebug()<<"Maximal mode stored "<<numMaximal<<" patterns, and mined "<<maximalPatterns.count()
+           <<" in "<<maximalElapsed<<" s.";
+    qDebug()<<(maximalPatterns == cleaned && bitmapMaximalPatterns == cleaned ?
+                   "The maximal mode agrees." : "The maximal mode DIFFERS.");
+}
+
 void Apps::storePatterns(const QVector<QVector<unsigned int> > &allPatterns,
                          const QVector<SegmentLocation> &clusters,
                          const QString &patternFileName)
@@ -677,12 +2163,7 @@ void Apps::storePatterns(const QVector<QVector<unsigned int> > &allPatterns,
     }
     QDataStream patternOut(&patternFile);
     foreach (QVector<unsigned int> pattern, allPatterns) {
-        patternOut << pattern.count();
-        foreach (unsigned int id, pattern) {
-            patternOut << clusters[id];
-            //printf("%d, ", id);
-        }
-        //printf("\n");
+        writePattern(patternOut, pattern, clusters);
     }
     patternFile.close();
 }
@@ -719,21 +2200,23 @@ void Apps::visualizePatterns(const QVector<QVector<unsigned int> > &allPatterns,
 }
 
 void Apps::prefixSpan(const QVector<unsigned int> &currPrefix,
-                      const QVector<QVector<unsigned int> > &projs,
-                      const QVector<int> &projsFrom,
-                      const QHash<unsigned int, QVector<unsigned int> > scMap,
+                      const TincIndex &index,
+                      const QVector<PseudoProjection> &projs,
+                      const QHash<unsigned int, QVector<unsigned int> > &scMap,
                       const QHash<unsigned int, unsigned int> &t2otMap,
                       QVector<QVector<unsigned int> > &allPatterns,
-                      int minSup)
+                      int minSup, bool maximal)
 {
     if (projs.count() < minSup)
         return;
     // Specify items to check.
     QVector<unsigned int> toCheck;
     if (currPrefix.isEmpty()) {
+        // Sorted, since the order of hash keys differs from run to run.
         toCheck = scMap.keys().toVector();
+        std::sort(toCheck.begin(), toCheck.end());
     } else {
-        toCheck = scMap[currPrefix.last()];
+        toCheck = scMap.value(currPrefix.last());
     }
     //qDebug()<<"Prefix: "<<currPrefix<<", tocheck: "<<toCheck;
     if (toCheck.isEmpty())
@@ -744,7 +2227,7 @@ void Apps::prefixSpan(const QVector<unsigned int> &currPrefix,
 //    foreach (unsigned int c, toCheck) {
 //        int counter = 0;
 //        for (int i=0; i<projs.count(); ++i) {
-//            if (projs[i].indexOf(c, projsFrom[i]) >= 0)
+//            if (index.indexOf(projs[i].seqId, c, projs[i].offset) >= 0)
 //                ++counter;
 //        }
 //        if (counter >= minSup)
@@ -753,34 +2236,19 @@ void Apps::prefixSpan(const QVector<unsigned int> &currPrefix,
 //    if (freq.isEmpty())
 //        return;
     //qDebug()<<"Prefix: "<<currPrefix<<", freq: "<<freq;
-    // Store patterns and invoke PrefixSpan recursively.
+    // Store patterns and invoke PrefixSpan recursively. The projections only point into the indexed
+    // transactions, so that no transaction is ever copied, and t2otMap is always looked up by the
+    // transaction id.
+    QVector<PseudoProjection> newProjs;
     foreach (unsigned int c, toCheck) {
         QVector<unsigned int> newPrefix = currPrefix;
         newPrefix.append(c);
-        //allPatterns <<  newPrefix;
-        //int beforePatternsCount = allPatterns.count();
-        QSet<unsigned int> uniqueIds;
-        QHash<unsigned int, unsigned int> newT2otMap;
-        QVector<QVector<unsigned int> > newProjs;
-        QVector<int> newProjsFrom;
-        for (int i=0; i<projs.count(); ++i) {
-            int idx = projs[i].indexOf(c, projsFrom[i]);
-            if (idx >= 0 && idx < projs[i].count()-1) {
-                newProjs << projs[i];
-                newProjsFrom << (idx+1);
-                if (!t2otMap.contains(i)) {
-                    SpatialTemporalException("Found t2otMap does not contain one id.").raise();
-                }
-                newT2otMap[newProjs.count()-1] = t2otMap[i];
-                uniqueIds.insert(t2otMap[i]);
-            }
-        }
-        //qDebug()<<"New projs and new from for"<<c<<" is "<<newProjs<<", "<<newProjsFrom;
-        if (uniqueIds.count() >= minSup) {
-            prefixSpan(newPrefix, newProjs, newProjsFrom, scMap, newT2otMap, allPatterns, minSup);
-            // Check if this is a leaf node of the prefix-span tree. However we will construct
-            // a (suffix) trie to solve this problem.
-            if (true) {//beforePatternsCount == allPatterns.count()) {
+        if (index.project(c, projs, t2otMap, newProjs) >= minSup) {
+            int beforePatternsCount = allPatterns.count();
+            prefixSpan(newPrefix, index, newProjs, scMap, t2otMap, allPatterns, minSup, maximal);
+            // In the maximal mode only the leaves of the prefix-span tree are kept, since the
+            // other patterns are prefixes of them.
+            if (!maximal || beforePatternsCount == allPatterns.count()) {
                 allPatterns << newPrefix;
             }
         }
@@ -788,6 +2256,29 @@ void Apps::prefixSpan(const QVector<unsigned int> &currPrefix,
     }
 }
 
+void Apps::parallelPrefixSpan(const TincIndex &index,
+                              const QVector<PseudoProjection> &projs,
+                              const QHash<unsigned int, QVector<unsigned int> > &scMap,
+                              const QHash<unsigned int, unsigned int> &t2otMap,
+                              QVector<QVector<unsigned int> > &allPatterns,
+                              int minSup, int numThreads, bool maximal)
+{
+    // Subtrees are mined by the pool in any order, each into its own node. The nodes are flattened
+    // afterwards, so the patterns are in the same order as the ones of prefixSpan().
+    MiningNode root;
+    root.projs = projs;
+    {
+        QThreadPool pool;
+        pool.setMaxThreadCount(numThreads);
+        pool.start(new MiningTask(&root, &pool, index, scMap, t2otMap, minSup, maximal));
+        pool.waitForDone();
+    }
+    QString error;
+    collectPatterns(&root, maximal, allPatterns, error);
+    if (!error.isEmpty())
+        SpatialTemporalException(error).raise();
+}
+
 void Apps::testPrefixSpan()
 {
     // Data preparation.
@@ -799,9 +2290,11 @@ void Apps::testPrefixSpan()
     qDebug()<<"T1: "<<t1;
     qDebug()<<"T2: "<<t2;
     QVector<QVector<unsigned int> > allPatterns;
-    QVector<int> projsFrom;
-    for (int i=0; i<tinc.count(); ++i)
-        projsFrom<<0;
+    QVector<PseudoProjection> projs(tinc.count());
+    for (int i=0; i<tinc.count(); ++i) {
+        projs[i].seqId = i;
+        projs[i].offset = 0;
+    }
     QHash<unsigned int, QVector<unsigned int> > scMap;
     QVector<unsigned int> n1, n2, n3, n4, n5;
     n1<<2<<3<<4;
@@ -821,8 +2314,8 @@ void Apps::testPrefixSpan()
 
     // Evaluation.
     prefixSpan(QVector<unsigned int>(),
-               tinc,
-               projsFrom,
+               TincIndex(tinc),
+               projs,
                scMap,
                t2otMap,
                allPatterns,
@@ -859,10 +2352,49 @@ QVector<SegmentLocation> Apps::retrieveClusters(const QString &clusterFileName)
 QHash<unsigned int, QVector<unsigned int> > Apps::getSpatialContinuityMap(
         const QVector<SegmentLocation> &clusters, double continuityRadius)
 {
+    // The grid needs a positive cell size, and cell coordinates that fit into integers.
+    if (!(continuityRadius > 0) || !std::isfinite(continuityRadius))
+        return getSpatialContinuityMapBruteForce(clusters, continuityRadius);
+    static const double MAX_CELL = 1e15;
+    foreach (const SegmentLocation &l, clusters) {
+        if (!(qAbs(l.x/continuityRadius) < MAX_CELL && qAbs(l.y/continuityRadius) < MAX_CELL &&
+              qAbs((l.x+l.rx)/continuityRadius) < MAX_CELL && qAbs((l.y+l.ry)/continuityRadius) < MAX_CELL))
+            return getSpatialContinuityMapBruteForce(clusters, continuityRadius);
+    }
+
+    // Locate the start points in a grid of cell size continuityRadius, sorted by cells.
+    int numThreads = qMax(QThread::idealThreadCount(), 1);
+    int chunk = qMax(1024, (clusters.count()+numThreads*4-1)/(numThreads*4));
+    QThreadPool pool;
+    pool.setMaxThreadCount(numThreads);
+    QVector<GridEntry> grid(clusters.count());
+    for (int from=0; from<clusters.count(); from+=chunk)
+        pool.start(new GridTask(clusters, continuityRadius, from, qMin(from+chunk, clusters.count()), grid));
+    pool.waitForDone();
+    std::sort(grid.begin(), grid.end());
+
+    // Each end point only tests the start points in the nearby cells.
+    QVector<QVector<unsigned int> > neighbors(clusters.count());
+    for (int from=0; from<clusters.count(); from+=chunk) {
+        pool.start(new ContinuityTask(clusters, grid, continuityRadius, from, qMin(from+chunk, clusters.count()),
+                                      neighbors));
+    }
+    pool.waitForDone();
+
     QHash<unsigned int, QVector<unsigned int> > scMap;
-    foreach (SegmentLocation l1, clusters) {
+    scMap.reserve(clusters.count());
+    for (int i=0; i<clusters.count(); ++i)
+        scMap[clusters.at(i).id] = neighbors.at(i);
+    return scMap;
+}
+
+QHash<unsigned int, QVector<unsigned int> > Apps::getSpatialContinuityMapBruteForce(
+        const QVector<SegmentLocation> &clusters, double continuityRadius)
+{
+    QHash<unsigned int, QVector<unsigned int> > scMap;
+    foreach (const SegmentLocation &l1, clusters) {
         QVector<unsigned int> nb;
-        foreach (SegmentLocation l2, clusters) {
+        foreach (const SegmentLocation &l2, clusters) {
             if (l1.id != l2.id) {
                 double diffX = l2.x-l1.x-l1.rx;
                 double diffY = l2.y-l1.y-l1.ry;
@@ -875,6 +2407,49 @@ QHash<unsigned int, QVector<unsigned int> > Apps::getSpatialContinuityMap(
     return scMap;
 }
 
+void Apps::testSpatialContinuityMap(const QString &clusterFileName, double continuityRadius)
+{
+    QVector<SegmentLocation> clusters = retrieveClusters(clusterFileName + clusterSuffix);
+    qDebug()<<"Retrieved "<<clusters.count()<<" clusters.";
+
+    QElapsedTimer timer;
+    timer.start();
+    QHash<unsigned int, QVector<unsigned int> > gridMap = getSpatialContinuityMap(clusters, continuityRadius);
+    double gridElapsed = timer.nsecsElapsed()/1e9;
+    timer.restart();
+    QHash<unsigned int, QVector<unsigned int> > bruteMap = getSpatialContinuityMapBruteForce(clusters, continuityRadius);
+    double bruteElapsed = timer.nsecsElapsed()/1e9;
+
+    // Both maps should have the same neighbors in the same order.
+    int numDiffer = 0;
+    qint64 numNeighbors = 0;
+    foreach (unsigned int id, bruteMap.keys()) {
+        numNeighbors += bruteMap.value(id).count();
+        if (!gridMap.contains(id) || gridMap.value(id) != bruteMap.value(id))
+            ++numDiffer;
+    }
+    if (gridMap.count() != bruteMap.count())
+        ++numDiffer;
+    qDebug()<<"Grid index differs from brute force on "<<numDiffer<<" of "<<bruteMap.count()<<" clusters, with "
+           <<numNeighbors<<" continuous pairs in total.";
+    qDebug()<<"Grid index took "<<gridElapsed<<" s, brute force took "<<bruteElapsed<<" s.";
+}
+
+QHash<unsigned int, unsigned int> Apps::retrieveT2ot(const QString &t2otFileName)
+{
+    QHash<unsigned int, unsigned int> t2otMap;
+    QFile t2otFile(t2otFileName);
+    t2otFile.open(QIODevice::ReadOnly);
+    QDataStream fin(&t2otFile);
+    while (!fin.atEnd()) {
+        unsigned k,v;
+        fin >> k >> v;
+        t2otMap[k] = v;
+    }
+    t2otFile.close();
+    return t2otMap;
+}
+
 QVector<QVector<unsigned int> > Apps::retrieveTinC(const QString &tincFileName)
 {
     // Open file.
@@ -937,6 +2512,95 @@ void Apps::testTrie()
     }
 }
 
+namespace {
+
+// Cleans the patterns the way cleanShortPatterns() used to, with one heap node per trie node and reversed
+// copies of the patterns. Kept as the reference of benchTrie().
+QVector<QVector<unsigned int> > cleanWithTrieNodes(const QVector<QVector<unsigned int> > &patterns,
+                                                   int &numReversed)
+{
+    QVector<QVector<unsigned int> > cleaned = patterns;
+    for (int pass=0; pass<2; ++pass) {
+        TrieNode<unsigned int> *root = new TrieNode<unsigned int>();
+        foreach (QVector<unsigned int> pattern, cleaned) {
+            root->insert(pattern, 0);
+        }
+        QVector<QVector<unsigned int> > leaves;
+        root->collectLeaves(leaves);
+        delete root;
+
+        // Reverse the patterns, for removing the suffixes in the second pass and restoring them after it.
+        cleaned.resize(0);
+        foreach (QVector<unsigned int> pattern, leaves) {
+            QVector<unsigned int> reversed;
+            for (int i=pattern.count()-1; i>=0; --i)
+                reversed.append(pattern.at(i));
+            cleaned.append(reversed);
+        }
+        numReversed += leaves.count();
+    }
+    return cleaned;
+}
+
+}
+
+void Apps::benchTrie(int numPatterns, int seed)
+{
+    // Synthetic patterns like the mined ones: random walks over a continuity graph, with all their prefixes.
+    static const int NUM_ITEMS = 10000, NUM_NEIGHBORS = 8, MIN_LENGTH = 3, MAX_LENGTH = 12;
+    qsrand(seed);
+    QVector<QVector<unsigned int> > neighbors(NUM_ITEMS);
+    for (int i=0; i<NUM_ITEMS; ++i) {
+        for (int j=0; j<NUM_NEIGHBORS; ++j)
+            neighbors[i] << (unsigned int)(qrand()%NUM_ITEMS);
+    }
+    QVector<QVector<unsigned int> > patterns;
+    qint64 numElements = 0;
+    while (patterns.count() < numPatterns) {
+        QVector<unsigned int> walk;
+        walk << (unsigned int)(qrand()%NUM_ITEMS);
+        int length = MIN_LENGTH + qrand()%(MAX_LENGTH-MIN_LENGTH+1);
+        while (walk.count() < length) {
+            walk << neighbors.at(walk.last()).at(qrand()%NUM_NEIGHBORS);
+            if (walk.count() >= 2 && patterns.count() < numPatterns) {
+                patterns << walk;
+                numElements += walk.count();
+            }
+        }
+    }
+    qDebug()<<"Generated "<<patterns.count()<<" patterns of "<<numElements<<" elements.";
+
+    // The old cleaning.
+    QElapsedTimer timer;
+    timer.start();
+    int numReversed = 0;
+    QVector<QVector<unsigned int> > oldCleaned = cleanWithTrieNodes(patterns, numReversed);
+    double oldElapsed = timer.nsecsElapsed()/1e9;
+
+    // The compact tries, built the same way as cleanShortPatterns() does, to count their allocations.
+    timer.restart();
+    CompactTrie<unsigned int> prefixTrie, suffixTrie(true);
+    for (int i=0; i<patterns.count(); ++i)
+        prefixTrie.insert(patterns.at(i));
+    QVector<QVector<unsigned int> > nonPrefixPatterns;
+    prefixTrie.collectLeaves(nonPrefixPatterns);
+    for (int i=0; i<nonPrefixPatterns.count(); ++i)
+        suffixTrie.insert(nonPrefixPatterns.at(i));
+    QVector<QVector<unsigned int> > newCleaned;
+    suffixTrie.collectLeaves(newCleaned);
+    double newElapsed = timer.nsecsElapsed()/1e9;
+
+    // The old tries had one node per node of the compact ones.
+    int numNodes = prefixTrie.nodeCount() + suffixTrie.nodeCount();
+    qDebug()<<"TrieNode: "<<oldElapsed<<" s, "<<numNodes<<" node allocations and "<<numReversed
+           <<" reversed copies.";
+    qDebug()<<"CompactTrie: "<<newElapsed<<" s, "<<prefixTrie.growthCount()+suffixTrie.growthCount()
+           <<" arena and hash growths, no reversed copies.";
+    qDebug()<<"Kept "<<newCleaned.count()<<" patterns. "
+           <<(oldCleaned == newCleaned && cleanShortPatterns(patterns) == newCleaned ?
+                  "The tries agree." : "The tries DIFFER.");
+}
+
 void Apps::evaluateMiningResults(const QString &patternFileName,
                                  const QString &referenceTrajFilePath,
                                  const QString &originalTrajFilePath)
@@ -9,7 +9,10 @@
 #include "birch/CFTree.h"
 #include <algorithm>
 #include "SpatialTemporalSegment.h"
-#include "TrieNode.h"
+#include "Trajectory.h"
+#include "CompactTrie.h"
+#include "TincIndex.h"
+#include "CentroidIndex.h"
 
 // The CF tree of specified dimension.
 typedef CFTree<6> CFTreeND;
@@ -41,9 +44,22 @@ public:
     // The segmentation phase.
     static void segmentTrajectories(const QString &fileDir, const QString &suffix,
                                     const QString &outputFile,
-                                    double segStep, bool useTemporal, double minLength, bool useSEST, double dotsTh);
+                                    double segStep, bool useTemporal, double minLength, bool useSEST, double dotsTh,
+                                    int numThreads = 1, bool pipelineSEST = false);
+    static QVector<Trajectory> segmentTrajectory(const QString &file, const SpatialTemporalPoint &reference,
+                                                 double segStep, bool useTemporal, bool useSEST, double dotsTh,
+                                                 bool pipelineSEST = false);
+    static QVector<Trajectory> segmentTrajectory(Trajectory &projected,
+                                                 double segStep, bool useTemporal, bool useSEST, double dotsTh,
+                                                 bool pipelineSEST = false);
+    static void importTrajectories(const QString &fileDir, const QString &suffix, const QString &outputFile);
     static QVector<SegmentLocation> filterSegments(const QVector<SegmentLocation> &segments, double minLength);
     static void testSegmentation();
+    static void benchParsers(const QString &fileDir, const QString &suffix, int rounds);
+    static void benchDots(const QString &fileDir, const QString &suffix, double dotsTh, int rounds);
+    static void benchFleet(int numStreams, int pointsPerStream, double dotsTh, int numThreads);
+    static void testDotsStreaming(const QString &fileDir, const QString &suffix, double dotsTh, int minEviction,
+                                  bool rebaseSums = false);
 
     // The visualization.
     static void visualizeDataset(const QString &fileDir, const QString &suffix, double range,
@@ -51,10 +67,22 @@ public:
 
     // The clustering phase.
     static void clusterSegments(const QString &segmentsFile, const QVector<double> &weights,
-                                const QString &outputFile, double thresh, int memoryLim);
-    static void myRedist(const CFTreeND::cfentry_vec_type &entries,
+                                const QString &outputFile, double thresh, int memoryLim, int numThreads = 1,
+                                bool useNNChain = false, int numShards = 1);
+    static QVector<double> getCentroids(const CFTreeND::cfentry_vec_type &entries);
+    static void myRedist(const CentroidIndex &index,
                          const QVector<ItemND> &buffer,
-                         std::vector<int> &item_cids);
+                         std::vector<int> &item_cids,
+                         int numThreads = 1);
+    static void testRedist(int numClusters, int numItems, int numThreads);
+    // Build a tree from each share of the segment file in parallel, sharing the memory limit. Returns the
+    // number of segments.
+    static qint64 buildShards(const QString &segFileName, const QVector<double> &weights, double thresh,
+                              int memoryLim, int numShards, QVector<CFTreeND *> &shards);
+    // Insert the leaf entries of the shards into tree, deleting each shard once its entries are taken.
+    static void mergeShards(QVector<CFTreeND *> &shards, CFTreeND &tree);
+    static void benchCFTree(int numItems, double thresh, int numShards = 1);
+    static void testNNChain(int numItems, double thresh);
     static QVector<ItemND> random(ItemND _inf, ItemND _sup,
                                   int num);
     static void testCluster(double thresh, int memoryLim = 0);
@@ -71,7 +99,27 @@ public:
     // The SCPM mining phase.
     static void scpm(const QString &clusterFileName, const QString &tincFileName,
                      const QString &outputFileName, double continuityRadius, int minSup,
-                     int minLen);
+                     int minLen, int numThreads = 1, bool useBitmap = false, int topK = 0,
+                     qint64 memoryBudget = 0);
+    static void scpmTopK(const QVector<SegmentLocation> &clusters, const QVector<QVector<unsigned int> > &tinc,
+                         const QHash<unsigned int, QVector<unsigned int> > &scMap,
+                         const QHash<unsigned int, unsigned int> &t2otMap,
+                         const QString &outputFileName, int minSup, int minLen, int topK);
+    static void testTopK(const QString &clusterFileName, const QString &tincFileName,
+                         double continuityRadius, int minSup, int minLen, int topK);
+    // Mine the tinc of newly appended trajectories against the mining state, which is created if missing.
+    static void scpmIncremental(const QString &clusterFileName, const QString &tincFileName,
+                                const QString &stateFileName, const QString &outputFileName,
+                                double continuityRadius, int minSup);
+    static void testIncrementalMining(const QString &clusterFileName, const QString &tincFileName,
+                                      double continuityRadius, int minSup, int numParts);
+    static void mineWithPrefixSpan(const QVector<QVector<unsigned int> > &tinc,
+                                   const QHash<unsigned int, QVector<unsigned int> > &scMap,
+                                   const QHash<unsigned int, unsigned int> &t2otMap,
+                                   QVector<QVector<unsigned int> > &allPatterns,
+                                   int minSup, int numThreads, bool maximal);
+    static void checkMiningEngines(const QString &clusterFileName, const QString &tincFileName,
+                                   double continuityRadius, int minSup);
     static void storePatterns(const QVector<QVector<unsigned int> > &allPatterns,
                               const QVector<SegmentLocation> &clusters,
                               const QString &patternFileName);
@@ -79,20 +127,31 @@ public:
                                   const QVector<SegmentLocation> &clusters,
                                   int minLen);
     static void prefixSpan(const QVector<unsigned int> &currPrefix,
-                           const QVector<QVector<unsigned int> > &projs,
-                           const QVector<int> &projsFrom,
-                           const QHash<unsigned int, QVector<unsigned int> > scMap,
+                           const TincIndex &index,
+                           const QVector<PseudoProjection> &projs,
+                           const QHash<unsigned int, QVector<unsigned int> > &scMap,
                            const QHash<unsigned int, unsigned int> &t2otMap,
                            QVector<QVector<unsigned int> > &allPatterns,
-                           int minSup);
+                           int minSup, bool maximal = false);
+    static void parallelPrefixSpan(const TincIndex &index,
+                                   const QVector<PseudoProjection> &projs,
+                                   const QHash<unsigned int, QVector<unsigned int> > &scMap,
+                                   const QHash<unsigned int, unsigned int> &t2otMap,
+                                   QVector<QVector<unsigned int> > &allPatterns,
+                                   int minSup, int numThreads, bool maximal = false);
     static void testPrefixSpan();
     static QVector<SegmentLocation> retrieveClusters(const QString &clusterFileName);
     static QHash<unsigned int, QVector<unsigned int> > getSpatialContinuityMap(
             const QVector<SegmentLocation> &clusters, double continuityRadius);
+    static QHash<unsigned int, QVector<unsigned int> > getSpatialContinuityMapBruteForce(
+            const QVector<SegmentLocation> &clusters, double continuityRadius);
+    static void testSpatialContinuityMap(const QString &clusterFileName, double continuityRadius);
+    static QHash<unsigned int, unsigned int> retrieveT2ot(const QString &t2otFileName);
     static QVector<QVector<unsigned int> > retrieveTinC(const QString &tincFileName);
 
     // Remove SUFFIX/PREFIX pattern.
     static void testTrie();
+    static void benchTrie(int numPatterns, int seed);
 
     // Return a random order version of the original oldVec.
     template<typename T>
@@ -111,39 +170,35 @@ public:
     template<typename T>
     static QVector<QVector<T> > cleanShortPatterns(
             const QVector<QVector<T> > &patterns) {
-        QVector<QVector<T> > nonPrefixPatterns = cleanPrefixPatterns(patterns);
-        QVector<QVector<T> > inversed = inversePatterns(nonPrefixPatterns);
-        inversed = cleanPrefixPatterns(inversed);
-        return inversePatterns(inversed);
+        return cleanSuffixPatterns(cleanPrefixPatterns(patterns));
+    }
+
+    // Clean the patterns so that those which are suffix of others are totally removed. The patterns mined
+    // in the maximal mode are already not prefixes of each other, so this keeps the same patterns in the same
+    // order as cleanShortPatterns() does on all the patterns.
+    template<typename T>
+    static QVector<QVector<T> > cleanSuffixPatterns(
+            const QVector<QVector<T> > &patterns) {
+        return cleanPatterns(patterns, true);
     }
 
     // Clean the patterns so that those which are prefix of others are totally removed.
     template<typename T>
     static QVector<QVector<T> > cleanPrefixPatterns(
             const QVector<QVector<T> > &patterns) {
-        TrieNode<T> *root = new TrieNode<T>();
-        foreach (QVector<T> pattern, patterns) {
-            root->insert(pattern, 0);
-        }
-        QVector<QVector<T> > newPatterns;
-        root->collectLeaves(newPatterns);
-        delete root;
-
-        return newPatterns;
+        return cleanPatterns(patterns, false);
     }
 
-    // Inverse each element of the patterns.
+    // Keep the leaves of the trie of the patterns, which is reversed for removing suffixes.
     template<typename T>
-    static QVector<QVector<T> > inversePatterns(
-            const QVector<QVector<T> > &patterns) {
-        QVector<QVector<T> > inversed;
-        foreach (QVector<T> pattern, patterns) {
-            QVector<T> ipattern;
-            for (int i=pattern.count()-1; i>=0; --i)
-                ipattern.append(pattern.at(i));
-            inversed.append(ipattern);
-        }
-        return inversed;
+    static QVector<QVector<T> > cleanPatterns(
+            const QVector<QVector<T> > &patterns, bool reversed) {
+        CompactTrie<T> trie(reversed);
+        for (int i=0; i<patterns.count(); ++i)
+            trie.insert(patterns.at(i));
+        QVector<QVector<T> > newPatterns;
+        trie.collectLeaves(newPatterns);
+        return newPatterns;
     }
 
     // Evaluation.
@@ -171,6 +226,7 @@ public:
     static const QString clusterSuffix;
     static const QString tincSuffix;
     static const QString patternSuffix;
+    static const QString trcSuffix;
 };
 
 #endif // APPS_H
@@ -0,0 +1,179 @@
+/* Copyright © 2015 DynamicFatty. All Rights Reserved. */
+
+#include "BitmapMiner.h"
+#include "SpatialTemporalException.h"
+#include <algorithm>
+
+BitmapMiner::BitmapMiner(const QVector<QVector<unsigned int> > &tinc,
+                         const QHash<unsigned int, unsigned int> &t2otMap)
+    : numSeqs(tinc.count())
+{
+    // Lay out the transactions, and number the original trajectories.
+    QHash<unsigned int, int> owners;
+    int numWords = 0;
+    firstWord.reserve(numSeqs+1);
+    seqOwner.fill(-1, numSeqs);
+    for (int i=0; i<numSeqs; ++i) {
+        firstWord << numWords;
+        int len = tinc.at(i).count()-1;
+        if (len <= 0)
+            continue;
+        QHash<unsigned int, unsigned int>::const_iterator it = t2otMap.constFind(i);
+        if (it == t2otMap.constEnd()) {
+            SpatialTemporalException("Found t2otMap does not contain one id.").raise();
+        }
+        QHash<unsigned int, int>::const_iterator owner = owners.constFind(it.value());
+        if (owner == owners.constEnd()) {
+            seqOwner[i] = owners.count();
+            owners.insert(it.value(), seqOwner.at(i));
+        } else {
+            seqOwner[i] = owner.value();
+        }
+        numWords += (len+63)/64;
+    }
+    firstWord << numWords;
+    wordSeq.resize(numWords);
+    for (int i=0; i<numSeqs; ++i) {
+        for (int w=firstWord.at(i); w<firstWord.at(i+1); ++w)
+            wordSeq[w] = i;
+    }
+    ownerBits.fill(0, (owners.count()+63)/64);
+
+    // Build the bitmaps of the items. Words are visited in order, so each bitmap stays sorted.
+    for (int i=0; i<numSeqs; ++i) {
+        const QVector<unsigned int> &seq = tinc.at(i);
+        for (int pos=0; pos<seq.count()-1; ++pos) {
+            QHash<unsigned int, int>::const_iterator it = itemSlots.constFind(seq.at(pos));
+            int slot = it == itemSlots.constEnd() ? itemBits.count() : it.value();
+            if (slot == itemBits.count()) {
+                itemSlots.insert(seq.at(pos), slot);
+                itemBits.append(Bitmap());
+            }
+            Bitmap &bits = itemBits[slot];
+            int index = firstWord.at(i) + pos/64;
+            if (bits.isEmpty() || bits.last().index != index) {
+                Word w;
+                w.index = index;
+                w.bits = 0;
+                bits.append(w);
+            }
+            bits.last().bits |= Q_UINT64_C(1) << (pos%64);
+        }
+    }
+}
+
+void BitmapMiner::mine(const QHash<unsigned int, QVector<unsigned int> > &scMap, int minSup,
+                       QVector<QVector<unsigned int> > &allPatterns, bool maximal)
+{
+    if (numSeqs < minSup)
+        return;
+    mine(QVector<unsigned int>(), Bitmap(), scMap, minSup, allPatterns, maximal);
+}
+
+void BitmapMiner::mine(const QVector<unsigned int> &prefix, const Bitmap &prefixBits,
+                       const QHash<unsigned int, QVector<unsigned int> > &scMap, int minSup,
+                       QVector<QVector<unsigned int> > &allPatterns, bool maximal)
+{
+    // The same candidates in the same order as Apps::prefixSpan().
+    QVector<unsigned int> toCheck;
+    if (prefix.isEmpty()) {
+        toCheck = scMap.keys().toVector();
+        std::sort(toCheck.begin(), toCheck.end());
+    } else {
+        toCheck = scMap.value(prefix.last());
+    }
+    Bitmap newBits;
+    foreach (unsigned int c, toCheck) {
+        QHash<unsigned int, int>::const_iterator slot = itemSlots.constFind(c);
+        const Bitmap &bits = slot == itemSlots.constEnd() ? emptyBits : itemBits.at(slot.value());
+        if (prefix.isEmpty())
+            newBits = bits;
+        else
+            sStep(prefixBits, bits, newBits);
+        if (support(newBits) >= minSup) {
+            QVector<unsigned int> newPrefix = prefix;
+            newPrefix.append(c);
+            int beforePatternsCount = allPatterns.count();
+            mine(newPrefix, newBits, scMap, minSup, allPatterns, maximal);
+            if (!maximal || beforePatternsCount == allPatterns.count())
+                allPatterns << newPrefix;
+        }
+    }
+}
+
+void BitmapMiner::sStep(const Bitmap &prefixBits, const Bitmap &itemBits, Bitmap &result) const
+{
+    result.resize(0);
+    const Word *item = itemBits.constData(), *itemEnd = item + itemBits.count();
+    int i = 0;
+    while (i < prefixBits.count() && item != itemEnd) {
+        // Only the first set bit of a transaction matters.
+        const Word &first = prefixBits.at(i);
+        int seq = wordSeq.at(first.index);
+        int bit = countTrailingZeros(first.bits);
+        quint64 mask = bit == 63 ? 0 : ~((Q_UINT64_C(2) << bit) - 1);
+        int seqEnd = firstWord.at(seq+1);
+        while (i < prefixBits.count() && prefixBits.at(i).index < seqEnd)
+            ++i;
+
+        // Keep the item bits after it, in the same transaction.
+        Word key;
+        key.index = first.index;
+        item = std::lower_bound(item, itemEnd, key);
+        for (; item != itemEnd && item->index < seqEnd; ++item) {
+            Word w = *item;
+            if (w.index == first.index)
+                w.bits &= mask;
+            if (w.bits)
+                result.append(w);
+        }
+    }
+}
+
+int BitmapMiner::support(const Bitmap &bits)
+{
+    // Mark the owners of the transactions, then count them.
+    touchedWords.resize(0);
+    int lastSeq = -1;
+    for (int i=0; i<bits.count(); ++i) {
+        int seq = wordSeq.at(bits.at(i).index);
+        if (seq == lastSeq)
+            continue;
+        lastSeq = seq;
+        int owner = seqOwner.at(seq);
+        quint64 &word = ownerBits[owner/64];
+        if (!word)
+            touchedWords << owner/64;
+        word |= Q_UINT64_C(1) << (owner%64);
+    }
+    int count = 0;
+    foreach (int w, touchedWords) {
+        count += popCount(ownerBits.at(w));
+        ownerBits[w] = 0;
+    }
+    return count;
+}
+
+int BitmapMiner::popCount(quint64 v)
+{
+#if defined(__GNUC__)
+    return __builtin_popcountll(v);
+#else
+    int count = 0;
+    for (; v; v &= v-1)
+        ++count;
+    return count;
+#endif
+}
+
+int BitmapMiner::countTrailingZeros(quint64 v)
+{
+#if defined(__GNUC__)
+    return __builtin_ctzll(v);
+#else
+    int count = 0;
+    for (; !(v & 1); v >>= 1)
+        ++count;
+    return count;
+#endif
+}
@@ -0,0 +1,64 @@
+/* Copyright © 2015 DynamicFatty. All Rights Reserved. */
+
+#ifndef BITMAPMINER_H
+#define BITMAPMINER_H
+
+#include <QVector>
+#include <QHash>
+#include <QtGlobal>
+
+// A SPAM-like miner of the spatial-continuous patterns, as an alternative to Apps::prefixSpan().
+//
+// Every transaction in clusters (tinc) owns a run of 64-bit words, with one bit per position. The last
+// position of a transaction is left out, since PrefixSpan never extends a pattern there. Each item and each
+// pattern is a vertical bitmap over these words, keeping only the non-zero words. A pattern is extended by
+// an S-step: the bits after the first set bit of each transaction are ANDed with the bitmap of the item.
+// The support is the number of distinct original trajectories, counted by popcount over a bitmap of them.
+//
+// The patterns are found in the same order as Apps::prefixSpan() finds them.
+class BitmapMiner
+{
+public:
+    BitmapMiner(const QVector<QVector<unsigned int> > &tinc, const QHash<unsigned int, unsigned int> &t2otMap);
+
+    // Mines the patterns from the empty prefix, appending them to allPatterns. In the maximal mode, only
+    // the patterns that are not prefixes of the others are kept.
+    void mine(const QHash<unsigned int, QVector<unsigned int> > &scMap, int minSup,
+              QVector<QVector<unsigned int> > &allPatterns, bool maximal);
+
+protected:
+    struct Word
+    {
+        int index;
+        quint64 bits;
+
+        bool operator<(const Word &other) const {
+            return index < other.index;
+        }
+    };
+    typedef QVector<Word> Bitmap;
+
+    void mine(const QVector<unsigned int> &prefix, const Bitmap &prefixBits,
+              const QHash<unsigned int, QVector<unsigned int> > &scMap, int minSup,
+              QVector<QVector<unsigned int> > &allPatterns, bool maximal);
+    void sStep(const Bitmap &prefixBits, const Bitmap &itemBits, Bitmap &result) const;
+    int support(const Bitmap &bits);
+
+    static int popCount(quint64 v);
+    static int countTrailingZeros(quint64 v);
+
+protected:
+    int numSeqs;
+    QVector<int> firstWord;         // The first word of each transaction, followed by the total.
+    QVector<int> wordSeq;           // The transaction of each word.
+    QVector<int> seqOwner;          // The original trajectory of each transaction, numbered from 0.
+    QHash<unsigned int, int> itemSlots;
+    QVector<Bitmap> itemBits;
+    Bitmap emptyBits;
+
+    // Scratch bitmap of the original trajectories, for counting supports.
+    QVector<quint64> ownerBits;
+    QVector<int> touchedWords;
+};
+
+#endif // BITMAPMINER_H
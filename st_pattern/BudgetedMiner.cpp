@@ -0,0 +1,261 @@
+/* Copyright © 2015 DynamicFatty. All Rights Reserved. */
+
+#include "BudgetedMiner.h"
+#include "SpatialTemporalException.h"
+#include <QTemporaryFile>
+#include <QScopedPointer>
+#include <QByteArray>
+#include <QDebug>
+#include <algorithm>
+
+/**
+ * @brief The BudgetedMiner::ProjectedDatabase class holds the pseudo-projections of one pattern, in memory
+ * or in a temporary file. It is on the path of the miner while it lives, and is filled run by run, so that
+ * it can be spilled while it is being made.
+ */
+class BudgetedMiner::ProjectedDatabase
+{
+public:
+    ProjectedDatabase(BudgetedMiner &miner, int depth)
+        : miner(miner), depth(depth), numProjs(0), lastSeqId(0), projecting(false)
+    {
+        miner.path << this;
+        if (miner.depthPeakBytes.count() <= depth) {
+            miner.depthPeakBytes.resize(depth+1);
+            miner.depthSpills.resize(depth+1);
+            miner.depthSpilledBytes.resize(depth+1);
+            miner.depthFileBytes.resize(depth+1);
+        }
+    }
+
+    ~ProjectedDatabase()
+    {
+        miner.usedBytes -= bytes();
+        miner.path.removeLast();
+    }
+
+    int count() const
+    {
+        return numProjs;
+    }
+
+    // Bytes held in memory.
+    qint64 bytes() const
+    {
+        return (qint64)projs.count()*sizeof(PseudoProjection);
+    }
+
+    bool isSpilled() const
+    {
+        return !file.isNull();
+    }
+
+    // Appends a run of projections, into the file once spilled, and keeps the path within the budget.
+    void append(const PseudoProjection *run, int n)
+    {
+        if (n == 0)
+            return;
+        numProjs += n;
+        if (isSpilled()) {
+            write(run, n);
+            miner.depthSpilledBytes[depth] += (qint64)n*sizeof(PseudoProjection);
+            return;
+        }
+        for (int i=0; i<n; ++i)
+            projs << run[i];
+        miner.usedBytes += (qint64)n*sizeof(PseudoProjection);
+        miner.peakBytes = qMax(miner.peakBytes, miner.usedBytes);
+        miner.depthPeakBytes[depth] = qMax(miner.depthPeakBytes.at(depth), bytes());
+        miner.enforceBudget();
+    }
+
+    void spill()
+    {
+        // One being projected is read in place; its child spills instead.
+        if (isSpilled() || projs.isEmpty() || projecting)
+            return;
+        file.reset(new QTemporaryFile());
+        if (!file->open()) {
+            SpatialTemporalException("Open temporary file of projected database error.").raise();
+        }
+        write(projs.constData(), projs.count());
+        miner.usedBytes -= bytes();
+        miner.depthSpills[depth] += 1;
+        miner.depthSpilledBytes[depth] += bytes();
+        QVector<PseudoProjection>().swap(projs);
+    }
+
+    // Projects the database on item into child the way TincIndex::project() does, run by run. A spilled one
+    // is streamed back.
+    int project(unsigned int item, ProjectedDatabase &child)
+    {
+        QSet<unsigned int> owners;
+        QVector<PseudoProjection> newProjs;
+        newProjs.reserve(RUN_SIZE);
+        if (!isSpilled()) {
+            projecting = true;
+            for (int from=0; from<numProjs; from+=RUN_SIZE) {
+                newProjs.resize(0);
+                miner.index.projectRun(item, projs.constData()+from, qMin(RUN_SIZE, numProjs-from), miner.t2otMap,
+                                       newProjs, owners);
+                child.append(newProjs.constData(), newProjs.count());
+            }
+            projecting = false;
+            return owners.count();
+        }
+
+        file->seek(0);
+        QVector<char> block(BLOCK_SIZE);
+        int blockPos = 0, blockSize = 0;
+        QVector<PseudoProjection> run;
+        run.reserve(RUN_SIZE);
+        unsigned int seqId = 0;
+        for (int i=0; i<numProjs; ++i) {
+            unsigned int values[2];
+            for (int j=0; j<2; ++j) {
+                values[j] = 0;
+                for (int shift=0; ; shift+=7) {
+                    if (blockPos == blockSize) {
+                        blockSize = (int)file->read(block.data(), block.count());
+                        blockPos = 0;
+                        if (blockSize <= 0) {
+                            SpatialTemporalException("Malformed temporary file of projected database.").raise();
+                        }
+                    }
+                    unsigned char b = (unsigned char)block.at(blockPos++);
+                    values[j] |= (unsigned int)(b & 0x7f) << shift;
+                    if (!(b & 0x80))
+                        break;
+                }
+            }
+            seqId += values[0];
+            PseudoProjection p;
+            p.seqId = (int)seqId;
+            p.offset = (int)values[1];
+            run << p;
+            if (run.count() == RUN_SIZE || i == numProjs-1) {
+                newProjs.resize(0);
+                miner.index.projectRun(item, run.constData(), run.count(), miner.t2otMap, newProjs, owners);
+                child.append(newProjs.constData(), newProjs.count());
+                run.resize(0);
+            }
+        }
+        return owners.count();
+    }
+
+protected:
+    static const int BLOCK_SIZE = 1<<16;
+    static const int RUN_SIZE = 4096;
+    static const int MAX_VARINT_SIZE = 5;
+
+    static void appendVarint(QByteArray &block, unsigned int v)
+    {
+        while (v >= 0x80) {
+            block.append((char)((v & 0x7f) | 0x80));
+            v >>= 7;
+        }
+        block.append((char)v);
+    }
+
+    // Appends projections to the end of the file.
+    void write(const PseudoProjection *projs, int n)
+    {
+        file->seek(file->size());
+        QByteArray block;
+        block.reserve(BLOCK_SIZE + 2*MAX_VARINT_SIZE);
+        for (int i=0; i<n; ++i) {
+            appendVarint(block, (unsigned int)projs[i].seqId - lastSeqId);
+            appendVarint(block, (unsigned int)projs[i].offset);
+            lastSeqId = projs[i].seqId;
+            if (block.size() >= BLOCK_SIZE || i == n-1) {
+                if (file->write(block) != block.size()) {
+                    SpatialTemporalException("Write temporary file of projected database error.").raise();
+                }
+                miner.depthFileBytes[depth] += block.size();
+                block.resize(0);
+            }
+        }
+    }
+
+    BudgetedMiner &miner;
+    int depth;
+    int numProjs;
+    unsigned int lastSeqId;         // Of the last projection written to the file.
+    bool projecting;
+    QVector<PseudoProjection> projs;
+    QScopedPointer<QTemporaryFile> file;
+};
+
+BudgetedMiner::BudgetedMiner(const QVector<QVector<unsigned int> > &tinc,
+                             const QHash<unsigned int, unsigned int> &t2otMap, qint64 budgetBytes)
+    : index(tinc), t2otMap(t2otMap), budgetBytes(budgetBytes), usedBytes(0), peakBytes(0)
+{
+}
+
+void BudgetedMiner::mine(const QHash<unsigned int, QVector<unsigned int> > &scMap, int minSup,
+                         QVector<QVector<unsigned int> > &allPatterns, bool maximal)
+{
+    ProjectedDatabase db(*this, 0);
+    static const int RUN_SIZE = 4096;
+    QVector<PseudoProjection> run;
+    for (int i=0; i<index.count(); ++i) {
+        PseudoProjection p;
+        p.seqId = i;
+        p.offset = 0;
+        run << p;
+        if (run.count() == RUN_SIZE || i == index.count()-1) {
+            db.append(run.constData(), run.count());
+            run.resize(0);
+        }
+    }
+    mine(QVector<unsigned int>(), db, scMap, minSup, allPatterns, maximal);
+}
+
+void BudgetedMiner::mine(const QVector<unsigned int> &prefix, ProjectedDatabase &db,
+                         const QHash<unsigned int, QVector<unsigned int> > &scMap, int minSup,
+                         QVector<QVector<unsigned int> > &allPatterns, bool maximal)
+{
+    if (db.count() < minSup)
+        return;
+    QVector<unsigned int> toCheck;
+    if (prefix.isEmpty()) {
+        // Sorted, since the order of hash keys differs from run to run.
+        toCheck = scMap.keys().toVector();
+        std::sort(toCheck.begin(), toCheck.end());
+    } else {
+        toCheck = scMap.value(prefix.last());
+    }
+
+    foreach (unsigned int c, toCheck) {
+        // The child is on the path while it is projected, so that it is spilled like the others.
+        ProjectedDatabase child(*this, prefix.count()+1);
+        if (db.project(c, child) < minSup)
+            continue;
+        QVector<unsigned int> newPrefix = prefix;
+        newPrefix.append(c);
+        int beforePatternsCount = allPatterns.count();
+        mine(newPrefix, child, scMap, minSup, allPatterns, maximal);
+        // In the maximal mode only the leaves of the prefix-span tree are kept, since the other patterns
+        // are prefixes of them.
+        if (!maximal || beforePatternsCount == allPatterns.count()) {
+            allPatterns << newPrefix;
+        }
+    }
+}
+
+void BudgetedMiner::enforceBudget()
+{
+    for (int i=0; i<path.count() && usedBytes > budgetBytes; ++i)
+        path.at(i)->spill();
+}
+
+void BudgetedMiner::report() const
+{
+    qDebug()<<"Projected databases held at most "<<peakBytes/(1<<20)<<" MB in memory, within a budget of "
+           <<budgetBytes/(1<<20)<<" MB.";
+    for (int d=0; d<depthPeakBytes.count(); ++d) {
+        qDebug()<<"Depth "<<d<<": the largest database took "<<depthPeakBytes.at(d)/1024<<" KB, "
+               <<depthSpills.at(d)<<" databases of "<<depthSpilledBytes.at(d)/1024<<" KB were spilled into "
+              <<depthFileBytes.at(d)/1024<<" KB.";
+    }
+}
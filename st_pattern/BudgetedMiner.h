@@ -0,0 +1,59 @@
+/* Copyright © 2015 DynamicFatty. All Rights Reserved. */
+
+#ifndef BUDGETEDMINER_H
+#define BUDGETEDMINER_H
+
+#include <QVector>
+#include <QHash>
+#include <QtGlobal>
+#include "TincIndex.h"
+
+// A PrefixSpan miner that keeps the projected databases along the current path of the search within a
+// memory budget, as an alternative to Apps::prefixSpan() for large tinc files.
+//
+// Each projected database is held in memory until the ones on the path exceed the budget. The shallowest
+// ones, which are the largest and the last to be read again, are then spilled to temporary files and
+// streamed back whenever they are projected. A database is filled run by run, and checked against the
+// budget after each run, so one that is being made spills as well. A spilled database is a list of varints, with the delta to the
+// previous transaction id and the offset of each pseudo-projection.
+//
+// The patterns are found in the same order as Apps::prefixSpan() finds them.
+class BudgetedMiner
+{
+public:
+    BudgetedMiner(const QVector<QVector<unsigned int> > &tinc, const QHash<unsigned int, unsigned int> &t2otMap,
+                  qint64 budgetBytes);
+
+    // Mines the patterns from the empty prefix, appending them to allPatterns. In the maximal mode, only
+    // the patterns that are not prefixes of the others are kept.
+    void mine(const QHash<unsigned int, QVector<unsigned int> > &scMap, int minSup,
+              QVector<QVector<unsigned int> > &allPatterns, bool maximal);
+
+    // Log the memory held and spilled by the projected databases at each depth.
+    void report() const;
+
+protected:
+    class ProjectedDatabase;
+
+    void mine(const QVector<unsigned int> &prefix, ProjectedDatabase &db,
+              const QHash<unsigned int, QVector<unsigned int> > &scMap, int minSup,
+              QVector<QVector<unsigned int> > &allPatterns, bool maximal);
+    // Spill the databases on the path from the shallowest one, until they fit in the budget.
+    void enforceBudget();
+
+protected:
+    TincIndex index;
+    const QHash<unsigned int, unsigned int> &t2otMap;
+    qint64 budgetBytes;
+    qint64 usedBytes;
+    qint64 peakBytes;
+    QVector<ProjectedDatabase *> path;
+
+    // Statistics of each depth.
+    QVector<qint64> depthPeakBytes;
+    QVector<int> depthSpills;
+    QVector<qint64> depthSpilledBytes;
+    QVector<qint64> depthFileBytes;
+};
+
+#endif // BUDGETEDMINER_H
@@ -0,0 +1,157 @@
+/* Copyright © 2015 DynamicFatty. All Rights Reserved. */
+
+#include "CentroidIndex.h"
+#include "Helper.h"
+#include <algorithm>
+
+namespace {
+
+// Orders the centroids by one coordinate.
+struct CoordinateLess
+{
+    CoordinateLess(const QVector<double> &centroids, int dim, int axis)
+        : data(centroids.constData()), dim(dim), axis(axis) {}
+
+    bool operator()(int a, int b) const {
+        double va = data[a*dim+axis], vb = data[b*dim+axis];
+        return va < vb || (va == vb && a < b);
+    }
+
+    const double *data;
+    int dim, axis;
+};
+
+}
+
+CentroidIndex::CentroidIndex(const QVector<double> &centroids, int dim)
+    : dim(dim), numCentroids(dim > 0 ? centroids.count()/dim : 0), centroids(centroids)
+{
+    ids.resize(numCentroids);
+    for (int i=0; i<numCentroids; ++i)
+        ids[i] = i;
+    if (numCentroids > 0)
+        build(0, numCentroids);
+
+    points.resize(numCentroids*dim);
+    for (int i=0; i<numCentroids; ++i)
+        std::copy(centroids.constData() + ids.at(i)*dim, centroids.constData() + (ids.at(i)+1)*dim,
+                  points.data() + i*dim);
+}
+
+int CentroidIndex::count() const
+{
+    return numCentroids;
+}
+
+int CentroidIndex::build(int from, int to)
+{
+    int node = nodes.count();
+    Node n = {from, to, -1, -1};
+    nodes << n;
+
+    // The bounding box, and the axis of the largest extent.
+    int box = boxes.count();
+    boxes.resize(box + 2*dim);
+    for (int j=0; j<dim; ++j) {
+        boxes[box+j] = Helper::INF;
+        boxes[box+dim+j] = -Helper::INF;
+    }
+    for (int i=from; i<to; ++i) {
+        const double *c = centroids.constData() + ids.at(i)*dim;
+        for (int j=0; j<dim; ++j) {
+            boxes[box+j] = qMin(boxes.at(box+j), c[j]);
+            boxes[box+dim+j] = qMax(boxes.at(box+dim+j), c[j]);
+        }
+    }
+    int axis = 0;
+    for (int j=1; j<dim; ++j) {
+        if (boxes.at(box+dim+j)-boxes.at(box+j) > boxes.at(box+dim+axis)-boxes.at(box+axis))
+            axis = j;
+    }
+    if (to-from <= LEAF_SIZE || !(boxes.at(box+dim+axis) > boxes.at(box+axis)))
+        return node;
+
+    // Split at the median.
+    int mid = from + (to-from)/2;
+    std::nth_element(ids.begin()+from, ids.begin()+mid, ids.begin()+to, CoordinateLess(centroids, dim, axis));
+    int left = build(from, mid);
+    int right = build(mid, to);
+    nodes[node].left = left;
+    nodes[node].right = right;
+    return node;
+}
+
+double CentroidIndex::boxDistance(int node, const double *item) const
+{
+    const double *lo = boxes.constData() + node*2*dim;
+    const double *hi = lo + dim;
+    double diff = 0;
+    for (int j=0; j<dim; ++j) {
+        double d = 0;
+        if (item[j] < lo[j])
+            d = lo[j]-item[j];
+        else if (item[j] > hi[j])
+            d = item[j]-hi[j];
+        diff += d*d;
+    }
+    return diff;
+}
+
+int CentroidIndex::nearest(const double *item) const
+{
+    double minDiff = Helper::INF;
+    int minIdx = 0;
+    if (numCentroids > 0)
+        search(0, item, minDiff, minIdx);
+    return minIdx;
+}
+
+void CentroidIndex::search(int node, const double *item, double &minDiff, int &minIdx) const
+{
+    const Node &n = nodes.at(node);
+    if (n.left < 0) {
+        for (int i=n.from; i<n.to; ++i) {
+            const double *c = points.constData() + i*dim;
+            double diff = 0;
+            for (int j=0; j<dim; ++j)
+                diff += (c[j]-item[j])*(c[j]-item[j]);
+            // Among the equally near ones, the lowest index wins as in the brute force search.
+            if (diff < minDiff || (diff == minDiff && ids.at(i) < minIdx)) {
+                minDiff = diff;
+                minIdx = ids.at(i);
+            }
+        }
+        return;
+    }
+
+    // The nearer subtree first, and the other one unless it is surely farther.
+    double leftDiff = boxDistance(n.left, item), rightDiff = boxDistance(n.right, item);
+    int first = n.left, second = n.right;
+    double secondDiff = rightDiff;
+    if (rightDiff < leftDiff) {
+        first = n.right;
+        second = n.left;
+        secondDiff = leftDiff;
+    }
+    if (qMin(leftDiff, rightDiff) <= minDiff)
+        search(first, item, minDiff, minIdx);
+    if (secondDiff <= minDiff)
+        search(second, item, minDiff, minIdx);
+}
+
+int CentroidIndex::nearestBruteForce(const double *item) const
+{
+    double minDiff = Helper::INF;
+    int minIdx = 0;
+    for (int k=0; k<numCentroids; ++k) {
+        const double *c = centroids.constData() + k*dim;
+        double diff = 0;
+        for (int j=0; j<dim; ++j)
+            diff += (c[j]-item[j])*(c[j]-item[j]);
+        if (diff < minDiff) {
+            minDiff = diff;
+            minIdx = k;
+        }
+    }
+    return minIdx;
+}
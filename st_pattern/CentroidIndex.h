@@ -0,0 +1,52 @@
+/* Copyright © 2015 DynamicFatty. All Rights Reserved. */
+
+#ifndef CENTROIDINDEX_H
+#define CENTROIDINDEX_H
+
+#include <QVector>
+
+// A k-d tree over the centroids of the BIRCH clusters, for redistributing the segments to their nearest
+// clusters without comparing each segment to every cluster.
+//
+// The search is exact: it finds the same cluster as the brute force search over all the centroids does,
+// including the lowest index among equally near ones. Distances are squared sums added in the order of
+// the dimensions, and a subtree is skipped only if the squared distance to its bounding box, added the same
+// way, is greater than the best one found. Since rounding is monotonic, that bound never exceeds the
+// distance of any centroid in the box.
+class CentroidIndex
+{
+public:
+    // The centroids are count rows of dim coordinates.
+    CentroidIndex(const QVector<double> &centroids, int dim);
+
+    int count() const;
+    // Index of the nearest centroid to item.
+    int nearest(const double *item) const;
+    // The same by comparing to every centroid.
+    int nearestBruteForce(const double *item) const;
+
+protected:
+    static const int LEAF_SIZE = 8;
+
+    // A subtree holding the centroids from..to-1 in the tree order, with its bounding box.
+    struct Node
+    {
+        int from, to;
+        int left, right;
+    };
+
+    int build(int from, int to);
+    double boxDistance(int node, const double *item) const;
+    void search(int node, const double *item, double &minDiff, int &minIdx) const;
+
+protected:
+    int dim;
+    int numCentroids;
+    QVector<double> centroids;      // The input centroids.
+    QVector<double> points;         // The centroids in the tree order.
+    QVector<int> ids;               // The index of each centroid in the tree order.
+    QVector<Node> nodes;
+    QVector<double> boxes;          // The lower and then the upper corner of each node.
+};
+
+#endif // CENTROIDINDEX_H
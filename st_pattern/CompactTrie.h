@@ -0,0 +1,144 @@
+/* Copyright © 2015 DynamicFatty. All Rights Reserved. */
+
+#ifndef COMPACTTRIE_H
+#define COMPACTTRIE_H
+
+#include <QVector>
+#include <QHash>
+#include <QPair>
+#include <algorithm>
+
+// A trie of patterns for cleaning them up, kept in one arena of nodes instead of one allocation per node.
+// The children of a node are chained in insertion order, so that the leaves are always collected in the
+// same order. A child of a node with a few children is looked up along the chain, while the children of
+// wider nodes are also indexed in one hash shared by all the nodes.
+//
+// A reversed trie inserts the patterns from their last elements, so that it finds the patterns being
+// suffixes of others without copying any of them reversed.
+template<class T>
+class CompactTrie
+{
+public:
+    explicit CompactTrie(bool reversed = false) : reversed(reversed), growths(0) {
+        Node root;
+        root.element = T();
+        root.parent = -1;
+        root.firstChild = -1;
+        root.lastChild = -1;
+        root.nextSibling = -1;
+        root.childCount = 0;
+        nodes.append(root);
+    }
+
+    // Inserts a pattern.
+    void insert(const QVector<T> &pattern) {
+        int nodeCapacity = nodes.capacity(), childCapacity = children.capacity();
+        int node = 0;
+        for (int i=0; i<pattern.count(); ++i) {
+            const T &e = pattern.at(reversed ? pattern.count()-1-i : i);
+            int child = findChild(node, e);
+            node = child > 0 ? child : addChild(node, e);
+        }
+        if (nodes.capacity() != nodeCapacity)
+            ++growths;
+        if (children.capacity() != childCapacity)
+            ++growths;
+    }
+
+    // Collects the patterns ending at the leaves, depth first in insertion order. The patterns of a reversed
+    // trie are restored to their original direction.
+    void collectLeaves(QVector<QVector<T> > &allLeaves) const {
+        QVector<T> pattern;
+        int node = nodes.at(0).firstChild;
+        while (node > 0) {
+            const Node &n = nodes.at(node);
+            if (n.firstChild > 0) {
+                node = n.firstChild;
+                continue;
+            }
+
+            // Walking up from a leaf reads the pattern backwards.
+            pattern.resize(0);
+            for (int p=node; p>0; p=nodes.at(p).parent)
+                pattern.append(nodes.at(p).element);
+            if (!reversed)
+                std::reverse(pattern.begin(), pattern.end());
+            allLeaves.append(pattern);
+
+            // Go on with the next sibling of the leaf or of its nearest ancestor having one.
+            while (node > 0 && nodes.at(node).nextSibling < 0)
+                node = nodes.at(node).parent;
+            node = node > 0 ? nodes.at(node).nextSibling : -1;
+        }
+    }
+
+    // Number of nodes, the root excluded.
+    int nodeCount() const {
+        return nodes.count()-1;
+    }
+
+    // Number of times the arena or the child hash had to grow.
+    int growthCount() const {
+        return growths;
+    }
+
+protected:
+    struct Node
+    {
+        T element;
+        int parent;
+        int firstChild;
+        int lastChild;
+        int nextSibling;
+        int childCount;
+    };
+
+    // Number of children from which a node indexes them in the hash.
+    static const int MAX_CHAINED_CHILDREN = 8;
+
+    int findChild(int parent, const T &e) const {
+        const Node &p = nodes.at(parent);
+        if (p.childCount > MAX_CHAINED_CHILDREN)
+            return children.value(qMakePair(parent, e), -1);
+        for (int child=p.firstChild; child>0; child=nodes.at(child).nextSibling) {
+            if (nodes.at(child).element == e)
+                return child;
+        }
+        return -1;
+    }
+
+    int addChild(int parent, const T &e) {
+        int child = nodes.count();
+        Node n;
+        n.element = e;
+        n.parent = parent;
+        n.firstChild = -1;
+        n.lastChild = -1;
+        n.nextSibling = -1;
+        n.childCount = 0;
+        nodes.append(n);
+        Node &p = nodes[parent];
+        if (p.lastChild < 0)
+            p.firstChild = child;
+        else
+            nodes[p.lastChild].nextSibling = child;
+        p.lastChild = child;
+
+        // Index the children once the chain gets long.
+        ++p.childCount;
+        if (p.childCount == MAX_CHAINED_CHILDREN+1) {
+            for (int c=p.firstChild; c>0; c=nodes.at(c).nextSibling)
+                children.insert(qMakePair(parent, nodes.at(c).element), c);
+        } else if (p.childCount > MAX_CHAINED_CHILDREN+1) {
+            children.insert(qMakePair(parent, e), child);
+        }
+        return child;
+    }
+
+    bool reversed;
+    int growths;
+    QVector<Node> nodes;
+    QHash<QPair<int, T>, int> children;
+};
+
+#endif // COMPACTTRIE_H
@@ -0,0 +1,342 @@
+/* This software is developed by caoweiquan322 OR DynamicFatty.
+ * All rights reserved.
+ *
+ * Author: caoweiquan322
+ */
+
+#include "DotsCascade.h"
+#include "DotsSimplifier.h"
+#include "DotsException.h"
+#include <QThread>
+#include <QThreadPool>
+#include <QRunnable>
+#include <QAtomicInt>
+#include <QMutex>
+#include <QWaitCondition>
+
+/**
+ * @brief The DotsCascade::IndexRing class is a bounded lock-free queue of indices between two threads. Besides the
+ * indices, it carries the markers telling that the previous level has finished, and that it has output everything.
+ *
+ * A thread waiting for the other one spins for a while, and then sleeps until it is woken up, so that idle stages do
+ * not take the cores from the workers of a multi-threaded segmentation.
+ */
+class DotsCascade::IndexRing
+{
+public:
+    static const int FINISHED = -1;
+    static const int END = -2;
+
+    IndexRing() : head(0), tail(0), producerWaiting(0), consumerWaiting(0) {}
+
+    // Called by the producer only.
+    void push(int value)
+    {
+        uint t = (uint)tail.load();
+        for (int spin=0; t-(uint)head.loadAcquire() == SIZE; ++spin)
+        {
+            if (spin < SPIN_COUNT)
+            {
+                QThread::yieldCurrentThread();
+                continue;
+            }
+            QMutexLocker locker(&mutex);
+            producerWaiting.fetchAndStoreOrdered(1);
+            while (t-(uint)head.fetchAndAddOrdered(0) == SIZE)
+                changed.wait(&mutex);
+            producerWaiting.fetchAndStoreOrdered(0);
+        }
+        buffer[t&(SIZE-1)] = value;
+        tail.fetchAndStoreOrdered((int)(t+1));
+        if (consumerWaiting.loadAcquire())
+            wake();
+    }
+
+    // Called by the consumer only.
+    int pop()
+    {
+        uint h = (uint)head.load();
+        for (int spin=0; (uint)tail.loadAcquire() == h; ++spin)
+        {
+            if (spin < SPIN_COUNT)
+            {
+                QThread::yieldCurrentThread();
+                continue;
+            }
+            QMutexLocker locker(&mutex);
+            consumerWaiting.fetchAndStoreOrdered(1);
+            while ((uint)tail.fetchAndAddOrdered(0) == h)
+                changed.wait(&mutex);
+            consumerWaiting.fetchAndStoreOrdered(0);
+        }
+        int value = buffer[h&(SIZE-1)];
+        head.fetchAndStoreOrdered((int)(h+1));
+        if (producerWaiting.loadAcquire())
+            wake();
+        return value;
+    }
+
+protected:
+    // The waiting flag is set before checking the position again, and the position is updated before checking the
+    // flag, both with ordered operations, so a sleeping thread is always woken up.
+    void wake()
+    {
+        QMutexLocker locker(&mutex);
+        changed.wakeAll();
+    }
+
+    static const uint SIZE = 4096;
+    static const int SPIN_COUNT = 64;
+    int buffer[SIZE];
+
+    // The positions are kept on separate cache lines, since each one is written by a different thread.
+    char pad0[64];
+    QAtomicInt head;
+    char pad1[64];
+    QAtomicInt tail;
+    char pad2[64];
+    QAtomicInt producerWaiting;
+    QAtomicInt consumerWaiting;
+    QMutex mutex;
+    QWaitCondition changed;
+};
+
+/**
+ * @brief The DotsCascade::Stage class runs one level after the first in the pipelined mode. It makes the same calls
+ * to its level as the serial mode does: every index fed before the previous level finished is followed by reading one
+ * output, and the rest ones are only fed before the level finishes.
+ *
+ * An error of the level is kept for DotsCascade::finish() to raise on the calling thread. The stage then still reads
+ * its input up to the end, so that the previous level is never blocked, and ends the next one.
+ */
+class DotsCascade::Stage : public QRunnable
+{
+public:
+    Stage(DotsSimplifier *level, IndexRing *in, IndexRing *out) :
+        level(level), in(in), out(out), inputEnded(false), outputEnded(false)
+    {
+        setAutoDelete(false);
+    }
+
+    void run()
+    {
+        try
+        {
+            process();
+        }
+        catch (DotsException &e)
+        {
+            error = e.getMessage();
+        }
+        catch (...)
+        {
+            error = "Unknown error occurs in a pipelined level of the cascade.";
+        }
+        if (error.isEmpty())
+            return;
+        while (!inputEnded)
+            inputEnded = in->pop() == IndexRing::END;
+        if (out && !outputEnded)
+        {
+            out->push(IndexRing::FINISHED);
+            out->push(IndexRing::END);
+        }
+    }
+
+    QString error;
+
+protected:
+    void process()
+    {
+        bool previousFinished = false;
+        int index = -1;
+        while (true)
+        {
+            int value = in->pop();
+            inputEnded = value == IndexRing::END;
+            if (inputEnded)
+                break;
+            if (value == IndexRing::FINISHED)
+            {
+                previousFinished = true;
+                continue;
+            }
+            level->feedIndex(value);
+            if (!previousFinished && level->readOutputIndex(index) && out)
+                out->push(index);
+        }
+
+        level->finish();
+        if (out)
+            out->push(IndexRing::FINISHED);
+        while (level->readOutputIndex(index))
+        {
+            if (out)
+                out->push(index);
+        }
+        if (out)
+            out->push(IndexRing::END);
+        outputEnded = true;
+    }
+
+    DotsSimplifier *level;
+    IndexRing *in;
+    IndexRing *out;
+    bool inputEnded;
+    bool outputEnded;
+};
+
+DotsCascade::DotsCascade(const QVector<double> &thresholds, double k, int pipelineCapacity) :
+    pipelineCapacity(pipelineCapacity), finished(false), pipelineEnded(false), pool(NULL)
+{
+    if (thresholds.isEmpty())
+        DotsException("The cascade needs at least one threshold.").raise();
+
+    // Only the first level stores the points, the others refer to it.
+    for (int i=0; i<thresholds.count(); ++i)
+    {
+        DotsSimplifier *s = new DotsSimplifier(0, i==0 ? NULL : levels.first());
+        s->setParameters(thresholds.at(i), k);
+        levels.append(s);
+    }
+
+    // Start a thread for each level after the first.
+    if (pipelineCapacity > 0 && levels.count() > 1)
+    {
+        levels.first()->reserve(pipelineCapacity);
+        for (int i=0; i<levels.count()-1; ++i)
+            rings.append(new IndexRing());
+        for (int i=1; i<levels.count(); ++i)
+        {
+            levels.at(i)->pinCascadeRoot();
+            stages.append(new Stage(levels.at(i), rings.at(i-1), i < rings.count() ? rings.at(i) : NULL));
+        }
+        pool = new QThreadPool();
+        pool->setMaxThreadCount(levels.count()-1);
+        foreach (Stage *stage, stages)
+            pool->start(stage);
+    }
+}
+
+DotsCascade::~DotsCascade()
+{
+    if (pool)
+    {
+        // Only stop the stages here, since the errors could not be raised.
+        endPipeline();
+        delete pool;
+    }
+    qDeleteAll(stages);
+    qDeleteAll(rings);
+    for (int i=levels.count()-1; i>=0; --i)
+        delete levels.at(i);
+}
+
+void DotsCascade::feedData(double x, double y, double t)
+{
+    if (pool && levels.first()->getWindowSize() >= pipelineCapacity)
+        DotsException(QString("The pipelined cascade could take at most %1 points.").arg(pipelineCapacity)).raise();
+    levels.first()->feedData(x, y, t);
+
+    // Hand over the output to the next stage.
+    int index = -1;
+    if (pool)
+    {
+        if (levels.first()->readOutputIndex(index))
+            rings.first()->push(index);
+        return;
+    }
+
+    // Forward the output down the levels until some level holds it.
+    for (int i=0; i<levels.count()-1; ++i)
+    {
+        if (!levels.at(i)->readOutputIndex(index))
+            return;
+        levels.at(i+1)->feedIndex(index);
+    }
+    levels.last()->readOutputIndex(index);
+}
+
+void DotsCascade::finish()
+{
+    if (finished)
+        return;
+    finished = true;
+    if (pool)
+    {
+        // Finish the first level here, and then wait for the stages to finish the others in turn.
+        DotsSimplifier *first = levels.first();
+        try
+        {
+            first->finish();
+            rings.first()->push(IndexRing::FINISHED);
+            int index = -1;
+            while (first->readOutputIndex(index))
+                rings.first()->push(index);
+        }
+        catch (...)
+        {
+            endPipeline();
+            throw;
+        }
+        endPipeline();
+        foreach (Stage *stage, stages)
+        {
+            if (!stage->error.isEmpty())
+                DotsException(stage->error).raise();
+        }
+        return;
+    }
+
+    // Finish levels from front to end.
+    for (int i=0; i<levels.count()-1; ++i)
+    {
+        DotsSimplifier *s = levels.at(i);
+        DotsSimplifier *n = levels.at(i+1);
+        s->finish();
+        int index = -1;
+        while (s->readOutputIndex(index))
+            n->feedIndex(index);
+    }
+    DotsSimplifier *last = levels.last();
+    last->finish();
+    int index = -1;
+    while (last->readOutputIndex(index)) ;
+}
+
+void DotsCascade::endPipeline()
+{
+    // The stages take a repeated FINISHED marker as a single one.
+    if (!pipelineEnded)
+    {
+        pipelineEnded = true;
+        rings.first()->push(IndexRing::FINISHED);
+        rings.first()->push(IndexRing::END);
+    }
+    pool->waitForDone();
+}
+
+int DotsCascade::levelCount() const
+{
+    return levels.count();
+}
+
+int DotsCascade::getInputCount(int level)
+{
+    return levels.at(level)->getInputCount();
+}
+
+int DotsCascade::getOutputCount(int level)
+{
+    return levels.at(level)->getOutputCount();
+}
+
+QVector<int> DotsCascade::getSimplifiedIndices(int level)
+{
+    DotsSimplifier *s = levels.at(level);
+    QVector<int> indices;
+    indices.reserve(s->getOutputCount());
+    for (int j=0; j<s->getOutputCount(); ++j)
+        indices.append(s->getSimplifiedIndex(j));
+    return indices;
+}
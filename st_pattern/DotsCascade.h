@@ -0,0 +1,111 @@
+/* This software is developed by caoweiquan322 OR DynamicFatty.
+ * All rights reserved.
+ *
+ * Author: caoweiquan322
+ */
+
+/**
+  * @file
+  * @brief DotsCascade.h defines the DotsCascade class.
+  * @author caoweiquan322
+  * @date 2016/06/06
+  * @version 1.0
+  */
+#ifndef DOTSCASCADE_H
+#define DOTSCASCADE_H
+
+#include <QVector>
+
+class QThreadPool;
+class DotsSimplifier;
+
+/**
+ * @brief The DotsCascade class simplifies a trajectory with a series of increasing LSSD thresholds in a single pass.
+ *
+ * The points and their prefix sums are stored only once, by the first level. Each of the other levels keeps nothing
+ * but the indices of its input points, and evaluates its LSSD with the shared prefix sums. Every output of a level
+ * is forwarded to the next level right away, so all the levels advance together while the points are fed.
+ *
+ * In the pipelined mode each level after the first runs on its own thread, and consumes the outputs of the previous
+ * level through a lock-free single-producer single-consumer ring. The buffers of the first level are reserved
+ * upfront, so they never move while being read by the other threads. The results are the same as the serial mode,
+ * and an error of any level is raised by finish().
+ */
+class DotsCascade
+{
+public:
+    /**
+     * @brief DotsCascade is the default constructor.
+     * @param thresholds is the LSSD threshold of each level, in increasing order.
+     * @param k is the factor for upper bound of all the levels.
+     * @param pipelineCapacity enables the pipelined mode if positive, and is the maximum number of points to feed.
+     */
+    DotsCascade(const QVector<double> &thresholds, double k, int pipelineCapacity = 0);
+    ~DotsCascade();
+
+    /**
+     * @brief feedData feeds a 2D spatio temporary point to the first level.
+     * @param x is the x position.
+     * @param y is the y position.
+     * @param t is the timestamp.
+     */
+    void feedData(double x, double y, double t);
+
+    /**
+     * @brief finish finishes the levels from front to end. No more data could be feeded after calling this method. In
+     * the pipelined mode, the first error caught by the stages is raised here.
+     */
+    void finish();
+
+    /**
+     * @brief levelCount retrieves the number of levels.
+     * @return the number of levels.
+     */
+    int levelCount() const;
+
+    /**
+     * @brief getInputCount retrieves the number of points fed to a level.
+     * @param level is the level.
+     * @return the number of input points.
+     */
+    int getInputCount(int level);
+
+    /**
+     * @brief getOutputCount retrieves the number of points output by a level.
+     * @param level is the level.
+     * @return the number of output points.
+     */
+    int getOutputCount(int level);
+
+    /**
+     * @brief getSimplifiedIndices retrieves indices of the points simplified by a level.
+     * @param level is the level.
+     * @return indices of the simplified points.
+     */
+    QVector<int> getSimplifiedIndices(int level);
+
+protected:
+    class IndexRing;
+    class Stage;
+
+    /**
+     * @brief endPipeline ends the input of the stages and waits for them to stop. It never throws.
+     */
+    void endPipeline();
+
+    QVector<DotsSimplifier *> levels;
+
+    // The pipelined mode. rings[i] connects level i to level i+1.
+    int pipelineCapacity;
+    bool finished;
+    bool pipelineEnded;
+    QThreadPool *pool;
+    QVector<IndexRing *> rings;
+    QVector<Stage *> stages;
+
+private:
+    DotsCascade(const DotsCascade &);
+    DotsCascade &operator=(const DotsCascade &);
+};
+
+#endif // DOTSCASCADE_H
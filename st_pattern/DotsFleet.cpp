@@ -0,0 +1,192 @@
+/* This software is developed by caoweiquan322 OR DynamicFatty.
+ * All rights reserved.
+ *
+ * Author: caoweiquan322
+ */
+
+#include "DotsFleet.h"
+#include "DotsStreamArena.h"
+#include "DotsException.h"
+#include <QRunnable>
+#include <QSet>
+#include <QThread>
+
+/**
+ * @brief The DotsFleet::Shard class owns the streams of one shard, and feeds its part of each batch.
+ */
+class DotsFleet::Shard : public QRunnable
+{
+public:
+    struct Output
+    {
+        qint64 streamId;
+        int index;
+        double x;
+        double y;
+        double t;
+    };
+
+    explicit Shard(double lssdTh) : arena(lssdTh, MIN_EVICTION)
+    {
+        setAutoDelete(false);
+    }
+
+    void run()
+    {
+        for (int i=0; i<input.count(); ++i)
+            feedPoint(input.at(i));
+        input.resize(0);
+    }
+
+    void feedPoint(const DotsFleet::Point &p)
+    {
+        // A failed stream stays dropped until it is closed, rather than being reopened by its next point.
+        if (failedStreams.contains(p.streamId))
+            return;
+        QHash<qint64, int>::const_iterator it = streams.constFind(p.streamId);
+        int slot;
+        if (it == streams.constEnd()) {
+            slot = arena.open();
+            streams.insert(p.streamId, slot);
+        } else {
+            slot = it.value();
+        }
+        DotsStreamArena::Status status = arena.feed(slot, p.x, p.y, p.t);
+        if (status != DotsStreamArena::OK) {
+            if (error.isEmpty())
+                error = QString("Stream %1 dropped: %2").arg(p.streamId).arg(DotsStreamArena::statusMessage(status));
+            releaseStream(p.streamId, slot);
+            failedStreams.insert(p.streamId);
+            return;
+        }
+        readOutput(p.streamId, slot, false);
+    }
+
+    void closeStream(qint64 streamId)
+    {
+        failedStreams.remove(streamId);
+        QHash<qint64, int>::const_iterator it = streams.constFind(streamId);
+        if (it == streams.constEnd())
+            return;
+        int slot = it.value();
+        arena.finish(slot);
+        readOutput(streamId, slot, true);
+        releaseStream(streamId, slot);
+    }
+
+    void closeAll()
+    {
+        foreach (qint64 streamId, streams.keys())
+            closeStream(streamId);
+        failedStreams.clear();
+    }
+
+public:
+    QVector<DotsFleet::Point> input;
+    QVector<Output> output;
+    QString error;
+
+    // Streams of this shard, mapped to their slots in the arena.
+    QHash<qint64, int> streams;
+    DotsStreamArena arena;
+    // Streams dropped by an error, whose points are ignored until they are closed.
+    QSet<qint64> failedStreams;
+
+protected:
+    // Minimum number of points a stream drops at a time.
+    static const int MIN_EVICTION = 256;
+
+    void releaseStream(qint64 streamId, int slot)
+    {
+        arena.release(slot);
+        streams.remove(streamId);
+    }
+
+    // Read one output after each feed as the batch mode does, and all the remaining ones after finished.
+    void readOutput(qint64 streamId, int slot, bool all)
+    {
+        Output o;
+        o.streamId = streamId;
+        while (arena.readOutput(slot, o.index, o.x, o.y, o.t)) {
+            output.append(o);
+            if (!all)
+                break;
+        }
+    }
+};
+
+DotsFleet::DotsFleet(double lssdTh, Listener *listener, int numThreads) : lssdTh(lssdTh), listener(listener)
+{
+    if (numThreads <= 0)
+        numThreads = QThread::idealThreadCount();
+    if (numThreads <= 0)
+        numThreads = 1;
+    pool.setMaxThreadCount(numThreads);
+    for (int i=0; i<numThreads; ++i)
+        shards.append(new Shard(lssdTh));
+}
+
+DotsFleet::~DotsFleet()
+{
+    pool.waitForDone();
+    qDeleteAll(shards);
+}
+
+void DotsFleet::feed(const QVector<Point> &points)
+{
+    // Scatter the points to their shards.
+    for (int i=0; i<points.count(); ++i)
+        shards.at(shardOf(points.at(i).streamId))->input.append(points.at(i));
+
+    // Feed the shards in parallel.
+    if (shards.count() == 1) {
+        shards.first()->run();
+    } else {
+        foreach (Shard *shard, shards) {
+            if (!shard->input.isEmpty())
+                pool.start(shard);
+        }
+        pool.waitForDone();
+    }
+    report();
+}
+
+void DotsFleet::closeStream(qint64 streamId)
+{
+    shards.at(shardOf(streamId))->closeStream(streamId);
+    report();
+}
+
+void DotsFleet::finish()
+{
+    foreach (Shard *shard, shards)
+        shard->closeAll();
+    report();
+}
+
+int DotsFleet::streamCount() const
+{
+    int count = 0;
+    foreach (Shard *shard, shards)
+        count += shard->streams.count();
+    return count;
+}
+
+void DotsFleet::report()
+{
+    QString error;
+    foreach (Shard *shard, shards) {
+        if (listener) {
+            for (int i=0; i<shard->output.count(); ++i) {
+                const Shard::Output &o = shard->output.at(i);
+                listener->onSimplifiedPoint(o.streamId, o.index, o.x, o.y, o.t);
+            }
+        }
+        shard->output.resize(0);
+        if (error.isEmpty())
+            error = shard->error;
+        shard->error.clear();
+    }
+    if (!error.isEmpty())
+        DotsException(error).raise();
+}
@@ -0,0 +1,130 @@
+/* This software is developed by caoweiquan322 OR DynamicFatty.
+ * All rights reserved.
+ *
+ * Author: caoweiquan322
+ */
+
+/**
+  * @file
+  * @brief DotsFleet.h defines the DotsFleet class.
+  * @author caoweiquan322
+  * @date 2016/06/02
+  * @version 1.0
+  */
+#ifndef DOTSFLEET_H
+#define DOTSFLEET_H
+
+#include <QVector>
+#include <QHash>
+#include <QThreadPool>
+#include <QtGlobal>
+
+/**
+ * @brief The DotsFleet class runs the DOTS algorithm online for many streams at once, e.g. the GPS streams of a whole
+ * fleet of vehicles.
+ *
+ * Points of all the streams are fed in interleaved batches. Each stream is assigned to a shard by its id, and each
+ * shard is processed by one worker thread, so the streams never need any lock. The state of the streams of a shard is
+ * kept in its DotsStreamArena, which runs DOTS in streaming mode and recycles the buffers of closed streams. The
+ * simplified points are reported to a listener from the calling thread, in the order of shards.
+ *
+ * The coordinates should be normalized the way DotsSimplifier expects, and the simplified points are reported with
+ * exactly the coordinates fed.
+ */
+class DotsFleet
+{
+public:
+    /**
+     * @brief The Point struct is one point of a stream.
+     */
+    struct Point
+    {
+        qint64 streamId;
+        double x;
+        double y;
+        double t;
+    };
+
+    /**
+     * @brief The Listener class receives the simplified points.
+     */
+    class Listener
+    {
+    public:
+        virtual ~Listener() {}
+
+        /**
+         * @brief onSimplifiedPoint is called for each simplified point, in the order of the stream.
+         * @param streamId is the stream the point belongs to.
+         * @param index is the number of the point within its stream, starting from 0.
+         * @param x is the x position.
+         * @param y is the y position.
+         * @param t is the timestamp.
+         */
+        virtual void onSimplifiedPoint(qint64 streamId, int index, double x, double y, double t) = 0;
+    };
+
+    /**
+     * @brief DotsFleet is the default constructor.
+     * @param lssdTh is the LSSD threshold of all the streams.
+     * @param listener receives the simplified points.
+     * @param numThreads is the number of worker threads. A non-positive value means using all the available cores.
+     */
+    DotsFleet(double lssdTh, Listener *listener, int numThreads = 0);
+    ~DotsFleet();
+
+    /**
+     * @brief feed feeds a batch of points. Points of the same stream must be in time order, while points of different
+     * streams could be interleaved arbitrarily. A stream is opened by its first point. A stream whose point is rejected
+     * is dropped, and its later points are ignored until it is closed. The first rejection is raised as a DotsException
+     * once the whole batch is fed and reported.
+     * @param points is the batch of points.
+     */
+    void feed(const QVector<Point> &points);
+
+    /**
+     * @brief closeStream finishes a stream and reports its remaining simplified points.
+     * @param streamId is the stream to close.
+     */
+    void closeStream(qint64 streamId);
+
+    /**
+     * @brief finish closes all the open streams.
+     */
+    void finish();
+
+    /**
+     * @brief streamCount retrieves the number of open streams.
+     * @return the number of open streams.
+     */
+    int streamCount() const;
+
+protected:
+    class Shard;
+
+    /**
+     * @brief shardOf maps a stream to its shard.
+     * @param streamId is the stream id.
+     * @return index of the shard.
+     */
+    inline int shardOf(qint64 streamId) const
+    {
+        return (int)(qHash(streamId) % (uint)shards.count());
+    }
+
+    /**
+     * @brief report reports the simplified points buffered by the shards, and raises the first error recorded by them.
+     */
+    void report();
+
+protected:
+    double lssdTh;
+    Listener *listener;
+    QThreadPool pool;
+    QVector<Shard *> shards;
+
+private:
+    Q_DISABLE_COPY(DotsFleet)
+};
+
+#endif // DOTSFLEET_H
@@ -5,34 +5,212 @@
  */
 
 #include "DotsSimplifier.h"
+#include "DotsCascade.h"
 #include"Helper.h"
 #include"DotsException.h"
 #include<QVector>
 #include<QtMath>
+#include <QAtomicInt>
 #include <QDebug>
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define DOTS_LSSD_AVX
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define DOTS_LSSD_SSE2
+#endif
+
+namespace {
+
+typedef void (*LssdKernel)(const double *sums, const double *x, const double *y, const double *t,
+                           const int *fst, int count, int lst, double *distances);
+
+// Read by every simplifier thread, and switched by setSimdEnabled() at any time.
+QAtomicInt simdEnabled(1);
+
+void batchLSSDScalar(const double *sums, const double *x, const double *y, const double *t,
+                     const int *fst, int count, int lst, double *distances)
+{
+    for (int j=0; j<count; ++j)
+        distances[j] = fst[j]+1>=lst ? 0 : DotsSimplifier::computeLSSD(sums, x, y, t, fst[j], lst);
+}
+
+// The SIMD kernels evaluate DotsSimplifier::computeLSSD() for several first points at once, keeping its exact
+// operation order. The prefix sums of each first point are one contiguous block, which is loaded and transposed
+// into lanes.
+#ifdef DOTS_LSSD_SSE2
+void batchLSSDSse2(const double *sums, const double *x, const double *y, const double *t,
+                   const int *fst, int count, int lst, double *distances)
+{
+    const int STRIDE = 8;
+    int plst = lst-1;
+    const double *sl = sums+plst*STRIDE;
+    __m128d xl = _mm_set1_pd(x[lst]), yl = _mm_set1_pd(y[lst]), tl = _mm_set1_pd(t[lst]);
+    __m128d two = _mm_set1_pd(2.0), last = _mm_set1_pd(lst);
+    __m128d lsum[STRIDE];
+    for (int k=0; k<STRIDE; ++k)
+        lsum[k] = _mm_set1_pd(sl[k]);
+
+    int j = 0;
+    for (; j+2<=count; j+=2) {
+        int f0 = fst[j], f1 = fst[j+1];
+        __m128d fsum[STRIDE];
+        for (int k=0; k<STRIDE; k+=2) {
+            __m128d r0 = _mm_loadu_pd(sums+f0*STRIDE+k), r1 = _mm_loadu_pd(sums+f1*STRIDE+k);
+            fsum[k] = _mm_unpacklo_pd(r0, r1);
+            fsum[k+1] = _mm_unpackhi_pd(r0, r1);
+        }
+        __m128d xf = _mm_set_pd(x[f1], x[f0]), yf = _mm_set_pd(y[f1], y[f0]), tf = _mm_set_pd(t[f1], t[f0]);
+        __m128d n = _mm_set_pd(plst-f1, plst-f0);
+
+        __m128d c1x = _mm_sub_pd(_mm_mul_pd(xf, tl), _mm_mul_pd(xl, tf));
+        __m128d c2x = _mm_mul_pd(c1x, c1x);
+        __m128d c3x = _mm_sub_pd(tl, tf);
+        __m128d c4x = _mm_mul_pd(c3x, c3x);
+        __m128d c5x = _mm_sub_pd(xl, xf);
+        __m128d c6x = _mm_mul_pd(c5x, c5x);
+        __m128d c1y = _mm_sub_pd(_mm_mul_pd(yf, tl), _mm_mul_pd(yl, tf));
+        __m128d c2y = _mm_mul_pd(c1y, c1y);
+        __m128d c5y = _mm_sub_pd(yl, yf);
+        __m128d c6y = _mm_mul_pd(c5y, c5y);
+        __m128d dT = _mm_sub_pd(lsum[2], fsum[2]), dT2 = _mm_sub_pd(lsum[5], fsum[5]);
+
+        __m128d d = _mm_div_pd(_mm_mul_pd(n, c2x), c4x);
+        d = _mm_add_pd(d, _mm_mul_pd(_mm_div_pd(c6x, c4x), dT2));
+        d = _mm_add_pd(d, _mm_sub_pd(lsum[3], fsum[3]));
+        d = _mm_add_pd(d, _mm_mul_pd(_mm_div_pd(_mm_mul_pd(_mm_mul_pd(two, c1x), c5x), c4x), dT));
+        d = _mm_sub_pd(d, _mm_mul_pd(_mm_div_pd(_mm_mul_pd(two, c1x), c3x), _mm_sub_pd(lsum[0], fsum[0])));
+        d = _mm_sub_pd(d, _mm_mul_pd(_mm_div_pd(_mm_mul_pd(two, c5x), c3x), _mm_sub_pd(lsum[6], fsum[6])));
+        d = _mm_add_pd(d, _mm_div_pd(_mm_mul_pd(n, c2y), c4x));
+        d = _mm_add_pd(d, _mm_mul_pd(_mm_div_pd(c6y, c4x), dT2));
+        d = _mm_add_pd(d, _mm_sub_pd(lsum[4], fsum[4]));
+        d = _mm_add_pd(d, _mm_mul_pd(_mm_div_pd(_mm_mul_pd(_mm_mul_pd(two, c1y), c5y), c4x), dT));
+        d = _mm_sub_pd(d, _mm_mul_pd(_mm_div_pd(_mm_mul_pd(two, c1y), c3x), _mm_sub_pd(lsum[1], fsum[1])));
+        d = _mm_sub_pd(d, _mm_mul_pd(_mm_div_pd(_mm_mul_pd(two, c5y), c3x), _mm_sub_pd(lsum[7], fsum[7])));
+
+        // Adjacent or identical points have no error.
+        __m128d adjacent = _mm_cmpge_pd(_mm_set_pd(f1+1, f0+1), last);
+        _mm_storeu_pd(distances+j, _mm_andnot_pd(adjacent, d));
+    }
+    batchLSSDScalar(sums, x, y, t, fst+j, count-j, lst, distances+j);
+}
+#endif
+
+#ifdef DOTS_LSSD_AVX
+__attribute__((target("avx")))
+inline void transpose4(__m256d r0, __m256d r1, __m256d r2, __m256d r3, __m256d *c)
+{
+    __m256d t0 = _mm256_unpacklo_pd(r0, r1), t1 = _mm256_unpackhi_pd(r0, r1);
+    __m256d t2 = _mm256_unpacklo_pd(r2, r3), t3 = _mm256_unpackhi_pd(r2, r3);
+    c[0] = _mm256_permute2f128_pd(t0, t2, 0x20);
+    c[1] = _mm256_permute2f128_pd(t1, t3, 0x20);
+    c[2] = _mm256_permute2f128_pd(t0, t2, 0x31);
+    c[3] = _mm256_permute2f128_pd(t1, t3, 0x31);
+}
+
+__attribute__((target("avx")))
+void batchLSSDAvx(const double *sums, const double *x, const double *y, const double *t,
+                  const int *fst, int count, int lst, double *distances)
+{
+    const int STRIDE = 8;
+    int plst = lst-1;
+    const double *sl = sums+plst*STRIDE;
+    __m256d xl = _mm256_set1_pd(x[lst]), yl = _mm256_set1_pd(y[lst]), tl = _mm256_set1_pd(t[lst]);
+    __m256d two = _mm256_set1_pd(2.0), last = _mm256_set1_pd(lst);
+    __m256d lsum[STRIDE];
+    for (int k=0; k<STRIDE; ++k)
+        lsum[k] = _mm256_set1_pd(sl[k]);
+
+    int j = 0;
+    for (; j+4<=count; j+=4) {
+        const double *s0 = sums+fst[j]*STRIDE, *s1 = sums+fst[j+1]*STRIDE;
+        const double *s2 = sums+fst[j+2]*STRIDE, *s3 = sums+fst[j+3]*STRIDE;
+        __m256d fsum[STRIDE];
+        transpose4(_mm256_loadu_pd(s0), _mm256_loadu_pd(s1), _mm256_loadu_pd(s2), _mm256_loadu_pd(s3), fsum);
+        transpose4(_mm256_loadu_pd(s0+4), _mm256_loadu_pd(s1+4), _mm256_loadu_pd(s2+4), _mm256_loadu_pd(s3+4),
+                   fsum+4);
+        int f0 = fst[j], f1 = fst[j+1], f2 = fst[j+2], f3 = fst[j+3];
+        __m256d xf = _mm256_set_pd(x[f3], x[f2], x[f1], x[f0]);
+        __m256d yf = _mm256_set_pd(y[f3], y[f2], y[f1], y[f0]);
+        __m256d tf = _mm256_set_pd(t[f3], t[f2], t[f1], t[f0]);
+        __m256d n = _mm256_set_pd(plst-f3, plst-f2, plst-f1, plst-f0);
+
+        __m256d c1x = _mm256_sub_pd(_mm256_mul_pd(xf, tl), _mm256_mul_pd(xl, tf));
+        __m256d c2x = _mm256_mul_pd(c1x, c1x);
+        __m256d c3x = _mm256_sub_pd(tl, tf);
+        __m256d c4x = _mm256_mul_pd(c3x, c3x);
+        __m256d c5x = _mm256_sub_pd(xl, xf);
+        __m256d c6x = _mm256_mul_pd(c5x, c5x);
+        __m256d c1y = _mm256_sub_pd(_mm256_mul_pd(yf, tl), _mm256_mul_pd(yl, tf));
+        __m256d c2y = _mm256_mul_pd(c1y, c1y);
+        __m256d c5y = _mm256_sub_pd(yl, yf);
+        __m256d c6y = _mm256_mul_pd(c5y, c5y);
+        __m256d dT = _mm256_sub_pd(lsum[2], fsum[2]), dT2 = _mm256_sub_pd(lsum[5], fsum[5]);
+
+        __m256d d = _mm256_div_pd(_mm256_mul_pd(n, c2x), c4x);
+        d = _mm256_add_pd(d, _mm256_mul_pd(_mm256_div_pd(c6x, c4x), dT2));
+        d = _mm256_add_pd(d, _mm256_sub_pd(lsum[3], fsum[3]));
+        d = _mm256_add_pd(d, _mm256_mul_pd(_mm256_div_pd(_mm256_mul_pd(_mm256_mul_pd(two, c1x), c5x), c4x), dT));
+        d = _mm256_sub_pd(d, _mm256_mul_pd(_mm256_div_pd(_mm256_mul_pd(two, c1x), c3x),
+                                           _mm256_sub_pd(lsum[0], fsum[0])));
+        d = _mm256_sub_pd(d, _mm256_mul_pd(_mm256_div_pd(_mm256_mul_pd(two, c5x), c3x),
+                                           _mm256_sub_pd(lsum[6], fsum[6])));
+        d = _mm256_add_pd(d, _mm256_div_pd(_mm256_mul_pd(n, c2y), c4x));
+        d = _mm256_add_pd(d, _mm256_mul_pd(_mm256_div_pd(c6y, c4x), dT2));
+        d = _mm256_add_pd(d, _mm256_sub_pd(lsum[4], fsum[4]));
+        d = _mm256_add_pd(d, _mm256_mul_pd(_mm256_div_pd(_mm256_mul_pd(_mm256_mul_pd(two, c1y), c5y), c4x), dT));
+        d = _mm256_sub_pd(d, _mm256_mul_pd(_mm256_div_pd(_mm256_mul_pd(two, c1y), c3x),
+                                           _mm256_sub_pd(lsum[1], fsum[1])));
+        d = _mm256_sub_pd(d, _mm256_mul_pd(_mm256_div_pd(_mm256_mul_pd(two, c5y), c3x),
+                                           _mm256_sub_pd(lsum[7], fsum[7])));
+
+        // Adjacent or identical points have no error.
+        __m256d adjacent = _mm256_cmp_pd(_mm256_set_pd(f3+1, f2+1, f1+1, f0+1), last, _CMP_GE_OQ);
+        _mm256_storeu_pd(distances+j, _mm256_andnot_pd(adjacent, d));
+    }
+    batchLSSDScalar(sums, x, y, t, fst+j, count-j, lst, distances+j);
+}
+#endif
+
+LssdKernel selectKernel()
+{
+#ifdef DOTS_LSSD_AVX
+    if (__builtin_cpu_supports("avx"))
+        return batchLSSDAvx;
+#endif
+#ifdef DOTS_LSSD_SSE2
+    return batchLSSDSse2;
+#else
+    return batchLSSDScalar;
+#endif
+}
+
+}
+
 DotsSimplifier::DotsSimplifier(QObject *parent, DotsSimplifier *cascadeRoot) : QObject(parent)
 {
     lssdTh = 10000.0;
     lssdUpperBound = lssdTh*2.0;
     maxVkSize = 1e6;
+    streaming = false;
+    minEviction = 4096;
+    rebaseSums = false;
+    rootX = rootY = rootT = rootSums = NULL;
+    rootCapacity = 0;
     resetInternalData();
 
     // Assign reference to the root DOTS simplifier.
     isCascadeRoot = (cascadeRoot == NULL);
     if (isCascadeRoot)
         cascadeRoot = this;
+    else if (cascadeRoot->streaming)
+        DotsException("The streaming mode is not supported by cascade simplifiers.").raise();
     pX = &(cascadeRoot->ptx);
     pY = &(cascadeRoot->pty);
     pT = &(cascadeRoot->ptt);
-    pXSum = &(cascadeRoot->xSum);
-    pYSum = &(cascadeRoot->ySum);
-    pTSum = &(cascadeRoot->tSum);
-    pX2Sum = &(cascadeRoot->x2Sum);
-    pY2Sum = &(cascadeRoot->y2Sum);
-    pT2Sum = &(cascadeRoot->t2Sum);
-    pXTSum = &(cascadeRoot->xtSum);
-    pYTSum = &(cascadeRoot->ytSum);
+    pSums = &(cascadeRoot->sums);
 }
 
 void DotsSimplifier::setParameters(double lssdTh, double k, int maxVkSize)
@@ -42,6 +220,40 @@ void DotsSimplifier::setParameters(double lssdTh, double k, int maxVkSize)
     this->maxVkSize = maxVkSize;
 }
 
+void DotsSimplifier::reserve(int capacity)
+{
+    ptx.reserve(capacity);
+    pty.reserve(capacity);
+    ptt.reserve(capacity);
+    ptIndex.reserve(capacity);
+    sums.reserve(capacity*SUM_STRIDE);
+    issed.reserve(capacity);
+    parents.reserve(capacity);
+}
+
+void DotsSimplifier::pinCascadeRoot()
+{
+    if (isCascadeRoot)
+        DotsException("Only a non-root simplifier could pin the cascade root.").raise();
+    rootX = pX->constData();
+    rootY = pY->constData();
+    rootT = pT->constData();
+    rootSums = pSums->constData();
+    rootCapacity = qMin(qMin(pX->capacity(), pY->capacity()), qMin(pT->capacity(), pSums->capacity()/SUM_STRIDE));
+}
+
+void DotsSimplifier::setStreaming(bool enabled, int minEviction, bool rebaseSums)
+{
+    if (enabled && (!isCascadeRoot || pX != &ptx))
+        DotsException("The streaming mode is not supported by cascade simplifiers.").raise();
+    if (minEviction < 1)
+        DotsException("At least one point should be dropped at a time.").raise();
+    streaming = enabled;
+    this->minEviction = minEviction;
+    this->rebaseSums = rebaseSums;
+    nextEviction = ptIndex.count()+minEviction;
+}
+
 void DotsSimplifier::resetInternalData()
 {
     // Clear data points and internal statistics.
@@ -49,21 +261,18 @@ void DotsSimplifier::resetInternalData()
     pty.clear();
     ptt.clear();
     ptIndex.clear();
-    xSum.clear();
-    ySum.clear();
-    tSum.clear();
-    x2Sum.clear();
-    y2Sum.clear();
-    t2Sum.clear();
-    xtSum.clear();
-    ytSum.clear();
+    sums.clear();
 
     // Clear structures for DAG construction and optimization.
     vK.clear();
     vL.clear();
     terminated.clear();
     numTerminated = 0;
-    pathK.clear();
+    trellis.clear();
+    nodeK.clear();
+    nodeL.clear();
+    freeNode = -1;
+    decodedNode = -1;
     issed.clear();
     parents.clear();
 
@@ -72,6 +281,11 @@ void DotsSimplifier::resetInternalData()
     inputCount = 0;
     outputCount = 0;
 
+    // Streaming window.
+    nextEviction = minEviction;
+    windowStart = 0;
+    numDroppedOutputs = 0;
+
     // Finish flag.
     finished = false;
 }
@@ -98,7 +312,7 @@ double DotsSimplifier::getAverageSED()
     if (inputCount<1)
         DotsException("No data points in the containers.").raise();
 
-    return qSqrt(issed.at(inputCount-1)/inputCount);
+    return qSqrt(issed.at(inputCount-1)/(windowStart+inputCount));
 }
 
 double DotsSimplifier::getMaxLSSD()
@@ -107,6 +321,8 @@ double DotsSimplifier::getMaxLSSD()
         DotsException("Calling getMaxLSSD() is not allowed before finished feeding data.").raise();
     if (inputCount<1)
         DotsException("No data points in the containers.").raise();
+    if (windowStart > 0)
+        DotsException("Calling getMaxLSSD() is not allowed after the streaming mode dropped any point.").raise();
 
     // LSSD
     double ret = 0;
@@ -123,6 +339,103 @@ double DotsSimplifier::getMaxLSSD()
     return ret;
 }
 
+void DotsSimplifier::evictWindow()
+{
+    // Find the first point that would be visited again. The undecided paths may still contain points before the
+    // decoded one, so all the live trellis nodes are checked as well.
+    int base = qMin(trellis.at(decodedNode).index, inputCount);
+    if (outputCount < simplifiedIndex.count())
+        base = qMin(base, simplifiedIndex.at(outputCount));
+    for (int k=0; k<vL.count(); ++k)
+        base = qMin(base, (int)vL.at(k));
+    QVector<bool> released(trellis.count(), false);
+    for (int node=freeNode; node>=0; node=trellis.at(node).parent)
+        released[node] = true;
+    for (int node=0; node<trellis.count(); ++node)
+    {
+        if (!released.at(node))
+            base = qMin(base, trellis.at(node).index);
+    }
+
+    // Only drop points when the window would shrink at least by half, so that each point is moved O(1) times.
+    int numPoints = ptIndex.count();
+    if (base < qMax(minEviction, numPoints-base))
+    {
+        nextEviction = numPoints+minEviction;
+        return;
+    }
+
+    // Drop the input sequence.
+    ptx.remove(0, base);
+    pty.remove(0, base);
+    ptt.remove(0, base);
+    ptIndex.resize(numPoints-base);
+    for (int i=0; i<ptIndex.count(); ++i)
+        ptIndex[i] = i;
+
+    // Drop the prefix sums. Their differences are the same as the batch mode unless they are rebased.
+    sums.remove(0, base*SUM_STRIDE);
+    if (rebaseSums)
+    {
+        double origin[SUM_STRIDE];
+        for (int k=0; k<SUM_STRIDE; ++k)
+            origin[k] = sums.at(k);
+        double *s = sums.data();
+        for (int i=0; i<ptIndex.count(); ++i, s+=SUM_STRIDE)
+        {
+            for (int k=0; k<SUM_STRIDE; ++k)
+                s[k] -= origin[k];
+        }
+    }
+
+    // Shift the DAG. Parents dropped with the window are never followed again, but still mark points as assigned.
+    issed.remove(0, base);
+    parents.remove(0, base);
+    for (int i=0; i<parents.count(); ++i)
+    {
+        if (parents.at(i) >= 0)
+            parents[i] = qMax(parents.at(i)-base, 0);
+    }
+    for (int k=0; k<vK.count(); ++k)
+        vK[k] -= base;
+    for (int k=0; k<vL.count(); ++k)
+        vL[k] -= base;
+    for (int node=0; node<trellis.count(); ++node)
+    {
+        if (!released.at(node))
+            trellis[node].index -= base;
+    }
+
+    // Drop the outputs already read, except the last one which the final decoding starts from.
+    int numDropped = qMin(outputCount, simplifiedIndex.count()-1);
+    simplifiedIndex.remove(0, numDropped);
+    for (int k=0; k<simplifiedIndex.count(); ++k)
+        simplifiedIndex[k] -= base;
+    outputCount -= numDropped;
+    numDroppedOutputs += numDropped;
+
+    inputCount -= base;
+    windowStart += base;
+    nextEviction = ptIndex.count()+minEviction;
+}
+
+void DotsSimplifier::setSimdEnabled(bool enabled)
+{
+    simdEnabled.store(enabled ? 1 : 0);
+}
+
+bool DotsSimplifier::isSimdEnabled()
+{
+    return simdEnabled.load() != 0;
+}
+
+void DotsSimplifier::batchLSSD(const double *sums, const double *x, const double *y, const double *t,
+                               const int *fst, int count, int lst, double *distances)
+{
+    static const LssdKernel kernel = selectKernel();
+    (simdEnabled.load() ? kernel : batchLSSDScalar)(sums, x, y, t, fst, count, lst, distances);
+}
+
 int DotsSimplifier::getInputCount()
 {
     return inputCount;
@@ -151,18 +464,24 @@ void DotsSimplifier::batchDots(const QVector<double> &x, const QVector<double> &
 
 void DotsSimplifier::batchDotsByIndex(const QVector<double> &x, const QVector<double> &y, const QVector<double> &t,
                                       QVector<int> &simplifiedIndex, double lssdThreshold)
+{
+    batchDotsByIndex(x.constData(), y.constData(), t.constData(), x.count(), simplifiedIndex, lssdThreshold);
+}
+
+void DotsSimplifier::batchDotsByIndex(const double *x, const double *y, const double *t, int pointCount,
+                                      QVector<int> &simplifiedIndex, double lssdThreshold,
+                                      double originX, double originY, double originT, double scale)
 {
     DotsSimplifier simplifier;
     // Set the simplification tolerance to 3km.
     simplifier.setParameters(lssdThreshold);
-    int pointCount = x.count();
     int idx;
     simplifiedIndex.clear();
 
     for(int i=0; i<pointCount; ++i)
     {
         // Feed one point.
-        simplifier.feedData(x.at(i), y.at(i), t.at(i));
+        simplifier.feedData((x[i]-originX)*scale, (y[i]-originY)*scale, (t[i]-originT)*scale);
         // Check if there's output data.
         if(simplifier.readOutputIndex(idx))
         {
@@ -200,6 +519,13 @@ void DotsSimplifier::batchDotsCascade(const QVector<double> &x, const QVector<do
 
 void DotsSimplifier::batchDotsCascadeByIndex(const QVector<double> &x, const QVector<double> &y, const QVector<double> &t,
                                              QVector<int> &simplifiedIndex, double lssdThreshold)
+{
+    batchDotsCascadeByIndex(x.constData(), y.constData(), t.constData(), x.count(), simplifiedIndex, lssdThreshold);
+}
+
+void DotsSimplifier::batchDotsCascadeByIndex(const double *x, const double *y, const double *t, int pointCount,
+                                             QVector<int> &simplifiedIndex, double lssdThreshold,
+                                             double originX, double originY, double originT, double scale)
 {
     // Clear output.
     simplifiedIndex.clear();
@@ -210,68 +536,17 @@ void DotsSimplifier::batchDotsCascadeByIndex(const QVector<double> &x, const QVe
     int cascadeCount = qFloor(qLn(lssdThreshold/startThreshold)/qLn(2.0))+1;
     double k = qPow(lssdThreshold/startThreshold, 1.0/(cascadeCount-1));
     double th = startThreshold;
-    QObject *root = new QObject();
-    QVector<DotsSimplifier *> cascade;
+    QVector<double> thresholds;
     for (int i=0; i<cascadeCount; ++i)
     {
-        DotsSimplifier *s = new DotsSimplifier(root, i==0 ? NULL : cascade[0]);
-        s->setParameters(th, k);
+        thresholds.append(th);
         th*=k;
-        cascade.append(s);
     }
+    DotsCascade cascade(thresholds, k);
 
     // Run DOTS in cascade manner.
-    int pointCount = x.count();
-    double px, py, pt;
-    DotsSimplifier *first = cascade[0];
     for (int i=0; i<pointCount; ++i)
-    {
-        px = x.at(i);
-        py = y.at(i);
-        pt = t.at(i);
-        first->feedData(px, py, pt);
-        int index = -1;
-        if (first->readOutputIndex(index))
-        {
-            bool gotOutput = true;
-            for (int j=1; j<cascadeCount; ++j)
-            {
-                DotsSimplifier *s = cascade[j];
-                s->feedIndex(index);
-                if (!(s->readOutputIndex(index)))
-                {
-                    gotOutput = false;
-                    break;
-                }
-            }
-            if (gotOutput)
-            {
-                simplifiedIndex.append(index);
-            }
-        }
-    }
-//    qDebug("Output count: %d", ox.count());
-//    qDebug("=====> Finished <=======");
-
-    // Finish simplifiers from front to end.
-    for (int i=0; i<cascadeCount-1; ++i)
-    {
-        DotsSimplifier *s = cascade[i];
-        DotsSimplifier *n = cascade[i+1];
-        s->finish();
-        int index = -1;
-        while (s->readOutputIndex(index))
-            n->feedIndex(index);
-    }
-    // Read output from the last simplifier.
-    DotsSimplifier *last = cascade.last();
-    last->finish();
-    int index = -1;
-    while (last->readOutputIndex(index))
-    {
-        simplifiedIndex.append(index);
-    }
-
-    // Destroy the total cascade.
-    delete root;
+        cascade.feedData((x[i]-originX)*scale, (y[i]-originY)*scale, (t[i]-originT)*scale);
+    cascade.finish();
+    simplifiedIndex = cascade.getSimplifiedIndices(cascadeCount-1);
 }
@@ -57,6 +57,20 @@ public:
      */
     void resetInternalData();
 
+    /**
+     * @brief setStreaming enables or disables the streaming mode. In the streaming mode the points before the last
+     * decided simplified point are dropped from time to time, so that the memory is bounded by the undecided window
+     * instead of the whole input. The prefix sums are kept as they are, so the output is exactly the same as the batch
+     * mode. getMaxLSSD() is not available once any point was dropped. Only a simplifier which is not part of a cascade
+     * supports the streaming mode.
+     * @param enabled indicates if the streaming mode is enabled.
+     * @param minEviction is the minimum number of points to drop at a time.
+     * @param rebaseSums rebases the prefix sums on the first point kept whenever points are dropped, which keeps their
+     * magnitude from growing on an endless stream. The rebased sums may round differently from the batch mode, and
+     * rarely break a tie the other way.
+     */
+    void setStreaming(bool enabled, int minEviction = 4096, bool rebaseSums = false);
+
     /**
      * @brief feedData feeds a 2D spatio temporary point to DOTS.
      * @param x is the x position.
@@ -72,6 +86,10 @@ public:
             DotsException("We can only feed index to non-root simplifier. "\
                           "Try feedIndex() instead.").raise();
 
+        // Drop the points which would never be visited again.
+        if (streaming && ptIndex.count() >= nextEviction)
+            evictWindow();
+
         // Store data.
         ptx.append(x);
         pty.append(y);
@@ -92,24 +110,16 @@ public:
                               "due to numerical errors. Would you please consider normalizing the "\
                               "input data properly first?").raise();
             }
-            xSum.append(x);
-            ySum.append(y);
-            tSum.append(t);
-            x2Sum.append(x*x);
-            y2Sum.append(y*y);
-            t2Sum.append(t*t);
-            xtSum.append(x*t);
-            ytSum.append(y*t);
+            appendSums(x, y, t);
 
             // Setup the initial vK set {0}.
             vK.append(0);
             terminated.append(false);
             numTerminated = 0;
 
-            // Setup the following-path for viterbi decoding.
-            QVector<int> path;
-            path.append(0);
-            pathK.append(path);
+            // Setup the trellis for viterbi decoding.
+            decodedNode = allocNode(0, -1);
+            nodeK.append(decodedNode);
 
             // Set input/output queue.
             inputCount = 1;
@@ -118,15 +128,7 @@ public:
         }
         else
         {
-            int count = xSum.count()-1;
-            xSum.append(xSum[count]+x);
-            ySum.append(ySum[count]+y);
-            tSum.append(tSum[count]+t);
-            x2Sum.append(x2Sum[count]+x*x);
-            y2Sum.append(y2Sum[count]+y*y);
-            t2Sum.append(t2Sum[count]+t*t);
-            xtSum.append(xtSum[count]+x*t);
-            ytSum.append(ytSum[count]+y*t);
+            appendSums(x, y, t);
         }
         // Initialize issed&parents.
         issed.append(0);
@@ -141,6 +143,8 @@ public:
         if (isCascadeRoot)
             DotsException("We can only feed data to the cascade root simplifier. "\
                           "Try feedData() instead.").raise();
+        if (streaming)
+            DotsException("The streaming mode is not supported by cascade simplifiers.").raise();
 
         ptIndex.append(index);
         // Update internal data.
@@ -151,10 +155,9 @@ public:
             terminated.append(false);
             numTerminated = 0;
 
-            // Setup the following-path for viterbi decoding.
-            QVector<int> path;
-            path.append(0);
-            pathK.append(path);
+            // Setup the trellis for viterbi decoding.
+            decodedNode = allocNode(0, -1);
+            nodeK.append(decodedNode);
 
             // Set input/output queue.
             inputCount = 1;
@@ -177,12 +180,26 @@ public:
     inline bool readOutputData(double &x, double &y, double &t)
     {
         int index = -1;
+        return readOutputData(index, x, y, t);
+    }
+
+    /**
+     * @brief readOutputData checks if the simplifier outputs any data after the recent feeds. Output data will be
+     * stored in corresponding parameters if returned true.
+     * @param index the selected index to output.
+     * @param x the x value to output.
+     * @param y the y value to output.
+     * @param t the timestamp to output.
+     * @return true if there's output data, false otherwise.
+     */
+    inline bool readOutputData(int &index, double &x, double &y, double &t)
+    {
         if (!readOutputIndex(index))
             return false;
 
-        x = pX->at(index);
-        y = pY->at(index);
-        t = pT->at(index);
+        x = pX->at(index-windowStart);
+        y = pY->at(index-windowStart);
+        t = pT->at(index-windowStart);
         return true;
     }
 
@@ -201,7 +218,7 @@ public:
         // Retrieve one data.
         if (outputCount < simplifiedIndex.count())
         {
-            index = ptIndex.at(simplifiedIndex.at(outputCount));
+            index = ptIndex.at(simplifiedIndex.at(outputCount))+windowStart;
             ++outputCount;
             return true;
         }
@@ -216,10 +233,36 @@ public:
      */
     inline int getSimplifiedIndex(int i)
     {
-        if (i<0 || i>=simplifiedIndex.count())
-            DotsException(QString("Index %1 is out of range [0, %2)").arg(i).arg(simplifiedIndex.count())).raise();
+        int k = i-numDroppedOutputs;
+        if (k<0 || k>=simplifiedIndex.count())
+            DotsException(QString("Index %1 is out of range [%2, %3)").arg(i).arg(numDroppedOutputs).
+                          arg(numDroppedOutputs+simplifiedIndex.count())).raise();
 
-        return ptIndex.at(simplifiedIndex.at(i));
+        return ptIndex.at(simplifiedIndex.at(k))+windowStart;
+    }
+
+    /**
+     * @brief reserve preallocates the buffers of the input points, so that they are not moved before the number of
+     * points fed exceeds the capacity.
+     * @param capacity is the number of points to allocate for.
+     */
+    void reserve(int capacity);
+
+    /**
+     * @brief pinCascadeRoot makes a non-root simplifier read the buffers of the cascade root through pointers taken
+     * now, rather than through the root vectors. A level running on another thread than the root must do so after the
+     * root reserved its buffers, since the root vectors are modified while points are fed. Indices beyond the reserved
+     * capacity raise an exception.
+     */
+    void pinCascadeRoot();
+
+    /**
+     * @brief getWindowSize retrieves the number of points kept by the simplifier.
+     * @return the number of points kept.
+     */
+    inline int getWindowSize() const
+    {
+        return ptIndex.count();
     }
 
     /**
@@ -286,6 +329,36 @@ public:
     static void batchDotsCascadeByIndex(const QVector<double> &x, const QVector<double> &y, const QVector<double> &t,
                                         QVector<int> &simplifiedIndex, double lssdThreshold);
 
+    /**
+     * @brief batchDotsByIndex simplifies the points stored in plain arrays. Each point is fed as (x-originX)*scale,
+     * (y-originY)*scale and (t-originT)*scale, so that callers need not make a shifted and scaled copy.
+     * @param x
+     * @param y
+     * @param t
+     * @param pointCount is the number of points in x, y and t.
+     * @param simplifiedIndex
+     * @param lssdThreshold is the threshold in the scaled space.
+     */
+    static void batchDotsByIndex(const double *x, const double *y, const double *t, int pointCount,
+                                 QVector<int> &simplifiedIndex, double lssdThreshold,
+                                 double originX = 0, double originY = 0, double originT = 0, double scale = 1.0);
+
+    /**
+     * @brief batchDotsCascadeByIndex is the cascade version of batchDotsByIndex() on plain arrays.
+     */
+    static void batchDotsCascadeByIndex(const double *x, const double *y, const double *t, int pointCount,
+                                        QVector<int> &simplifiedIndex, double lssdThreshold,
+                                        double originX = 0, double originY = 0, double originT = 0,
+                                        double scale = 1.0);
+
+    /**
+     * @brief setSimdEnabled enables or disables the SIMD LSSD kernels for all simplifiers. The scalar kernel gives
+     * identical results and is mainly kept for benchmarking. It is safe to call while other threads simplify, which
+     * then switch kernels from their next batch of distances.
+     */
+    static void setSimdEnabled(bool enabled);
+    static bool isSimdEnabled();
+
 protected:
     /**
      * @brief directedAcyclicGraphSearch does a DAG search among the feeded spatio-temporal 2D data. The output queue
@@ -308,12 +381,21 @@ protected:
                     // Update vK if parent was not assigned yet.
                     if (parents.at(i) < 0)
                     {
+                        double distances[LSSD_CHUNK];
+                        int numEvaluated = 0, next = 0;
                         for (int j=0;j<vK.count(); ++j)
                         {
                             int jIndex = vK.at(j);
                             if (!terminated.at(j))
                             {
-                                double distance = getLSSD(jIndex,i);
+                                // Evaluate the alive Vk elements chunk by chunk, since the scan may stop early. The
+                                // first one is evaluated alone, as the scan mostly stops there.
+                                if (next == numEvaluated)
+                                {
+                                    numEvaluated = getAliveLSSD(j, i, distances, numEvaluated == 0 ? 1 : LSSD_CHUNK);
+                                    next = 0;
+                                }
+                                double distance = distances[next++];
                                 if (distance < lssdTh)
                                 {
                                     vL.append(i);
@@ -385,12 +467,21 @@ protected:
                     // Update vK if parent was not assigned yet.
                     if (parents.at(i) < 0)
                     {
+                        double distances[LSSD_CHUNK];
+                        int numEvaluated = 0, next = 0;
                         for (int j=0;j<vK.count(); ++j)
                         {
                             int jIndex = vK.at(j);
                             if (!terminated.at(j))
                             {
-                                double distance = getLSSD(jIndex,i);
+                                // Evaluate the alive Vk elements chunk by chunk, since the scan may stop early. The
+                                // first one is evaluated alone, as the scan mostly stops there.
+                                if (next == numEvaluated)
+                                {
+                                    numEvaluated = getAliveLSSD(j, i, distances, numEvaluated == 0 ? 1 : LSSD_CHUNK);
+                                    next = 0;
+                                }
+                                double distance = distances[next++];
                                 if (distance < lssdTh)
                                 {
                                     vL.append(i);
@@ -471,39 +562,161 @@ protected:
         lst = ptIndex.at(lst);
         if (fst+1>=lst)
             return 0;
-        if (fst<0 || lst>=pXSum->count())
+        // Other levels only get indices output by the root, and must not read the size of the root buffers, which may
+        // be growing on another thread in a pipelined cascade.
+        if (fst<0 || (isCascadeRoot && lst>=pX->count()))
             DotsException(QString("Index out of bound error.")).raise();
+        if (rootSums)
+        {
+            if (lst>=rootCapacity)
+                DotsException(QString("Index out of bound error.")).raise();
+            return computeLSSD(rootSums, rootX, rootY, rootT, fst, lst);
+        }
 
+        return computeLSSD(pSums->constData(), pX->constData(), pY->constData(), pT->constData(), fst, lst);
+    }
+
+public:
+    // The prefix sums of each point, in the order they are interleaved.
+    enum PrefixSum { SUM_X, SUM_Y, SUM_T, SUM_X2, SUM_Y2, SUM_T2, SUM_XT, SUM_YT, SUM_STRIDE };
+
+    /**
+     * @brief batchLSSD calculates the LSSD from each of the count points indexed by fst to the point indexed by lst.
+     * Distances of adjacent or identical points are 0. It dispatches to an AVX/SSE2 kernel if the CPU supports it.
+     */
+    static void batchLSSD(const double *sums, const double *x, const double *y, const double *t,
+                          const int *fst, int count, int lst, double *distances);
+
+    /**
+     * @brief computeLSSD evaluates the LSSD formula between two points of the cascade root, where fst+1<lst.
+     * The batch kernels follow exactly the same operation order, so that all of them give identical results.
+     * @param sums is the interleaved prefix sums.
+     * @param x is the x values of points.
+     * @param y is the y values of points.
+     * @param t is the timestamps of points.
+     * @param fst is index of the first point.
+     * @param lst is index of the second point.
+     * @return the LSSD distance.
+     */
+    static inline double computeLSSD(const double *sums, const double *x, const double *y, const double *t,
+                                     int fst, int lst)
+    {
         int plst = lst-1;
-        double c1x = pX->at(fst)*pT->at(lst)-pX->at(lst)*pT->at(fst);
+        const double *sf = sums+fst*SUM_STRIDE;
+        const double *sl = sums+plst*SUM_STRIDE;
+        double c1x = x[fst]*t[lst]-x[lst]*t[fst];
         double c2x = c1x*c1x;
-        double c3x = pT->at(lst)-pT->at(fst);
+        double c3x = t[lst]-t[fst];
         double c4x = c3x*c3x;
-        double c5x = pX->at(lst)-pX->at(fst);
+        double c5x = x[lst]-x[fst];
         double c6x = c5x*c5x;
 
-        double c1y = pY->at(fst)*pT->at(lst)-pY->at(lst)*pT->at(fst);
+        double c1y = y[fst]*t[lst]-y[lst]*t[fst];
         double c2y = c1y*c1y;
         double c3y = c3x;
         double c4y = c3y*c3y;
-        double c5y = pY->at(lst)-pY->at(fst);
+        double c5y = y[lst]-y[fst];
         double c6y = c5y*c5y;
 
         double distance = (plst-fst)*c2x/c4x
-                + c6x/c4x*(pT2Sum->at(plst)-pT2Sum->at(fst))
-                + (pX2Sum->at(plst)-pX2Sum->at(fst))
-                + 2*c1x*c5x/c4x*(pTSum->at(plst)-pTSum->at(fst))
-                - 2*c1x/c3x*(pXSum->at(plst)-pXSum->at(fst))
-                - 2*c5x/c3x*(pXTSum->at(plst)-pXTSum->at(fst))
+                + c6x/c4x*(sl[SUM_T2]-sf[SUM_T2])
+                + (sl[SUM_X2]-sf[SUM_X2])
+                + 2*c1x*c5x/c4x*(sl[SUM_T]-sf[SUM_T])
+                - 2*c1x/c3x*(sl[SUM_X]-sf[SUM_X])
+                - 2*c5x/c3x*(sl[SUM_XT]-sf[SUM_XT])
                 + (plst-fst)*c2y/c4y
-                + c6y/c4y*(pT2Sum->at(plst)-pT2Sum->at(fst))
-                + (pY2Sum->at(plst)-pY2Sum->at(fst))
-                + 2*c1y*c5y/c4y*(pTSum->at(plst)-pTSum->at(fst))
-                - 2*c1y/c3y*(pYSum->at(plst)-pYSum->at(fst))
-                - 2*c5y/c3y*(pYTSum->at(plst)-pYTSum->at(fst));
+                + c6y/c4y*(sl[SUM_T2]-sf[SUM_T2])
+                + (sl[SUM_Y2]-sf[SUM_Y2])
+                + 2*c1y*c5y/c4y*(sl[SUM_T]-sf[SUM_T])
+                - 2*c1y/c3y*(sl[SUM_Y]-sf[SUM_Y])
+                - 2*c5y/c3y*(sl[SUM_YT]-sf[SUM_YT]);
         return distance;
     }
 
+protected:
+    /**
+     * @brief getAliveLSSD calculates the LSSD to the point indexed by lst from at most maxCount not terminated
+     * elements of Vk set, starting at position from.
+     * @param from is the position of the first element of Vk set, which must not be terminated.
+     * @param lst is index of the second point.
+     * @param distances is the output LSSD distances, one for each not terminated element in order.
+     * @param maxCount is the number of elements to evaluate at most, no more than LSSD_CHUNK. A single one is
+     * evaluated by the scalar code.
+     * @return the number of distances calculated.
+     */
+    inline int getAliveLSSD(int from, int lst, double *distances, int maxCount)
+    {
+        if (maxCount == 1)
+        {
+            distances[0] = getLSSD((int)vK.at(from), lst);
+            return 1;
+        }
+        int fst[LSSD_CHUNK];
+        int count = 0;
+        for (int j=from; j<vK.count() && count<maxCount; ++j)
+        {
+            if (!terminated.at(j))
+                fst[count++] = ptIndex.at((int)vK.at(j));
+        }
+        getLSSD(fst, count, lst, distances);
+        return count;
+    }
+
+    /**
+     * @brief getLSSD calculates the LSSD from count points to the point indexed by lst. The distances are evaluated
+     * by the SIMD kernel if available.
+     * @param fst is the indices of the first points in the cascade root.
+     * @param count is the number of the first points.
+     * @param lst is index of the second point.
+     * @param distances is the output LSSD distances.
+     */
+    inline void getLSSD(const int *fst, int count, int lst, double *distances)
+    {
+        lst = ptIndex.at(lst);
+        if (isCascadeRoot && lst>=pX->count())
+            DotsException(QString("Index out of bound error.")).raise();
+        if (rootSums)
+        {
+            if (lst>=rootCapacity)
+                DotsException(QString("Index out of bound error.")).raise();
+            batchLSSD(rootSums, rootX, rootY, rootT, fst, count, lst, distances);
+            return;
+        }
+
+        batchLSSD(pSums->constData(), pX->constData(), pY->constData(), pT->constData(),
+                  fst, count, lst, distances);
+    }
+
+    /**
+     * @brief appendSums appends the prefix sums of one more point to the interleaved block.
+     */
+    inline void appendSums(double x, double y, double t)
+    {
+        int count = sums.count();
+        sums.resize(count+SUM_STRIDE);
+        double *s = sums.data()+count;
+        s[SUM_X] = x;
+        s[SUM_Y] = y;
+        s[SUM_T] = t;
+        s[SUM_X2] = x*x;
+        s[SUM_Y2] = y*y;
+        s[SUM_T2] = t*t;
+        s[SUM_XT] = x*t;
+        s[SUM_YT] = y*t;
+        if (count > 0) {
+            const double *last = s-SUM_STRIDE;
+            for (int k=0; k<SUM_STRIDE; ++k)
+                s[k] = last[k]+s[k];
+        }
+    }
+
+    /**
+     * @brief evictWindow drops the points before the decided simplified point, the first point without parent and the
+     * first unread output, none of which would be visited again. The prefix sums are rebased on the first point kept
+     * if asked by setStreaming().
+     */
+    void evictWindow();
+
     /**
      * @brief needUpdateVK Checks if we need to swap Vl and Vk sets.
      * @return true if a swap operation is necessary, false otherwise.
@@ -513,13 +726,62 @@ protected:
         return (vK.count() == numTerminated || vL.count()>= maxVkSize);
     }
 
+    /**
+     * @brief allocNode takes a trellis node from the free list, or appends a new one if the list is empty.
+     * @param index is the point the node stands for.
+     * @param parent is the parent node, or -1 for the root.
+     * @return the node allocated.
+     */
+    inline int allocNode(int index, int parent)
+    {
+        int node = freeNode;
+        if (node < 0)
+        {
+            node = trellis.count();
+            trellis.append(TrellisNode());
+        }
+        else
+        {
+            freeNode = trellis.at(node).parent;
+        }
+        TrellisNode &n = trellis[node];
+        n.index = index;
+        n.parent = parent;
+        n.children = 0;
+        n.childXor = 0;
+        if (parent >= 0)
+        {
+            ++trellis[parent].children;
+            trellis[parent].childXor ^= node;
+        }
+        return node;
+    }
+
+    /**
+     * @brief releaseNode frees a trellis node that no longer leads to the Vk set, and then its ancestors which become
+     * childless as well. The decoded node is always kept since it roots all the paths.
+     * @param node is the node to release.
+     */
+    inline void releaseNode(int node)
+    {
+        while (node != decodedNode && trellis.at(node).children == 0)
+        {
+            int parent = trellis.at(node).parent;
+            trellis[node].parent = freeNode;
+            freeNode = node;
+            --trellis[parent].children;
+            trellis[parent].childXor ^= node;
+            node = parent;
+        }
+    }
+
     /**
      * @brief updateVK swaps Vl and Vk sets and updates the DAG paths from root node to each elements of current Vk set.
      */
     inline void updateVK()
     {
-        // Update following-path.
-        QVector< QVector<int> > newPath;
+        // Append the Vl elements to the trellis.
+        nodeL.resize(vL.count());
         for (int k=0; k<vL.count(); ++k)
         {
             int indexK = -1;
@@ -532,12 +794,13 @@ protected:
                     break;
                 }
             }
-
-            QVector<int> p = pathK.at(indexK);
-            p.append(vL.at(k));
-            newPath.append(p);
+            nodeL[k] = allocNode(vL.at(k), nodeK.at(indexK));
         }
-        pathK = newPath;
+
+        // Drop the paths ending at Vk elements which got no child.
+        for (int m=0; m<nodeK.count(); ++m)
+            releaseNode(nodeK.at(m));
+        nodeK.swap(nodeL);
 
         // Update vK set.
         vK = vL;
@@ -554,11 +817,18 @@ protected:
      */
     inline void minimizeISSED()
     {
+        frontier.resize(vK.count());
+        lssdBuffer.resize(vK.count());
+        for (int k=0; k<vK.count(); ++k)
+            frontier[k] = ptIndex.at((int)vK.at(k));
+        double *distances = lssdBuffer.data();
         foreach (int i, vL) {
             double minDistance = issed.at(i);
             double minParent = parents.at(i);
-            foreach (int j, vK) {
-                double localDistance = getLSSD(j,i);
+            getLSSD(frontier.constData(), vK.count(), i, distances);
+            for (int k=0; k<vK.count(); ++k) {
+                int j = vK.at(k);
+                double localDistance = distances[k];
                 double distance = issed.at(j) + localDistance;
                 if (localDistance<lssdTh && distance<minDistance)
                 {
@@ -576,23 +846,14 @@ protected:
      */
     inline void viterbiDecode()
     {
-        int inputLayer = pathK.at(0).count();
-        int startLayer = simplifiedIndex.count();
-        while (startLayer < inputLayer) {
-            bool equal = true;
-            int reference = pathK.at(0).at(startLayer);
-            foreach (QVector<int> path, pathK) {
-                if (path.at(startLayer) != reference)
-                {
-                    equal = false;
-                    break;
-                }
-            }
-            if (!equal)
-                break;
-
-            simplifiedIndex.append(reference);
-            ++startLayer;
+        // All the paths pass the decoded node. They share its child as well if it has only one.
+        while (trellis.at(decodedNode).children == 1)
+        {
+            int child = trellis.at(decodedNode).childXor;
+            trellis[decodedNode].parent = freeNode;
+            freeNode = decodedNode;
+            decodedNode = child;
+            simplifiedIndex.append(trellis.at(child).index);
         }
     }
 
@@ -609,17 +870,41 @@ protected:
     QVector<double> ptx, pty, ptt;
     QVector<int> ptIndex;
     QVector<double> *pX, *pY, *pT;
-
-    // DOTS algorithm internal data.
-    QVector<double> xSum, ySum, tSum, x2Sum, y2Sum, t2Sum, xtSum, ytSum;
-    QVector<double> *pXSum, *pYSum, *pTSum, *pX2Sum, *pY2Sum, *pT2Sum, *pXTSum, *pYTSum;
+    // Buffers of the cascade root pinned by pinCascadeRoot(), and the number of points they could hold.
+    const double *rootX, *rootY, *rootT, *rootSums;
+    int rootCapacity;
+
+    // DOTS algorithm internal data. The prefix sums of each point are stored together in one 64-byte block, so that
+    // the LSSD kernel loads them from at most two cache lines. The QVector storage is not 64-byte aligned, so a block
+    // may straddle a line boundary.
+    QVector<double> sums;
+    QVector<double> *pSums;
     QVector<double> vK,vL;
     QVector<bool> terminated;
     int numTerminated;
-    QVector< QVector<int> > pathK;
     QVector<double> issed;
     QVector<int> parents;
 
+    // The Viterbi trellis holding the undecided part of the paths from root node to Vk elements. Each node points back
+    // to its parent and counts the children still leading to Vk. The children ids are XOR-ed together, so the only
+    // child is known once the count drops to 1. Released nodes are linked into a free list through parent.
+    struct TrellisNode
+    {
+        int index;
+        int parent;
+        int children;
+        int childXor;
+    };
+    QVector<TrellisNode> trellis;
+    QVector<int> nodeK, nodeL;
+    int freeNode;
+    int decodedNode;
+
+    // Scratch buffers of the LSSD kernel.
+    static const int LSSD_CHUNK = 8;
+    QVector<int> frontier;
+    QVector<double> lssdBuffer;
+
     // Output sequence.
     QVector<int> simplifiedIndex;
     int inputCount;
@@ -630,6 +915,14 @@ protected:
 
     bool isCascadeRoot;
 
+    // Streaming mode. The first windowStart points and the first numDroppedOutputs outputs were dropped.
+    bool streaming;
+    int minEviction;
+    bool rebaseSums;
+    int nextEviction;
+    int windowStart;
+    int numDroppedOutputs;
+
 signals:
 
 public slots:
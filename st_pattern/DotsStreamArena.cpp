@@ -0,0 +1,586 @@
+/* This software is developed by caoweiquan322 OR DynamicFatty.
+ * All rights reserved.
+ *
+ * Author: caoweiquan322
+ */
+
+#include "DotsStreamArena.h"
+#include "DotsSimplifier.h"
+#include <cstdlib>
+#include <new>
+
+DotsStreamArena::DotsStreamArena(double lssdTh, int minEviction, double k, int maxVkSize)
+{
+    this->lssdTh = lssdTh;
+    lssdUpperBound = lssdTh*k;
+    this->maxVkSize = maxVkSize;
+    this->minEviction = minEviction;
+    chunkBytes = 0;
+    cursor = NULL;
+    remaining = 0;
+}
+
+DotsStreamArena::~DotsStreamArena()
+{
+    for (int i=0; i<chunks.count(); ++i)
+        free(chunks.at(i));
+}
+
+char *DotsStreamArena::allocBlock(int sizeClass)
+{
+    QVector<char *> &blocks = freeBlocks[sizeClass];
+    if (!blocks.isEmpty())
+    {
+        char *block = blocks.last();
+        blocks.removeLast();
+        return block;
+    }
+
+    int blockBytes = 1<<(MIN_BLOCK_SHIFT+sizeClass);
+    bool alone = blockBytes > (1<<CHUNK_SHIFT)/16;
+    if (alone || remaining < blockBytes)
+    {
+        // The tail of the last chunk is left unused, which is less than 1/16 of it.
+        int bytes = alone ? blockBytes : 1<<CHUNK_SHIFT;
+        chunks.reserve(chunks.count()+1);
+        char *raw = (char *)malloc(bytes+63);
+        if (raw == NULL)
+            throw std::bad_alloc();
+        chunks.append(raw);
+        chunkBytes += bytes+63;
+        char *aligned = (char *)(((size_t)raw+63)/64*64);
+        if (alone)
+            return aligned;
+        cursor = aligned;
+        remaining = bytes;
+    }
+    char *block = cursor;
+    cursor += blockBytes;
+    remaining -= blockBytes;
+    return block;
+}
+
+int DotsStreamArena::open()
+{
+    int slot;
+    if (freeSlots.isEmpty())
+    {
+        slot = streams.count();
+        streams.append(Stream());
+    }
+    else
+    {
+        slot = freeSlots.last();
+        freeSlots.removeLast();
+    }
+
+    Stream &s = streams[slot];
+    memset(&s, 0, sizeof(Stream));
+    s.freeNode = -1;
+    s.decodedNode = -1;
+    s.nextEviction = minEviction;
+    return slot;
+}
+
+void DotsStreamArena::release(int slot)
+{
+    Stream &s = streams[slot];
+    freeSpan(s.x);
+    freeSpan(s.y);
+    freeSpan(s.t);
+    freeSpan(s.sums);
+    freeSpan(s.issed);
+    freeSpan(s.parents);
+    freeSpan(s.vK);
+    freeSpan(s.vL);
+    freeSpan(s.nodeK);
+    freeSpan(s.nodeL);
+    freeSpan(s.simplifiedIndex);
+    freeSpan(s.terminated);
+    freeSpan(s.trellis);
+    freeSlots.append(slot);
+}
+
+DotsStreamArena::Status DotsStreamArena::feed(int slot, double x, double y, double t)
+{
+    Stream &s = streams[slot];
+    if (s.finished)
+        return FED_AFTER_FINISHED;
+    if (s.x.count == 0)
+    {
+        if (qAbs(t) > 3600*24*365)
+            return FIRST_TIMESTAMP_TOO_BIG;
+        if (qAbs(x) > 2000*1000 || qAbs(y) > 2000*1000)
+            return FIRST_POSITION_TOO_BIG;
+    }
+
+    // Drop the points which would never be visited again.
+    if (s.x.count >= s.nextEviction)
+        evictWindow(s);
+
+    // Store data.
+    append(s.x, x);
+    append(s.y, y);
+    append(s.t, t);
+    appendSums(s, x, y, t);
+    if (s.x.count == 1)
+    {
+        // Setup the initial vK set {0}.
+        append(s.vK, 0);
+        append(s.terminated, (char)0);
+        s.numTerminated = 0;
+
+        // Setup the trellis for viterbi decoding.
+        s.decodedNode = allocNode(s, 0, -1);
+        append(s.nodeK, s.decodedNode);
+
+        // Set input/output queue.
+        s.inputCount = 1;
+        s.outputCount = 0;
+        append(s.simplifiedIndex, 0);
+    }
+    // Initialize issed&parents.
+    append(s.issed, 0.0);
+    append(s.parents, -1);
+    return OK;
+}
+
+bool DotsStreamArena::readOutput(int slot, int &index, double &x, double &y, double &t)
+{
+    Stream &s = streams[slot];
+    // Run DAG search to produce potentially more output data.
+    if (!s.finished && s.outputCount >= s.simplifiedIndex.count)
+        directedAcyclicGraphSearch(s);
+
+    // Retrieve one data.
+    if (s.outputCount < s.simplifiedIndex.count)
+    {
+        int i = s.simplifiedIndex.data[s.outputCount++];
+        index = i+s.windowStart;
+        x = s.x.data[i];
+        y = s.y.data[i];
+        t = s.t.data[i];
+        return true;
+    }
+    // No output yet.
+    return false;
+}
+
+void DotsStreamArena::finish(int slot)
+{
+    Stream &s = streams[slot];
+    if (!s.finished)
+    {
+        s.finished = true;
+        // Run DAG search once again to finish the simplification work.
+        directedAcyclicGraphSearch(s);
+    }
+}
+
+int DotsStreamArena::streamCount() const
+{
+    return streams.count()-freeSlots.count();
+}
+
+qint64 DotsStreamArena::reservedBytes() const
+{
+    return chunkBytes+(qint64)streams.capacity()*sizeof(Stream);
+}
+
+QString DotsStreamArena::statusMessage(Status status)
+{
+    switch (status)
+    {
+    case FED_AFTER_FINISHED:
+        return "Feeding data is NOT allowed after the stream finished.";
+    case FIRST_TIMESTAMP_TOO_BIG:
+        return "The first timestamp seems so big that DOTS would potentially fail "\
+               "due to numerical errors. Would you please consider normalizing the "\
+               "input data properly first?";
+    case FIRST_POSITION_TOO_BIG:
+        return "The first position seems so big that DOTS would potentially fail "\
+               "due to numerical errors. Would you please consider normalizing the "\
+               "input data properly first?";
+    default:
+        return QString();
+    }
+}
+
+void DotsStreamArena::appendSums(Stream &s, double x, double y, double t)
+{
+    int count = s.sums.count;
+    resize(s.sums, count+DotsSimplifier::SUM_STRIDE);
+    double *sum = s.sums.data+count;
+    sum[DotsSimplifier::SUM_X] = x;
+    sum[DotsSimplifier::SUM_Y] = y;
+    sum[DotsSimplifier::SUM_T] = t;
+    sum[DotsSimplifier::SUM_X2] = x*x;
+    sum[DotsSimplifier::SUM_Y2] = y*y;
+    sum[DotsSimplifier::SUM_T2] = t*t;
+    sum[DotsSimplifier::SUM_XT] = x*t;
+    sum[DotsSimplifier::SUM_YT] = y*t;
+    if (count > 0) {
+        const double *last = sum-DotsSimplifier::SUM_STRIDE;
+        for (int k=0; k<DotsSimplifier::SUM_STRIDE; ++k)
+            sum[k] = last[k]+sum[k];
+    }
+}
+
+inline double DotsStreamArena::getLSSD(const Stream &s, int fst, int lst) const
+{
+    if (fst+1>=lst)
+        return 0;
+    return DotsSimplifier::computeLSSD(s.sums.data, s.x.data, s.y.data, s.t.data, fst, lst);
+}
+
+int DotsStreamArena::getAliveLSSD(Stream &s, int from, int lst, double *distances, int maxCount)
+{
+    if (maxCount == 1)
+    {
+        distances[0] = getLSSD(s, s.vK.data[from], lst);
+        return 1;
+    }
+    int fst[LSSD_CHUNK];
+    int count = 0;
+    for (int j=from; j<s.vK.count && count<maxCount; ++j)
+    {
+        if (!s.terminated.data[j])
+            fst[count++] = s.vK.data[j];
+    }
+    DotsSimplifier::batchLSSD(s.sums.data, s.x.data, s.y.data, s.t.data, fst, count, lst, distances);
+    return count;
+}
+
+void DotsStreamArena::directedAcyclicGraphSearch(Stream &s)
+{
+    int numPoints = s.x.count;
+    if (s.finished)
+    {
+        // Construct the DAG completely.
+        while (true)
+        {
+            if (s.inputCount>=numPoints)
+                break;
+
+            // Move v* points to vL.
+            for (int i=s.inputCount; i<numPoints; ++i)
+            {
+                // Update vK if parent was not assigned yet.
+                if (s.parents.data[i] < 0)
+                {
+                    double distances[LSSD_CHUNK];
+                    int numEvaluated = 0, next = 0;
+                    for (int j=0; j<s.vK.count; ++j)
+                    {
+                        int jIndex = s.vK.data[j];
+                        if (!s.terminated.data[j])
+                        {
+                            // The first alive element is evaluated alone, as the scan mostly stops there.
+                            if (next == numEvaluated)
+                            {
+                                numEvaluated = getAliveLSSD(s, j, i, distances, numEvaluated == 0 ? 1 : LSSD_CHUNK);
+                                next = 0;
+                            }
+                            double distance = distances[next++];
+                            if (distance < lssdTh)
+                            {
+                                append(s.vL, i);
+                                s.issed.data[i] = s.issed.data[jIndex]+distance;
+                                s.parents.data[i] = jIndex;
+                                break;
+                            }
+                            else if (distance > lssdUpperBound)
+                            {
+                                s.terminated.data[j] = 1;
+                                ++s.numTerminated;
+
+                                // Check if all vK terminated.
+                                if (needUpdateVK(s))
+                                    break;
+                            }
+                        }
+                    }
+                }
+
+                // Update inputCount for consequent none v* points.
+                if (s.parents.data[i]>=0 && s.inputCount == i)
+                    ++s.inputCount;
+
+                // Terminate loop early if we need to update vK.
+                if (needUpdateVK(s))
+                    break;
+            }
+
+            // Minimize ISSED.
+            minimizeISSED(s);
+
+            // Force swap vK/vL no matter we need update vK.
+            updateVK(s);
+        }
+
+        // Decode the simplified data from back to front.
+        decoded.clear();
+        int idx = numPoints-1;
+        int currentIndex = -1;
+        if (s.simplifiedIndex.count > 0)
+            currentIndex = s.simplifiedIndex.data[s.simplifiedIndex.count-1];
+        while (idx>currentIndex)
+        {
+            decoded.append(idx);
+            idx = s.parents.data[idx];
+        }
+        for (int k=decoded.count()-1; k>=0; --k)
+            append(s.simplifiedIndex, decoded.at(k));
+    }
+    else
+    {
+        while (true)
+        {
+            bool vKUpdated = false;
+            if (s.inputCount>=numPoints)
+                break;
+
+            // Move v* points to vL.
+            for (int i=s.inputCount; i<numPoints; ++i)
+            {
+                // Update vK if parent was not assigned yet.
+                if (s.parents.data[i] < 0)
+                {
+                    double distances[LSSD_CHUNK];
+                    int numEvaluated = 0, next = 0;
+                    for (int j=0; j<s.vK.count; ++j)
+                    {
+                        int jIndex = s.vK.data[j];
+                        if (!s.terminated.data[j])
+                        {
+                            // The first alive element is evaluated alone, as the scan mostly stops there.
+                            if (next == numEvaluated)
+                            {
+                                numEvaluated = getAliveLSSD(s, j, i, distances, numEvaluated == 0 ? 1 : LSSD_CHUNK);
+                                next = 0;
+                            }
+                            double distance = distances[next++];
+                            if (distance < lssdTh)
+                            {
+                                append(s.vL, i);
+                                s.issed.data[i] = s.issed.data[jIndex]+distance;
+                                s.parents.data[i] = jIndex;
+
+                                // Check if vL exceeds max size.
+                                if (needUpdateVK(s))
+                                {
+                                    minimizeISSED(s);
+                                    updateVK(s);
+                                    viterbiDecode(s);
+                                    vKUpdated = true;
+                                }
+                                break;
+                            }
+                            else if (distance > lssdUpperBound)
+                            {
+                                s.terminated.data[j] = 1;
+                                ++s.numTerminated;
+
+                                // Check if all vK terminated.
+                                if (needUpdateVK(s))
+                                {
+                                    minimizeISSED(s);
+                                    updateVK(s);
+                                    viterbiDecode(s);
+                                    vKUpdated = true;
+                                    break;
+                                }
+                            }
+                        }
+                    }
+                }
+
+                // Update inputCount for consequent none v* points.
+                if (s.parents.data[i]>=0 && s.inputCount == i)
+                    ++s.inputCount;
+
+                if (vKUpdated)
+                    break;
+            }
+
+            // Stop DAG search if no new vK generated.
+            if (!vKUpdated)
+                break;
+        }
+    }
+}
+
+void DotsStreamArena::minimizeISSED(Stream &s)
+{
+    int numK = s.vK.count;
+    lssdBuffer.resize(numK);
+    double *distances = lssdBuffer.data();
+    for (int l=0; l<s.vL.count; ++l)
+    {
+        int i = s.vL.data[l];
+        double minDistance = s.issed.data[i];
+        int minParent = s.parents.data[i];
+        DotsSimplifier::batchLSSD(s.sums.data, s.x.data, s.y.data, s.t.data, s.vK.data, numK, i, distances);
+        for (int k=0; k<numK; ++k)
+        {
+            int j = s.vK.data[k];
+            double localDistance = distances[k];
+            double distance = s.issed.data[j] + localDistance;
+            if (localDistance<lssdTh && distance<minDistance)
+            {
+                minDistance = distance;
+                minParent = j;
+            }
+        }
+        s.issed.data[i] = minDistance;
+        s.parents.data[i] = minParent;
+    }
+}
+
+void DotsStreamArena::updateVK(Stream &s)
+{
+    // Append the Vl elements to the trellis.
+    resize(s.nodeL, s.vL.count);
+    for (int k=0; k<s.vL.count; ++k)
+    {
+        int indexK = -1;
+        int parentPos = s.parents.data[s.vL.data[k]];
+        for (int m=0; m<s.vK.count; ++m)
+        {
+            if (s.vK.data[m] == parentPos)
+            {
+                indexK = m;
+                break;
+            }
+        }
+        int node = allocNode(s, s.vL.data[k], s.nodeK.data[indexK]);
+        s.nodeL.data[k] = node;
+    }
+
+    // Drop the paths ending at Vk elements which got no child.
+    for (int m=0; m<s.nodeK.count; ++m)
+        releaseNode(s, s.nodeK.data[m]);
+    qSwap(s.nodeK, s.nodeL);
+
+    // Update vK set. The blocks of the old one are kept for the next Vl set.
+    qSwap(s.vK, s.vL);
+    s.vL.count = 0;
+    resize(s.terminated, s.vK.count);
+    memset(s.terminated.data, 0, s.terminated.count);
+    s.numTerminated = 0;
+}
+
+void DotsStreamArena::viterbiDecode(Stream &s)
+{
+    // All the paths pass the decoded node. They share its child as well if it has only one.
+    while (s.trellis.data[s.decodedNode].children == 1)
+    {
+        int child = s.trellis.data[s.decodedNode].childXor;
+        s.trellis.data[s.decodedNode].parent = s.freeNode;
+        s.freeNode = s.decodedNode;
+        s.decodedNode = child;
+        append(s.simplifiedIndex, s.trellis.data[child].index);
+    }
+}
+
+int DotsStreamArena::allocNode(Stream &s, int index, int parent)
+{
+    int node = s.freeNode;
+    if (node < 0)
+    {
+        node = s.trellis.count;
+        TrellisNode empty;
+        append(s.trellis, empty);
+    }
+    else
+    {
+        s.freeNode = s.trellis.data[node].parent;
+    }
+    TrellisNode &n = s.trellis.data[node];
+    n.index = index;
+    n.parent = parent;
+    n.children = 0;
+    n.childXor = 0;
+    if (parent >= 0)
+    {
+        ++s.trellis.data[parent].children;
+        s.trellis.data[parent].childXor ^= node;
+    }
+    return node;
+}
+
+void DotsStreamArena::releaseNode(Stream &s, int node)
+{
+    while (node != s.decodedNode && s.trellis.data[node].children == 0)
+    {
+        int parent = s.trellis.data[node].parent;
+        s.trellis.data[node].parent = s.freeNode;
+        s.freeNode = node;
+        --s.trellis.data[parent].children;
+        s.trellis.data[parent].childXor ^= node;
+        node = parent;
+    }
+}
+
+void DotsStreamArena::evictWindow(Stream &s)
+{
+    // Find the first point that would be visited again, as DotsSimplifier::evictWindow() does.
+    int base = qMin(s.trellis.data[s.decodedNode].index, s.inputCount);
+    if (s.outputCount < s.simplifiedIndex.count)
+        base = qMin(base, s.simplifiedIndex.data[s.outputCount]);
+    for (int k=0; k<s.vL.count; ++k)
+        base = qMin(base, s.vL.data[k]);
+    released.resize(s.trellis.count);
+    released.fill(false);
+    for (int node=s.freeNode; node>=0; node=s.trellis.data[node].parent)
+        released[node] = true;
+    for (int node=0; node<s.trellis.count; ++node)
+    {
+        if (!released.at(node))
+            base = qMin(base, s.trellis.data[node].index);
+    }
+
+    // Only drop points when the window would shrink at least by half, so that each point is moved O(1) times.
+    int numPoints = s.x.count;
+    if (base < qMax(minEviction, numPoints-base))
+    {
+        s.nextEviction = numPoints+minEviction;
+        return;
+    }
+
+    // Drop the input sequence and its prefix sums, which are not rebased.
+    removeFront(s.x, base);
+    removeFront(s.y, base);
+    removeFront(s.t, base);
+    removeFront(s.sums, base*DotsSimplifier::SUM_STRIDE);
+
+    // Shift the DAG. Parents dropped with the window are never followed again, but still mark points as assigned.
+    removeFront(s.issed, base);
+    removeFront(s.parents, base);
+    for (int i=0; i<s.parents.count; ++i)
+    {
+        if (s.parents.data[i] >= 0)
+            s.parents.data[i] = qMax(s.parents.data[i]-base, 0);
+    }
+    for (int k=0; k<s.vK.count; ++k)
+        s.vK.data[k] -= base;
+    for (int k=0; k<s.vL.count; ++k)
+        s.vL.data[k] -= base;
+    for (int node=0; node<s.trellis.count; ++node)
+    {
+        if (!released.at(node))
+            s.trellis.data[node].index -= base;
+    }
+
+    // Drop the outputs already read, except the last one which the final decoding starts from.
+    int numDropped = qMin(s.outputCount, s.simplifiedIndex.count-1);
+    removeFront(s.simplifiedIndex, numDropped);
+    for (int k=0; k<s.simplifiedIndex.count; ++k)
+        s.simplifiedIndex.data[k] -= base;
+    s.outputCount -= numDropped;
+    s.numDroppedOutputs += numDropped;
+
+    s.inputCount -= base;
+    s.windowStart += base;
+    s.nextEviction = s.x.count+minEviction;
+}
@@ -0,0 +1,267 @@
+/* This software is developed by caoweiquan322 OR DynamicFatty.
+ * All rights reserved.
+ *
+ * Author: caoweiquan322
+ */
+
+/**
+  * @file
+  * @brief DotsStreamArena.h defines the DotsStreamArena class.
+  * @author caoweiquan322
+  * @date 2016/06/08
+  * @version 1.0
+  */
+#ifndef DOTSSTREAMARENA_H
+#define DOTSSTREAMARENA_H
+
+#include <QVector>
+#include <QString>
+#include <QtGlobal>
+#include <cstring>
+
+/**
+ * @brief The DotsStreamArena class runs the DOTS algorithm in streaming mode for many streams, whose state is kept in
+ * one arena instead of a DotsSimplifier each. It is used by one thread at a time.
+ *
+ * A stream is addressed by its slot. The fixed part of each stream is one entry of a vector indexed by slot, and each
+ * of its growing arrays (the window of points and their prefix sums, the Vk/Vl layers, the trellis and the outputs) is
+ * a block of the arena. Blocks are powers of two from 64 bytes, aligned to 64 bytes and carved from large chunks. The
+ * blocks of a released stream are kept in free lists for the next streams, so opening and closing streams does not
+ * touch the heap once the arena is warm.
+ *
+ * The simplification is the same as DotsSimplifier in streaming mode without rebasing the prefix sums, so each stream
+ * gives exactly the output of DotsSimplifier::batchDotsByIndex(). Bad input is reported by a status code rather than
+ * an exception.
+ */
+class DotsStreamArena
+{
+public:
+    /**
+     * @brief The Status enum tells if a point was fed.
+     */
+    enum Status
+    {
+        OK,
+        FED_AFTER_FINISHED,
+        FIRST_TIMESTAMP_TOO_BIG,
+        FIRST_POSITION_TOO_BIG
+    };
+
+    /**
+     * @brief DotsStreamArena is the default constructor.
+     * @param lssdTh is the LSSD threshold of all the streams.
+     * @param minEviction is the minimum number of points a stream drops at a time.
+     * @param k is the factor for upper bound. LSSD that exceeds lssdTh*k would be ignored by DAG searching.
+     * @param maxVkSize is the maximum size of each layer of DAG tree.
+     */
+    DotsStreamArena(double lssdTh, int minEviction = 4096, double k = 2.0, int maxVkSize = 1e6);
+    ~DotsStreamArena();
+
+    /**
+     * @brief open opens a new stream.
+     * @return the slot of the stream.
+     */
+    int open();
+
+    /**
+     * @brief release gives the blocks of a stream back to the arena. The slot could be returned by open() again.
+     * @param slot is the stream.
+     */
+    void release(int slot);
+
+    /**
+     * @brief feed feeds a 2D spatio temporary point to a stream.
+     * @param slot is the stream.
+     * @param x is the x position.
+     * @param y is the y position.
+     * @param t is the timestamp.
+     * @return OK if the point was fed, or why it was not.
+     */
+    Status feed(int slot, double x, double y, double t);
+
+    /**
+     * @brief readOutput checks if a stream outputs any point after the recent feeds.
+     * @param slot is the stream.
+     * @param index is the number of the point within its stream.
+     * @param x is the x position.
+     * @param y is the y position.
+     * @param t is the timestamp.
+     * @return true if there's output data, false otherwise.
+     */
+    bool readOutput(int slot, int &index, double &x, double &y, double &t);
+
+    /**
+     * @brief finish finishes a stream, whose remaining outputs are then read by readOutput(). No more points could be
+     * fed to it.
+     * @param slot is the stream.
+     */
+    void finish(int slot);
+
+    /**
+     * @brief streamCount retrieves the number of open streams.
+     * @return the number of open streams.
+     */
+    int streamCount() const;
+
+    /**
+     * @brief reservedBytes retrieves the bytes taken from the heap by the arena, including the stream entries.
+     * @return the bytes reserved.
+     */
+    qint64 reservedBytes() const;
+
+    /**
+     * @brief statusMessage describes a status the way DotsSimplifier describes the same error.
+     * @param status is the status.
+     * @return the message.
+     */
+    static QString statusMessage(Status status);
+
+protected:
+    // A growing array of a stream, stored in a block of the arena.
+    template <class T>
+    struct Span
+    {
+        T *data;
+        int count;
+        int capacity;
+    };
+
+    struct TrellisNode
+    {
+        int index;
+        int parent;
+        int children;
+        int childXor;
+    };
+
+    // The state of a stream. The first windowStart points and the first numDroppedOutputs outputs were dropped.
+    struct Stream
+    {
+        Span<double> x, y, t, sums, issed;
+        Span<int> parents, vK, vL, nodeK, nodeL, simplifiedIndex;
+        Span<char> terminated;
+        Span<TrellisNode> trellis;
+        int numTerminated;
+        int freeNode;
+        int decodedNode;
+        int inputCount;
+        int outputCount;
+        int nextEviction;
+        int windowStart;
+        int numDroppedOutputs;
+        bool finished;
+    };
+
+    // Block sizes are 64<<sizeClass bytes. Blocks up to 1/16 of a chunk are carved from the chunks, and larger ones
+    // are allocated alone.
+    static const int MIN_BLOCK_SHIFT = 6;
+    static const int CHUNK_SHIFT = 20;
+    static const int NUM_CLASSES = 31-MIN_BLOCK_SHIFT;
+    static const int LSSD_CHUNK = 8;
+
+    static inline int sizeClassOf(qint64 bytes)
+    {
+        int sizeClass = 0;
+        while (((qint64)1<<(MIN_BLOCK_SHIFT+sizeClass)) < bytes)
+            ++sizeClass;
+        return sizeClass;
+    }
+
+    /**
+     * @brief allocBlock takes a block of the size class from its free list, or from the heap.
+     * @param sizeClass is the size class.
+     * @return the block.
+     */
+    char *allocBlock(int sizeClass);
+
+    template <class T>
+    void grow(Span<T> &span, int count)
+    {
+        int sizeClass = sizeClassOf((qint64)count*sizeof(T));
+        T *data = (T *)allocBlock(sizeClass);
+        int oldCount = span.count;
+        if (oldCount > 0)
+            memcpy(data, span.data, oldCount*sizeof(T));
+        freeSpan(span);
+        span.data = data;
+        span.count = oldCount;
+        span.capacity = (int)(((qint64)1<<(MIN_BLOCK_SHIFT+sizeClass))/sizeof(T));
+    }
+
+    template <class T>
+    void freeSpan(Span<T> &span)
+    {
+        if (span.data)
+            freeBlocks[sizeClassOf((qint64)span.capacity*sizeof(T))].append((char *)span.data);
+        span.data = NULL;
+        span.count = 0;
+        span.capacity = 0;
+    }
+
+    template <class T>
+    inline void append(Span<T> &span, T value)
+    {
+        if (span.count == span.capacity)
+            grow(span, span.count+1);
+        span.data[span.count++] = value;
+    }
+
+    template <class T>
+    inline void resize(Span<T> &span, int count)
+    {
+        if (count > span.capacity)
+            grow(span, count);
+        span.count = count;
+    }
+
+    template <class T>
+    static inline void removeFront(Span<T> &span, int count)
+    {
+        span.count -= count;
+        memmove(span.data, span.data+count, span.count*sizeof(T));
+    }
+
+    // The steps of DotsSimplifier, on the state of a stream.
+    void appendSums(Stream &s, double x, double y, double t);
+    void directedAcyclicGraphSearch(Stream &s);
+    int getAliveLSSD(Stream &s, int from, int lst, double *distances, int maxCount);
+    void evictWindow(Stream &s);
+    void minimizeISSED(Stream &s);
+    void updateVK(Stream &s);
+    void viterbiDecode(Stream &s);
+    int allocNode(Stream &s, int index, int parent);
+    void releaseNode(Stream &s, int node);
+
+    inline double getLSSD(const Stream &s, int fst, int lst) const;
+
+    inline bool needUpdateVK(const Stream &s) const
+    {
+        return s.vK.count == s.numTerminated || s.vL.count >= maxVkSize;
+    }
+
+protected:
+    double lssdTh;
+    double lssdUpperBound;
+    int maxVkSize;
+    int minEviction;
+
+    QVector<Stream> streams;
+    QVector<int> freeSlots;
+
+    // The chunks and the blocks allocated alone, as returned by malloc, before aligning.
+    QVector<char *> chunks;
+    qint64 chunkBytes;
+    char *cursor;
+    int remaining;
+    QVector<char *> freeBlocks[NUM_CLASSES];
+
+    // Scratch buffers shared by the streams.
+    QVector<double> lssdBuffer;
+    QVector<bool> released;
+    QVector<int> decoded;
+
+private:
+    Q_DISABLE_COPY(DotsStreamArena)
+};
+
+#endif // DOTSSTREAMARENA_H
@@ -15,6 +15,7 @@
 #include <QFileInfoList>
 #include <QFileInfo>
 #include <QDebug>
+#include <cstring>
 
 const QString Helper::MOPSI_DATETIME_FORMAT("yyyy-MM-dd-H:mm:ss");
 const double Helper::SCALE_FACTOR_PRECISION = 1e-4;
@@ -182,6 +183,312 @@ void Helper::parseGeoLife(QString fileName, QVector<double> &x, QVector<double>
     }
 }
 
+namespace {
+
+// The whole file mapped into memory. It falls back to reading the file if mapping is not supported.
+class MappedFile
+{
+public:
+    MappedFile(const QString &fileName) : file(fileName), data(NULL), size(0)
+    {
+        if (!file.open(QIODevice::ReadOnly))
+            DotsException(QString("Open file %1 error.").arg(fileName)).raise();
+        size = file.size();
+        if (size <= 0)
+            return;
+        data = reinterpret_cast<const char *>(file.map(0, size));
+        if (data == NULL) {
+            buffer = file.readAll();
+            data = buffer.constData();
+            size = buffer.size();
+        }
+    }
+
+    const char *begin() const { return data; }
+    const char *end() const { return data + size; }
+
+private:
+    QFile file;
+    QByteArray buffer;
+    const char *data;
+    qint64 size;
+};
+
+// The same white spaces as the ones removed by QByteArray::trimmed().
+inline bool isSpace(char c)
+{
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+inline bool isDigit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+// Upper bound of the number of lines, used to preallocate the output arrays.
+int countLines(const char *p, const char *e)
+{
+    int lines = 1;
+    while ((p = static_cast<const char *>(memchr(p, '\n', e-p))) != NULL) {
+        ++lines;
+        ++p;
+    }
+    return lines;
+}
+
+// Advances p to the next line and returns the trimmed current line as [begin, end).
+inline void nextLine(const char *&p, const char *e, const char *&begin, const char *&end)
+{
+    const char *lineEnd = static_cast<const char *>(memchr(p, '\n', e-p));
+    if (lineEnd == NULL)
+        lineEnd = e;
+    begin = p;
+    end = lineEnd;
+    p = lineEnd < e ? lineEnd+1 : e;
+    while (begin < end && isSpace(*begin))
+        ++begin;
+    while (end > begin && isSpace(end[-1]))
+        --end;
+}
+
+// Splits [p, e) by sep like QByteArray::split(). Returns the number of parts, while only the first maxParts ones
+// are stored.
+inline int splitLine(const char *p, const char *e, char sep, const char **begins, const char **ends, int maxParts)
+{
+    int parts = 0;
+    while (true) {
+        const char *partEnd = static_cast<const char *>(memchr(p, sep, e-p));
+        if (partEnd == NULL)
+            partEnd = e;
+        if (parts < maxParts) {
+            begins[parts] = p;
+            ends[parts] = partEnd;
+        }
+        ++parts;
+        if (partEnd == e)
+            return parts;
+        p = partEnd+1;
+    }
+}
+
+// Decodes a plain decimal number such as "-63.325585". The result is exact as long as the digits fit in the
+// mantissa and the power of ten is exactly representable. Other forms go through QByteArray::toDouble().
+inline double decodeDouble(const char *p, const char *e)
+{
+    static const double POW10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                   1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+    static const quint64 MAX_MANTISSA = Q_UINT64_C(1)<<53;
+    const char *s = p;
+    bool negative = false;
+    if (s < e && (*s == '-' || *s == '+')) {
+        negative = (*s == '-');
+        ++s;
+    }
+    quint64 mantissa = 0;
+    int numDigits = 0, numDecimals = 0;
+    bool dot = false;
+    for (; s < e; ++s) {
+        if (isDigit(*s)) {
+            mantissa = mantissa*10 + (*s - '0');
+            if (mantissa > MAX_MANTISSA)
+                break;
+            ++numDigits;
+            if (dot)
+                ++numDecimals;
+        } else if (*s == '.' && !dot) {
+            dot = true;
+        } else {
+            break;
+        }
+    }
+    if (s == e && numDigits > 0 && numDecimals <= 22) {
+        double value = (double)mantissa/POW10[numDecimals];
+        return negative ? -value : value;
+    }
+    return QByteArray::fromRawData(p, int(e-p)).toDouble();
+}
+
+inline bool decodeDigits(const char *p, int count, int &value)
+{
+    value = 0;
+    for (int i=0; i<count; ++i) {
+        if (!isDigit(p[i]))
+            return false;
+        value = value*10 + (p[i] - '0');
+    }
+    return true;
+}
+
+// Decodes the MOPSI local date-time, i.e. "yyyy-MM-dd" and "H:mm:ss", into the same timestamp as QDateTime does.
+// QDateTime is only asked once per hour, since the rest of an hour is a fixed offset unless a daylight saving
+// transition happens in it. Anything unusual is passed to QDateTime::fromString() as is.
+class LocalTimeDecoder
+{
+public:
+    LocalTimeDecoder() : cachedHour(-1), hourStart(0), linearHour(false) {}
+
+    double decode(const char *date, const char *dateEnd, const char *time, const char *timeEnd)
+    {
+        int year, month, day, hour, minute, second;
+        int hourLen = timeEnd-time-6;
+        if (dateEnd-date == 10 && date[4] == '-' && date[7] == '-' &&
+                decodeDigits(date, 4, year) && decodeDigits(date+5, 2, month) && decodeDigits(date+8, 2, day) &&
+                (hourLen == 1 || (hourLen == 2 && time[0] != '0')) &&
+                time[hourLen] == ':' && time[hourLen+3] == ':' && decodeDigits(time, hourLen, hour) &&
+                decodeDigits(time+hourLen+1, 2, minute) && decodeDigits(time+hourLen+4, 2, second) &&
+                hour < 24 && minute < 60 && second < 60) {
+            qint64 key = ((qint64(year)*100+month)*100+day)*100+hour;
+            if (key != cachedHour) {
+                cachedHour = key;
+                QDate d(year, month, day);
+                QDateTime start(d, QTime(hour, 0, 0)), end(d, QTime(hour, 59, 59));
+                hourStart = start.toTime_t();
+                linearHour = start.isValid() && end.isValid() && hourStart != uint(-1) &&
+                        end.toTime_t() - hourStart == 3599;
+            }
+            if (linearHour)
+                return (double)(hourStart + minute*60 + second);
+        }
+        QByteArray dateTime = QByteArray(date, int(dateEnd-date)) + '-' + QByteArray(time, int(timeEnd-time));
+        return (double)QDateTime::fromString(dateTime, Helper::MOPSI_DATETIME_FORMAT).toTime_t();
+    }
+
+private:
+    qint64 cachedHour;
+    uint hourStart;
+    bool linearHour;
+};
+
+// Projects and normalizes the parsed longitude/latitude just like the line based parsers.
+void finishParsing(QVector<double> &longitude, QVector<double> &latitude, QVector<double> &x, QVector<double> &y,
+                   QVector<double> &t, bool doMercator, bool doNormalize)
+{
+    if (doMercator) {
+        Helper::mercatorProject(longitude, latitude, x, y);
+    } else {
+        x = longitude;
+        y = latitude;
+    }
+    if (doNormalize) {
+        Helper::normalizeData(x, true);
+        Helper::normalizeData(y, true);
+        Helper::normalizeData(t, false);
+    }
+}
+
+}
+
+void Helper::parseMOPSIMapped(QString fileName, QVector<double> &x, QVector<double> &y, QVector<double> &t,
+                              bool doMercator, bool doNormalize)
+{
+    // Check if file name is null or empty.
+    Helper::checkNotNullNorEmpty("fileName", fileName);
+    try
+    {
+        MappedFile file(fileName.trimmed());
+        int capacity = countLines(file.begin(), file.end());
+        QVector<double> longitude(capacity), latitude(capacity);
+        x.clear();
+        y.clear();
+        t.resize(capacity);
+        double *lon = longitude.data(), *lat = latitude.data(), *ts = t.data();
+        int count = 0;
+        LocalTimeDecoder timeDecoder;
+        const char *begins[4], *ends[4];
+        const char *p = file.begin(), *e = file.end(), *lineBegin, *lineEnd;
+        while (p < e)
+        {
+            nextLine(p, e, lineBegin, lineEnd);
+            if (lineBegin == lineEnd)
+                continue;
+
+            // In case where the line is malformed.
+            if (splitLine(lineBegin, lineEnd, ' ', begins, ends, 4) != 4)
+            {
+                DotsException("Malformed line found.").raise();
+            }
+
+            // Store the parsed data without cleaning it.
+            double timestamp = timeDecoder.decode(begins[2], ends[2], begins[3], ends[3]);
+            if (count > 0 && timestamp-ts[count-1] < 1e-15) // Duplicated time point.
+                continue;
+            lat[count] = decodeDouble(begins[0], ends[0]);
+            lon[count] = decodeDouble(begins[1], ends[1]);
+            ts[count] = timestamp;
+            ++count;
+        }
+        longitude.resize(count);
+        latitude.resize(count);
+        t.resize(count);
+        finishParsing(longitude, latitude, x, y, t, doMercator, doNormalize);
+    }
+    catch (DotsException &e)
+    {
+        e.raise();
+    }
+    catch (QException &)
+    {
+        DotsException("Error occured when parsing trajectory file.").raise();
+    }
+}
+
+void Helper::parseGeoLifeMapped(QString fileName, QVector<double> &x, QVector<double> &y, QVector<double> &t,
+                                bool doMercator, bool doNormalize)
+{
+    // Check if file name is null or empty.
+    Helper::checkNotNullNorEmpty("fileName", fileName);
+    try
+    {
+        MappedFile file(fileName.trimmed());
+        int capacity = countLines(file.begin(), file.end());
+        QVector<double> longitude(capacity), latitude(capacity);
+        x.clear();
+        y.clear();
+        t.resize(capacity);
+        double *lon = longitude.data(), *lat = latitude.data(), *ts = t.data();
+        int count = 0, numLine = 0;
+        static const double secsPerDay = 24*3600;
+        const char *begins[7], *ends[7];
+        const char *p = file.begin(), *e = file.end(), *lineBegin, *lineEnd;
+        while (p < e)
+        {
+            nextLine(p, e, lineBegin, lineEnd);
+            ++numLine;
+            if (numLine<=6)
+                continue;
+            if (lineBegin == lineEnd)
+                continue;
+
+            // In case where the line is malformed.
+            if (splitLine(lineBegin, lineEnd, ',', begins, ends, 7) != 7)
+            {
+                DotsException("Malformed line found.").raise();
+            }
+
+            // Store the parsed data without cleaning it.
+            double timestamp = decodeDouble(begins[4], ends[4])*secsPerDay;
+            if (count > 0 && timestamp-ts[count-1] < 1e-15) // Duplicated time point.
+                continue;
+            lat[count] = decodeDouble(begins[0], ends[0]);
+            lon[count] = decodeDouble(begins[1], ends[1]);
+            ts[count] = timestamp;
+            ++count;
+        }
+        longitude.resize(count);
+        latitude.resize(count);
+        t.resize(count);
+        finishParsing(longitude, latitude, x, y, t, doMercator, doNormalize);
+    }
+    catch (DotsException &e)
+    {
+        e.raise();
+    }
+    catch (QException &)
+    {
+        DotsException("Error occured when parsing trajectory file.").raise();
+    }
+}
+
 // Problem with points whose latitude nears pi/2 was fixed.
 double Helper::mercatorProject(QVector<double> &longitude, QVector<double> &latitude, QVector<double> &x,
                                      QVector<double> &y, double sf)
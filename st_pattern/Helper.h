@@ -89,6 +89,29 @@ public:
     static void parseGeoLife(QString fileName, QVector<double> &x, QVector<double> &y, QVector<double> &t,
                              bool doMercator = true, bool doNormalize = true);
 
+    /**
+     * @brief parseMOPSIMapped parses a MOPSI data file just like parseMOPSI, but it scans the memory mapped file in
+     * place and decodes the numbers and date-times without any temporary object. The output values are identical to
+     * the ones of parseMOPSI.
+     * @param fileName is the file name of MOPSI format.
+     * @param x is the x values of trajectory points.
+     * @param y is the y values of trajectory points.
+     * @param t is the timestamps of trajectory points.
+     */
+    static void parseMOPSIMapped(QString fileName, QVector<double> &x, QVector<double> &y, QVector<double> &t,
+                                 bool doMercator = true, bool doNormalize = true);
+
+    /**
+     * @brief parseGeoLifeMapped parses a GeoLife data file just like parseGeoLife, but it scans the memory mapped
+     * file in place. The output values are identical to the ones of parseGeoLife.
+     * @param fileName is the file name of GeoLife format.
+     * @param x is the x values of trajectory points.
+     * @param y is the y values of trajectory points.
+     * @param t is the timestamps of trajectory points.
+     */
+    static void parseGeoLifeMapped(QString fileName, QVector<double> &x, QVector<double> &y, QVector<double> &t,
+                                   bool doMercator = true, bool doNormalize = true);
+
     /**
      * @brief mercatorProject does mercator projection on the longitude/latitude pairs.
      * @param longitude is the longitude of positions.
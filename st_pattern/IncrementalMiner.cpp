@@ -0,0 +1,261 @@
+/* Copyright © 2015 DynamicFatty. All Rights Reserved. */
+
+#include "IncrementalMiner.h"
+#include "TincIndex.h"
+#include "SpatialTemporalException.h"
+#include <QFile>
+#include <QDataStream>
+#include <QScopedPointer>
+#include <algorithm>
+
+const quint32 IncrementalMiner::MAGIC = 0x53545053;
+const quint32 IncrementalMiner::VERSION = 1;
+
+namespace {
+
+// The pseudo-projections of the old transactions on a pattern, which are made from the ones of its parent
+// pattern the first time they are needed.
+class OldProjections
+{
+public:
+    OldProjections(const OldProjections *parent, unsigned int item)
+        : parent(parent), item(item), ready(false), support(0) {}
+
+    const QVector<PseudoProjection> &get(const TincIndex &index, const QHash<unsigned int, unsigned int> &t2otMap) const
+    {
+        if (!ready) {
+            if (parent) {
+                support = index.project(item, parent->get(index, t2otMap), t2otMap, projs);
+            } else {
+                projs.resize(index.count());
+                for (int i=0; i<projs.count(); ++i) {
+                    projs[i].seqId = i;
+                    projs[i].offset = 0;
+                }
+            }
+            ready = true;
+        }
+        return projs;
+    }
+
+    // Number of distinct original trajectories among the projections.
+    int getSupport(const TincIndex &index, const QHash<unsigned int, unsigned int> &t2otMap) const
+    {
+        get(index, t2otMap);
+        return support;
+    }
+
+protected:
+    const OldProjections *parent;
+    unsigned int item;
+    mutable bool ready;
+    mutable int support;
+    mutable QVector<PseudoProjection> projs;
+};
+
+}
+
+/**
+ * @brief The IncrementalMiner::Update class walks the patterns frequent in the old and the new transactions
+ * together, the same way PrefixSpan does, and builds the new pattern tree.
+ */
+class IncrementalMiner::Update
+{
+public:
+    Update(const IncrementalMiner &miner, const QVector<QVector<unsigned int> > &newTinc,
+           const QHash<unsigned int, unsigned int> &newT2otMap)
+        : miner(miner), newIndex(newTinc), newT2otMap(newT2otMap)
+    {
+    }
+
+    void run()
+    {
+        PatternNode root = {0, 0, -1, -1};
+        nodes << root;
+
+        QVector<PseudoProjection> newProjs(newIndex.count());
+        for (int i=0; i<newProjs.count(); ++i) {
+            newProjs[i].seqId = i;
+            newProjs[i].offset = 0;
+        }
+        // Sorted, since the order of hash keys differs from run to run.
+        QVector<unsigned int> toCheck = miner.scMap.keys().toVector();
+        std::sort(toCheck.begin(), toCheck.end());
+        extend(0, 0, toCheck, newProjs, OldProjections(0, 0));
+    }
+
+public:
+    QVector<PatternNode> nodes;
+
+protected:
+    const IncrementalMiner &miner;
+    QScopedPointer<TincIndex> oldIndex;     // Built when the old transactions are first projected.
+    TincIndex newIndex;
+    const QHash<unsigned int, unsigned int> &newT2otMap;
+
+    // An append that only raises the supports of the old patterns never indexes the old transactions.
+    const TincIndex &getOldIndex()
+    {
+        if (oldIndex.isNull())
+            oldIndex.reset(new TincIndex(miner.tinc));
+        return *oldIndex;
+    }
+
+    // Extend the pattern of node, which is oldNode in the old pattern tree or -1 if it was not frequent.
+    void extend(int oldNode, int node, const QVector<unsigned int> &toCheck,
+                const QVector<PseudoProjection> &newProjs, const OldProjections &oldProjs)
+    {
+        const QVector<PatternNode> &oldNodes = miner.nodes;
+        int oldChild = oldNode >= 0 ? oldNodes.at(oldNode).firstChild : -1;
+        int lastChild = -1;
+        QVector<PseudoProjection> childNewProjs;
+        foreach (unsigned int c, toCheck) {
+            // The old children were mined in the same order, so that they are matched in one pass.
+            int matched = -1;
+            if (oldChild >= 0 && oldNodes.at(oldChild).item == c) {
+                matched = oldChild;
+                oldChild = oldNodes.at(oldChild).nextSibling;
+            }
+            int support = newIndex.project(c, newProjs, newT2otMap, childNewProjs);
+            OldProjections childOldProjs(&oldProjs, c);
+            if (matched >= 0) {
+                support += oldNodes.at(matched).support;
+            } else if (support > 0) {
+                // It was not frequent in the old transactions, but may become frequent now.
+                support += childOldProjs.getSupport(getOldIndex(), miner.t2otMap);
+            } else {
+                continue;
+            }
+            if (support < miner.minSup)
+                continue;
+
+            PatternNode child = {c, support, -1, -1};
+            int childId = nodes.count();
+            nodes << child;
+            if (lastChild < 0)
+                nodes[node].firstChild = childId;
+            else
+                nodes[lastChild].nextSibling = childId;
+            lastChild = childId;
+            extend(matched, childId, miner.scMap.value(c), childNewProjs, childOldProjs);
+        }
+    }
+};
+
+IncrementalMiner::IncrementalMiner(const QHash<unsigned int, QVector<unsigned int> > &scMap, double radius,
+                                   int numClusters, int minSup)
+    : scMap(scMap), radius(radius), numClusters(numClusters), minSup(minSup), nextOtId(0)
+{
+    if (minSup < 1)
+        SpatialTemporalException("The min support of incremental mining must be positive.").raise();
+    PatternNode root = {0, 0, -1, -1};
+    nodes << root;
+}
+
+void IncrementalMiner::load(const QString &stateFileName)
+{
+    QFile stateFile(stateFileName);
+    if (!stateFile.open(QIODevice::ReadOnly)) {
+        SpatialTemporalException(QString("Open mining state file %1 error.").arg(stateFileName)).raise();
+    }
+    QDataStream in(&stateFile);
+    quint32 magic, version;
+    double stateRadius;
+    int stateNumClusters, stateMinSup;
+    in >> magic >> version >> stateRadius >> stateNumClusters >> stateMinSup;
+    if (magic != MAGIC || version != VERSION)
+        SpatialTemporalException(QString("%1 is not a mining state file of this version.").arg(stateFileName)).raise();
+    if (stateRadius != radius || stateNumClusters != numClusters || stateMinSup != minSup)
+        SpatialTemporalException(QString("The mining state file %1 was made with radius %2, %3 clusters and min "
+                                         "support %4.").arg(stateFileName).arg(stateRadius).
+                                 arg(stateNumClusters).arg(stateMinSup)).raise();
+
+    int numNodes;
+    in >> tinc >> t2otMap >> numNodes;
+    nodes.resize(qMax(numNodes, 0));
+    for (int i=0; i<nodes.count(); ++i)
+        in >> nodes[i].item >> nodes[i].support >> nodes[i].firstChild >> nodes[i].nextSibling;
+    if (in.status() != QDataStream::Ok || nodes.isEmpty())
+        SpatialTemporalException(QString("Malformed mining state file %1.").arg(stateFileName)).raise();
+    stateFile.close();
+
+    nextOtId = 0;
+    for (QHash<unsigned int, unsigned int>::const_iterator it = t2otMap.constBegin(); it != t2otMap.constEnd(); ++it)
+        nextOtId = qMax(nextOtId, it.value()+1);
+}
+
+void IncrementalMiner::save(const QString &stateFileName) const
+{
+    QFile stateFile(stateFileName);
+    if (!stateFile.open(QIODevice::WriteOnly)) {
+        SpatialTemporalException(QString("Open mining state file %1 error.").arg(stateFileName)).raise();
+    }
+    QDataStream out(&stateFile);
+    out << MAGIC << VERSION << radius << numClusters << minSup;
+    out << tinc << t2otMap << nodes.count();
+    for (int i=0; i<nodes.count(); ++i)
+        out << nodes[i].item << nodes[i].support << nodes[i].firstChild << nodes[i].nextSibling;
+    stateFile.close();
+}
+
+void IncrementalMiner::append(const QVector<QVector<unsigned int> > &newTinc,
+                              const QHash<unsigned int, unsigned int> &newT2otMap)
+{
+    // Number the new trajectories after the old ones.
+    QHash<unsigned int, unsigned int> shiftedT2otMap;
+    unsigned int newNextOtId = nextOtId;
+    for (QHash<unsigned int, unsigned int>::const_iterator it = newT2otMap.constBegin();
+         it != newT2otMap.constEnd(); ++it) {
+        shiftedT2otMap.insert(it.key(), it.value() + nextOtId);
+        newNextOtId = qMax(newNextOtId, it.value() + nextOtId + 1);
+    }
+
+    Update update(*this, newTinc, shiftedT2otMap);
+    update.run();
+    nodes = update.nodes;
+
+    unsigned int offset = tinc.count();
+    tinc << newTinc;
+    for (QHash<unsigned int, unsigned int>::const_iterator it = shiftedT2otMap.constBegin();
+         it != shiftedT2otMap.constEnd(); ++it) {
+        t2otMap.insert(it.key() + offset, it.value());
+    }
+    nextOtId = newNextOtId;
+}
+
+void IncrementalMiner::collectMaximalPatterns(QVector<QVector<unsigned int> > &allPatterns) const
+{
+    // Walk the tree in pre-order, where the leaves are in the mining order.
+    QVector<unsigned int> pattern;
+    QVector<int> path;
+    int node = nodes.at(0).firstChild;
+    while (node >= 0) {
+        pattern << nodes.at(node).item;
+        path << node;
+        if (nodes.at(node).firstChild >= 0) {
+            node = nodes.at(node).firstChild;
+            continue;
+        }
+        allPatterns << pattern;
+        // Go up to the first ancestor having a next sibling.
+        while (!path.isEmpty() && nodes.at(path.last()).nextSibling < 0) {
+            path.removeLast();
+            pattern.removeLast();
+        }
+        if (path.isEmpty())
+            break;
+        node = nodes.at(path.last()).nextSibling;
+        path.removeLast();
+        pattern.removeLast();
+    }
+}
+
+int IncrementalMiner::transactionCount() const
+{
+    return tinc.count();
+}
+
+int IncrementalMiner::patternCount() const
+{
+    return nodes.count()-1;
+}
@@ -0,0 +1,68 @@
+/* Copyright © 2015 DynamicFatty. All Rights Reserved. */
+
+#ifndef INCREMENTALMINER_H
+#define INCREMENTALMINER_H
+
+#include <QVector>
+#include <QHash>
+#include <QString>
+
+// Keeps the frequent patterns mined by PrefixSpan together with their supports and the transactions in
+// clusters (tinc) mined so far, so that the transactions of newly appended trajectories are mined without
+// a full re-mine.
+//
+// The appended trajectories are new ones, so that the support of a pattern is the sum of its supports in
+// the old and the new transactions. Every pattern is counted on the new transactions only, except for the
+// ones becoming frequent, which were infrequent before but occur in the new transactions. Only those are
+// counted on the old transactions as well, and the projections of the old transactions are made for their
+// prefixes on demand.
+//
+// The state file holds the mining parameters, the tinc and its t2ot, and the pattern tree. It is rewritten as a
+// whole by save(), since load() reads the whole tinc anyway.
+class IncrementalMiner
+{
+public:
+    IncrementalMiner(const QHash<unsigned int, QVector<unsigned int> > &scMap, double radius,
+                     int numClusters, int minSup);
+
+    // Load the state mined with the same parameters.
+    void load(const QString &stateFileName);
+    void save(const QString &stateFileName) const;
+
+    // Append the transactions of new trajectories, whose t2ot is numbered on its own, and update the patterns.
+    void append(const QVector<QVector<unsigned int> > &newTinc, const QHash<unsigned int, unsigned int> &newT2otMap);
+
+    // The maximal patterns, in the order PrefixSpan mines them in the maximal mode.
+    void collectMaximalPatterns(QVector<QVector<unsigned int> > &allPatterns) const;
+
+    int transactionCount() const;
+    int patternCount() const;
+
+protected:
+    class Update;
+
+    static const quint32 MAGIC;
+    static const quint32 VERSION;
+
+    // A frequent pattern, which is its parent pattern followed by item. The children are kept in the mining
+    // order, and node 0 is the empty pattern.
+    struct PatternNode
+    {
+        unsigned int item;
+        int support;
+        int firstChild;
+        int nextSibling;
+    };
+
+    const QHash<unsigned int, QVector<unsigned int> > &scMap;
+    double radius;
+    int numClusters;
+    int minSup;
+
+    QVector<QVector<unsigned int> > tinc;
+    QHash<unsigned int, unsigned int> t2otMap;
+    unsigned int nextOtId;
+    QVector<PatternNode> nodes;
+};
+
+#endif // INCREMENTALMINER_H
@@ -0,0 +1,78 @@
+/* Copyright © 2015 DynamicFatty. All Rights Reserved. */
+
+#include "TincIndex.h"
+#include "SpatialTemporalException.h"
+#include <algorithm>
+
+TincIndex::TincIndex(const QVector<QVector<unsigned int> > &tinc)
+{
+    int total = 0;
+    offsets.reserve(tinc.count()+1);
+    for (int i=0; i<tinc.count(); ++i) {
+        offsets << total;
+        total += tinc.at(i).count();
+    }
+    offsets << total;
+
+    occurrences.resize(total);
+    Occurrence *occ = occurrences.data();
+    for (int i=0; i<tinc.count(); ++i) {
+        const QVector<unsigned int> &seq = tinc.at(i);
+        Occurrence *first = occ + offsets.at(i);
+        for (int j=0; j<seq.count(); ++j) {
+            first[j].item = seq.at(j);
+            first[j].pos = j;
+        }
+        std::sort(first, first+seq.count());
+    }
+}
+
+int TincIndex::count() const
+{
+    return offsets.count()-1;
+}
+
+int TincIndex::length(int seqId) const
+{
+    return offsets.at(seqId+1)-offsets.at(seqId);
+}
+
+int TincIndex::indexOf(int seqId, unsigned int item, int from) const
+{
+    const Occurrence *first = occurrences.constData() + offsets.at(seqId);
+    const Occurrence *last = occurrences.constData() + offsets.at(seqId+1);
+    Occurrence key;
+    key.item = item;
+    key.pos = from;
+    const Occurrence *it = std::lower_bound(first, last, key);
+    return (it != last && it->item == item) ? it->pos : -1;
+}
+
+int TincIndex::project(unsigned int item, const QVector<PseudoProjection> &projs,
+                       const QHash<unsigned int, unsigned int> &t2otMap, QVector<PseudoProjection> &newProjs) const
+{
+    QSet<unsigned int> uniqueIds;
+    newProjs.resize(0);
+    projectRun(item, projs.constData(), projs.count(), t2otMap, newProjs, uniqueIds);
+    return uniqueIds.count();
+}
+
+void TincIndex::projectRun(unsigned int item, const PseudoProjection *projs, int count,
+                           const QHash<unsigned int, unsigned int> &t2otMap, QVector<PseudoProjection> &newProjs,
+                           QSet<unsigned int> &owners) const
+{
+    for (int i=0; i<count; ++i) {
+        int idx = indexOf(projs[i].seqId, item, projs[i].offset);
+        if (idx >= 0 && idx < length(projs[i].seqId)-1) {
+            PseudoProjection p;
+            p.seqId = projs[i].seqId;
+            p.offset = idx+1;
+            newProjs << p;
+            QHash<unsigned int, unsigned int>::const_iterator it = t2otMap.constFind(p.seqId);
+            if (it == t2otMap.constEnd()) {
+                SpatialTemporalException("Found t2otMap does not contain one id.").raise();
+            }
+            owners.insert(it.value());
+        }
+    }
+}
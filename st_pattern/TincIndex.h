@@ -0,0 +1,60 @@
+/* Copyright © 2015 DynamicFatty. All Rights Reserved. */
+
+#ifndef TINCINDEX_H
+#define TINCINDEX_H
+
+#include <QVector>
+#include <QHash>
+#include <QSet>
+
+// A pseudo-projected transaction of PrefixSpan: the suffix of transaction seqId starting at offset.
+struct PseudoProjection
+{
+    int seqId;
+    int offset;
+};
+
+// An inverted index of the transactions in clusters (tinc) mined by PrefixSpan. The positions of each
+// transaction are grouped by item and sorted, so that finding the next occurrence of an item after an
+// offset is one binary search instead of a scan of the transaction.
+//
+// All the transactions share two flat arrays:
+//   int offsets[count+1]               The first occurrence of each transaction, followed by the total.
+//   Occurrence occurrences[total]      The (item, position) pairs of each transaction, sorted.
+class TincIndex
+{
+public:
+    explicit TincIndex(const QVector<QVector<unsigned int> > &tinc);
+
+    // Number of transactions.
+    int count() const;
+    // Number of items in a transaction.
+    int length(int seqId) const;
+    // Position of the first occurrence of item in transaction seqId at or after from, or -1 if there is none.
+    int indexOf(int seqId, unsigned int item, int from) const;
+    // Projects the pseudo-projections on item the way PrefixSpan does, and returns the number of distinct
+    // original trajectories among the new projections.
+    int project(unsigned int item, const QVector<PseudoProjection> &projs,
+                const QHash<unsigned int, unsigned int> &t2otMap, QVector<PseudoProjection> &newProjs) const;
+    // Projects a run of count pseudo-projections on item, appending the new projections to newProjs and their
+    // original trajectories to owners.
+    void projectRun(unsigned int item, const PseudoProjection *projs, int count,
+                    const QHash<unsigned int, unsigned int> &t2otMap, QVector<PseudoProjection> &newProjs,
+                    QSet<unsigned int> &owners) const;
+
+protected:
+    struct Occurrence
+    {
+        unsigned int item;
+        int pos;
+
+        bool operator<(const Occurrence &other) const {
+            return item < other.item || (item == other.item && pos < other.pos);
+        }
+    };
+
+    QVector<int> offsets;
+    QVector<Occurrence> occurrences;
+};
+
+#endif // TINCINDEX_H
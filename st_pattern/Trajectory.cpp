@@ -11,7 +11,10 @@
 #include "SpatialTemporalException.h"
 #include "mainwindow.h"
 #include "DotsSimplifier.h"
+#include "DotsCascade.h"
 #include <QSet>
+#include <cstring>
+#include "TrajectoryCache.h"
 
 const double Trajectory::MERCATOR_LATITUDE_LB = 2.5*2.0-M_PI/2;
 const double Trajectory::MERCATOR_LATITUDE_UB = 87.5*2.0-M_PI/2;
@@ -30,7 +33,9 @@ Trajectory::Trajectory(const Trajectory &traj)
 {
     this->referencePointInLL = traj.referencePointInLL;
     this->referencePointInXY = traj.referencePointInXY;
-    this->points = traj.points;
+    this->xs = traj.xs;
+    this->ys = traj.ys;
+    this->ts = traj.ts;
     this->coordinateType = traj.coordinateType;
     this->normalized = traj.normalized;
 }
@@ -42,10 +47,10 @@ Trajectory::Trajectory(QString filePath)
     QVector<double> longitude, latitude, timestamp;
     if (filePath.endsWith(".txt")) {
         // MOPSI dataset.
-        Helper::parseMOPSI(filePath, longitude, latitude, timestamp, false, false);
+        Helper::parseMOPSIMapped(filePath, longitude, latitude, timestamp, false, false);
     } else if (filePath.endsWith(".plt")) {
         // GeoLife dataset.
-        Helper::parseGeoLife(filePath, longitude, latitude, timestamp, false, false);
+        Helper::parseGeoLifeMapped(filePath, longitude, latitude, timestamp, false, false);
     } else {
         SpatialTemporalException(QString("Unrecognized file type: [%1]").
                                  arg(filePath)).raise();
@@ -56,11 +61,29 @@ Trajectory::Trajectory(QString filePath)
     this->setPoints(longitude, latitude, timestamp);
 }
 
+Trajectory::Trajectory(const TrajectoryCache &cache, int index)
+{
+    // The cached points have already been projected by the reference point of the cache.
+    this->coordinateType = Trajectory::LongitudeLatitude;
+    this->normalized = false;
+    this->setReferencePoint(cache.getReferencePoint());
+    int pointCount = cache.pointCount(index);
+    this->xs.resize(pointCount);
+    this->ys.resize(pointCount);
+    this->ts.resize(pointCount);
+    memcpy(this->xs.data(), cache.x(index), pointCount*sizeof(double));
+    memcpy(this->ys.data(), cache.y(index), pointCount*sizeof(double));
+    memcpy(this->ts.data(), cache.t(index), pointCount*sizeof(double));
+    this->coordinateType = Trajectory::XandY;
+}
+
 Trajectory &Trajectory::operator =(const Trajectory &traj)
 {
     this->referencePointInLL = traj.referencePointInLL;
     this->referencePointInXY = traj.referencePointInXY;
-    this->points = traj.points;
+    this->xs = traj.xs;
+    this->ys = traj.ys;
+    this->ts = traj.ts;
     this->coordinateType = traj.coordinateType;
     this->normalized = traj.normalized;
     return *this;
@@ -78,8 +101,9 @@ void Trajectory::setPoints(const QVector<double> &longitude, const QVector<doubl
     Helper::checkIntEqual(longitude.count(), latitude.count());
     Helper::checkIntEqual(latitude.count(), timestamp.count());
 
-    for (int i=0; i<longitude.count(); ++i)
-        this->points.append(SpatialTemporalPoint(longitude.at(i), latitude.at(i), timestamp.at(i)));
+    this->xs += longitude;
+    this->ys += latitude;
+    this->ts += timestamp;
     this->coordinateType = Trajectory::LongitudeLatitude;
 }
 
@@ -88,27 +112,28 @@ void Trajectory::validate(bool autoFix)
     // Checking time is monotonous.
     double lastTime = -Helper::INF;
     int numChecked = 0;
-    foreach (SpatialTemporalPoint p, points) {
-        if (p.t < lastTime)
+    foreach (double t, ts) {
+        if (t < lastTime)
             SpatialTemporalException(QString("Trajectory::validate() failed while checking index %1. "\
                                              "Details: Expecting %2 < %3").
-                                     arg(numChecked).arg(lastTime).arg(p.t)).raise();
-        lastTime = p.t;
+                                     arg(numChecked).arg(lastTime).arg(t)).raise();
+        lastTime = t;
         ++numChecked;
     }
     // Checking maximum speed.
-    double speed;
-    SpatialTemporalPoint p, lastP = points.at(0);
+    double speed, dx, dy, dt;
+    int last = 0;
     QSet<int> exceed;
     for (int i=1; i<count(); ++i) {
-        p = points.at(i);
-        p -= lastP;
-        speed = qSqrt(p.x*p.x+p.y*p.y)/(p.t);
+        dx = xs.at(i) - xs.at(last);
+        dy = ys.at(i) - ys.at(last);
+        dt = ts.at(i) - ts.at(last);
+        speed = qSqrt(dx*dx+dy*dy)/(dt);
         if (speed > MAX_SPEED) {
             exceed<<i;
             //qDebug()<<"Exceed speed: "<<(speed*3.6)<<" km/h.";
         } else {
-            lastP = points.at(i);
+            last = i;
         }
     }
     if (exceed.count() > count()*MAX_EXCEED_TO_FIX || !autoFix) {
@@ -118,31 +143,35 @@ void Trajectory::validate(bool autoFix)
         // Fix the trajectory.
         qDebug()<<"Auto-fix the trajectory since malformed rate is "
                <<((double)exceed.count()/((double)count())*100.0)<<"%";
-        QVector<SpatialTemporalPoint> npoints;
+        QVector<int> kept;
         for (int i=0; i<count(); ++i) {
             if (!exceed.contains(i))
-                npoints<<points.at(i);
+                kept<<i;
         }
-        points = npoints;
+        *this = slice(kept);
     }
     // All checking done.
 }
 
 int Trajectory::count() const
 {
-    return points.count();
+    return ts.count();
 }
 
 QVector<SpatialTemporalPoint> Trajectory::getPoints() const
 {
+    QVector<SpatialTemporalPoint> points(count());
+    for (int i=0; i<count(); ++i)
+        points[i] = SpatialTemporalPoint(xs.at(i), ys.at(i), ts.at(i));
     return points;
 }
 
 QVector<SpatialTemporalSegment> Trajectory::getSegments() const
 {
     QVector<SpatialTemporalSegment> segments;
+    segments.reserve(qMax(count()-1, 0));
     for (int i=0; i<count()-1; ++i) {
-        segments.append(SpatialTemporalSegment(points.at(i), points.at(i+1)));
+        segments.append(SpatialTemporalSegment(xs.at(i), ys.at(i), ts.at(i), xs.at(i+1), ys.at(i+1), ts.at(i+1)));
     }
     return segments;
 }
@@ -162,7 +191,7 @@ double Trajectory::getStartTime() const
     if (count() == 0)
         return 0;
     else
-        return points.at(0).t;
+        return ts.at(0);
 }
 
 SpatialTemporalPoint Trajectory::estimateReferencePoint() const
@@ -171,9 +200,10 @@ SpatialTemporalPoint Trajectory::estimateReferencePoint() const
         SpatialTemporalException("The trajectory contains no points.").raise();
 
     double xSum = 0, ySum = 0;
-    foreach (SpatialTemporalPoint p, points) {
-        xSum += p.x;
-        ySum += p.y;
+    const double *x = xs.constData(), *y = ys.constData();
+    for (int i=0; i<count(); ++i) {
+        xSum += x[i];
+        ySum += y[i];
     }
     return SpatialTemporalPoint(xSum/count(), ySum/count(), 0);
 }
@@ -182,15 +212,16 @@ void Trajectory::doMercatorProject()
 {
     double sf = getMercatorScaleFactor();
     double finalFactor = EARCH_RADIUS/sf;
-    SpatialTemporalPoint p;
+    int pointCount = count();
+    double *x = this->xs.data(), *y = this->ys.data();
     double ry;
-    for (int i=0; i<this->points.count(); ++i)
+    for (int i=0; i<pointCount; ++i)
+        x[i] = qDegreesToRadians(x[i])*finalFactor;
+    for (int i=0; i<pointCount; ++i)
     {
-        p = this->points.at(i);
-        this->points[i].x = qDegreesToRadians(p.x)*finalFactor;
-        ry = qDegreesToRadians(Helper::limitVal(p.y, MERCATOR_LATITUDE_LB, MERCATOR_LATITUDE_UB));
+        ry = qDegreesToRadians(Helper::limitVal(y[i], MERCATOR_LATITUDE_LB, MERCATOR_LATITUDE_UB));
         ry = qLn(qFabs(qTan(ry)+1.0/qCos(ry)));
-        this->points[i].y = ry*finalFactor;
+        y[i] = ry*finalFactor;
     }
     this->coordinateType = Trajectory::XandY;
 }
@@ -217,9 +248,13 @@ void Trajectory::doNormalize()
 
     SpatialTemporalPoint reference = this->coordinateType == Trajectory::LongitudeLatitude ?
                 this->referencePointInLL : this->referencePointInXY;
-    for (int i=0; i<this->points.count(); ++i)
+    int pointCount = count();
+    double *x = this->xs.data(), *y = this->ys.data(), *t = this->ts.data();
+    for (int i=0; i<pointCount; ++i)
     {
-        this->points[i] -= reference;
+        x[i] -= reference.x;
+        y[i] -= reference.y;
+        t[i] -= reference.t;
     }
     this->normalized = true;
 }
@@ -227,13 +262,11 @@ void Trajectory::doNormalize()
 Trajectory Trajectory::sample(int rate) const
 {
     Helper::checkPositive("sample rate", rate);
-    QVector<SpatialTemporalPoint> _pts;
+    QVector<int> indices;
     for (int i=0; i<count(); i+=rate) {
-        _pts.append(points.at(i));
+        indices.append(i);
     }
-    Trajectory sampled(*this);
-    sampled.points = _pts;
-    return sampled;
+    return slice(indices);
 }
 
 Trajectory Trajectory::simplify(double threshold, bool useCascade) const
@@ -244,30 +277,26 @@ Trajectory Trajectory::simplify(double threshold, bool useCascade) const
     if (count() <= 2)
         SpatialTemporalException("The trajectory contains number of points less than 2.").raise();
 
-    // Preparing data.
+    // Points are shifted to the first one and scaled while being fed.
     double dotsScale = 0.001; // This scale is used to prevent numerical errors.
-    QVector<double> _x, _y, _t;
-    double refX = points.at(0).x;
-    double refY = points.at(0).y;
-    double refT = points.at(0).t;
-    foreach (SpatialTemporalPoint p, points) {
-        _x.append((p.x - refX)*dotsScale);
-        _y.append((p.y - refY)*dotsScale);
-        _t.append((p.t - refT)*dotsScale);
-    }
+    double refX = xs.at(0);
+    double refY = ys.at(0);
+    double refT = ts.at(0);
 
     // Simplify.
     QVector<int> indices;
     if (useCascade) {
-        DotsSimplifier::batchDotsCascadeByIndex(_x, _y, _t, indices, threshold*dotsScale*dotsScale);
+        DotsSimplifier::batchDotsCascadeByIndex(xs.constData(), ys.constData(), ts.constData(), count(), indices,
+                                                threshold*dotsScale*dotsScale, refX, refY, refT, dotsScale);
     } else {
-        DotsSimplifier::batchDotsByIndex(_x, _y, _t, indices, threshold*dotsScale*dotsScale);
+        DotsSimplifier::batchDotsByIndex(xs.constData(), ys.constData(), ts.constData(), count(), indices,
+                                         threshold*dotsScale*dotsScale, refX, refY, refT, dotsScale);
     }
 
     return slice(indices);
 }
 
-QVector<Trajectory> Trajectory::simplifyWithSEST(double dotsTh, double step, bool useTemporal) const
+QVector<Trajectory> Trajectory::simplifyWithSEST(double dotsTh, double step, bool useTemporal, bool pipelined) const
 {
     // Checking.
     if (!normalized)
@@ -275,17 +304,12 @@ QVector<Trajectory> Trajectory::simplifyWithSEST(double dotsTh, double step, boo
     if (count() <= 2)
         SpatialTemporalException("The trajectory contains number of points less than 2.").raise();
 
-    // Preparing data.
+    // Points are shifted to the first one and scaled while being fed.
     double dotsScale = 0.001; // This scale is used to prevent numerical errors.
-    QVector<double> _x, _y, _t;
-    double refX = points.at(0).x;
-    double refY = points.at(0).y;
-    double refT = points.at(0).t;
-    foreach (SpatialTemporalPoint p, points) {
-        _x.append((p.x - refX)*dotsScale);
-        _y.append((p.y - refY)*dotsScale);
-        _t.append((p.t - refT)*dotsScale);
-    }
+    const double *_x = xs.constData(), *_y = ys.constData(), *_t = ts.constData();
+    double refX = _x[0];
+    double refY = _y[0];
+    double refT = _t[0];
 
     // Simplify by cascade structure.
     qDebug()<<"Use temporal info: "<<useTemporal;
@@ -296,90 +320,48 @@ QVector<Trajectory> Trajectory::simplifyWithSEST(double dotsTh, double step, boo
     int cascadeCount = qFloor(qLn(DEFAULT_END_THRESHOLD/startThreshold)/qLn(step))+1;
     double k = qPow(DEFAULT_END_THRESHOLD/startThreshold, 1.0/(cascadeCount-1));
     double th = startThreshold;
-    QObject *root = new QObject();
-    QVector<DotsSimplifier *> cascade;
+    QVector<double> thresholds;
     for (int i=0; i<cascadeCount; ++i) {
-        DotsSimplifier *s = new DotsSimplifier(root, i==0 ? NULL : cascade[0]);
-        s->setParameters(th*dotsScale*dotsScale, k);
+        thresholds.append(th*dotsScale*dotsScale);
         th*=k;
-        cascade.append(s);
     }
-
-    // Run DOTS in cascade manner.
     int pointCount = this->count();
-    double px, py, pt;
-    DotsSimplifier *first = cascade[0];
-    for (int i=0; i<pointCount; ++i) {
-        px = _x.at(i);
-        py = _y.at(i);
-        pt = _t.at(i);
-        first->feedData(px, py, pt);
-        int index = -1;
-        if (first->readOutputIndex(index)) {
-            for (int j=1; j<cascadeCount; ++j) {
-                DotsSimplifier *s = cascade[j];
-                s->feedIndex(index);
-                if (!(s->readOutputIndex(index))) {
-                    break;
-                }
-            }
-        }
-    }
+    DotsCascade cascade(thresholds, k, pipelined ? pointCount : 0);
 
-    // Finish simplifiers from front to end.
-    for (int i=0; i<cascadeCount-1; ++i) {
-        DotsSimplifier *s = cascade[i];
-        DotsSimplifier *n = cascade[i+1];
-        s->finish();
-        int index = -1;
-        while (s->readOutputIndex(index))
-            n->feedIndex(index);
-    }
-    // Read output from the last simplifier.
-    DotsSimplifier *last = cascade.last();
-    last->finish();
-    int index = -1;
-    while (last->readOutputIndex(index)) ;
+    // Run DOTS in cascade manner.
+    for (int i=0; i<pointCount; ++i)
+        cascade.feedData((_x[i] - refX)*dotsScale, (_y[i] - refY)*dotsScale, (_t[i] - refT)*dotsScale);
+    cascade.finish();
 
     // Get the output.
     QVector<double> icrs;// Incremental compression rates.
-    foreach (DotsSimplifier *s, cascade) {
-        icrs.append((s->getInputCount())/1.0/(s->getOutputCount()));
+    for (int i=0; i<cascadeCount; ++i) {
+        icrs.append((cascade.getInputCount(i))/1.0/(cascade.getOutputCount(i)));
     }
     for (int i=0; i<icrs.count(); ++i)
     {
         if (i>0 && i<icrs.count()-1) {
             if (icrs[i] <= icrs[i-1] && icrs[i] <= icrs[i+1] && icrs[i-1]>1.0) {
-                DotsSimplifier *s = cascade[i];
-                QVector<int> indices;
-                for (int j=0; j<s->getOutputCount(); ++j)
-                    indices.append(s->getSimplifiedIndex(j));
-                subTrajs.append(this->slice(indices));
+                subTrajs.append(this->slice(cascade.getSimplifiedIndices(i)));
             }
         }
     }
-
-    // Destroy the total cascade.
-    delete root;
     return subTrajs;
 }
 
 Trajectory Trajectory::slice(const QVector<int> &indices) const
 {
     Trajectory traj(*this);
-    Helper::slice<SpatialTemporalPoint>(this->points, indices, traj.points);
+    Helper::slice<double>(this->xs, indices, traj.xs);
+    Helper::slice<double>(this->ys, indices, traj.ys);
+    Helper::slice<double>(this->ts, indices, traj.ts);
     return traj;
 }
 
 void Trajectory::visualize(const QString &plotOption, QString curveName) const
 {
     MainWindow *figure = new MainWindow();
-    QVector<double> _x, _y;
-    foreach (SpatialTemporalPoint p, points) {
-        _x.append(p.x);
-        _y.append(p.y);
-    }
-    figure->plot(_x, _y, plotOption, curveName);
+    figure->plot(xs, ys, plotOption, curveName);
     figure->show();
 }
 
@@ -13,6 +13,8 @@
 #include <QVector>
 #include <QString>
 
+class TrajectoryCache;
+
 class Trajectory : public QObject
 {
     Q_OBJECT
@@ -21,6 +23,7 @@ public:
     explicit Trajectory(QObject *parent = 0);
     Trajectory(const Trajectory &traj);
     Trajectory(QString filePath);
+    Trajectory(const TrajectoryCache &cache, int index);
     Trajectory & operator =(const Trajectory &traj);
 
     // Interfaces for feeding data.
@@ -45,7 +48,8 @@ public:
     void doNormalize();
     Trajectory sample(int rate) const;
     Trajectory simplify(double threshold, bool useCascade = false) const;
-    QVector<Trajectory> simplifyWithSEST(double dotsTh, double step, bool useTemporal = true) const;
+    QVector<Trajectory> simplifyWithSEST(double dotsTh, double step, bool useTemporal = true,
+                                         bool pipelined = false) const;
     Trajectory slice(const QVector<int> &indices) const;
 
     // The visualization.
@@ -74,7 +78,10 @@ protected:
 protected:
     SpatialTemporalPoint referencePointInLL;
     SpatialTemporalPoint referencePointInXY;
-    QVector<SpatialTemporalPoint> points;
+    // The points are stored column by column, so that the whole trajectory is processed in tight loops.
+    QVector<double> xs;
+    QVector<double> ys;
+    QVector<double> ts;
     CoordinateType coordinateType;
     bool normalized;
 };
@@ -0,0 +1,177 @@
+/* Copyright © 2015 DynamicFatty. All Rights Reserved. */
+
+#include "TrajectoryCache.h"
+#include "Trajectory.h"
+#include "SpatialTemporalException.h"
+#include "DotsException.h"
+#include <QVector>
+#include <QDebug>
+#include <cstring>
+#include <climits>
+
+const char TrajectoryCache::MAGIC[8] = {'S', 'T', 'P', 'T', 'R', 'C', '\0', '\0'};
+const quint32 TrajectoryCache::VERSION = 1;
+const quint32 TrajectoryCache::BYTE_ORDER_MARK = 0x01020304;
+
+TrajectoryCache::TrajectoryCache(const QString &cacheFile) : file(cacheFile)
+{
+    if (!file.open(QIODevice::ReadOnly))
+        SpatialTemporalException(QString("Open file %1 error.").arg(cacheFile)).raise();
+    qint64 size = file.size();
+    data = size >= (qint64)sizeof(Header) ? file.map(0, size) : NULL;
+    if (data == NULL)
+        SpatialTemporalException(QString("Map trajectory cache %1 error.").arg(cacheFile)).raise();
+
+    // Validate the header.
+    header = reinterpret_cast<const Header *>(data);
+    if (memcmp(header->magic, MAGIC, sizeof(MAGIC)) != 0)
+        SpatialTemporalException(QString("%1 is not a trajectory cache.").arg(cacheFile)).raise();
+    if (header->version != VERSION || header->byteOrder != BYTE_ORDER_MARK)
+        SpatialTemporalException(QString("Trajectory cache %1 was made by an incompatible version or machine.").
+                                 arg(cacheFile)).raise();
+    if (header->count < 0 || header->count > INT_MAX || header->totalPoints < 0 || header->totalPoints > size)
+        SpatialTemporalException(QString("Trajectory cache %1 is truncated.").arg(cacheFile)).raise();
+    qint64 columnsEnd = (qint64)sizeof(Header) + (header->count+1)*(qint64)sizeof(qint64) +
+            header->totalPoints*3*(qint64)sizeof(double);
+    if (columnsEnd > size)
+        SpatialTemporalException(QString("Trajectory cache %1 is truncated.").arg(cacheFile)).raise();
+
+    // Locate the columns.
+    offsets = reinterpret_cast<const qint64 *>(data + sizeof(Header));
+    xs = reinterpret_cast<const double *>(offsets + header->count+1);
+    ys = xs + header->totalPoints;
+    ts = ys + header->totalPoints;
+    for (qint64 i=0; i<header->count; ++i) {
+        if (offsets[i] > offsets[i+1] || offsets[i+1] - offsets[i] > INT_MAX)
+            SpatialTemporalException(QString("Trajectory cache %1 has malformed offsets.").arg(cacheFile)).raise();
+    }
+    if (offsets[0] != 0 || offsets[header->count] != header->totalPoints)
+        SpatialTemporalException(QString("Trajectory cache %1 has malformed offsets.").arg(cacheFile)).raise();
+
+    // Read the file names.
+    const uchar *p = data + columnsEnd, *end = data + size;
+    for (qint64 i=0; i<header->count; ++i) {
+        quint32 length;
+        if (end - p < (qint64)sizeof(length))
+            SpatialTemporalException(QString("Trajectory cache %1 is truncated.").arg(cacheFile)).raise();
+        memcpy(&length, p, sizeof(length));
+        p += sizeof(length);
+        if (end - p < (qint64)length)
+            SpatialTemporalException(QString("Trajectory cache %1 is truncated.").arg(cacheFile)).raise();
+        fileNames << QString::fromUtf8(reinterpret_cast<const char *>(p), length);
+        p += length;
+    }
+}
+
+TrajectoryCache::~TrajectoryCache()
+{
+    file.close();
+}
+
+int TrajectoryCache::build(const QStringList &files, const QString &cacheFile)
+{
+    if (files.isEmpty())
+        SpatialTemporalException("No trajectory file to cache.").raise();
+
+    // Estimate the reference point the same way as the segmentation phase does.
+    SpatialTemporalPoint reference = Trajectory(files.first()).estimateReferencePoint();
+
+    // Parse and project all the files.
+    QVector<qint64> offsets;
+    QVector<double> x, y, t;
+    QStringList names;
+    offsets << 0;
+    foreach (QString f, files) {
+        try {
+            Trajectory traj(f);
+            traj.setReferencePoint(reference);
+            traj.doMercatorProject();
+            foreach (SpatialTemporalPoint p, traj.getPoints()) {
+                x << p.x;
+                y << p.y;
+                t << p.t;
+            }
+            offsets << x.count();
+            names << f;
+        } catch (SpatialTemporalException &e) {
+            qDebug()<<"Error occurs while importing trajectory: "<<f<<"\nDetails: "<<e.getMessage();
+        } catch (DotsException &e) {
+            qDebug()<<"Error occurs while importing trajectory: "<<f<<"\nDetails: "<<e.getMessage();
+        }
+    }
+
+    // Store the columns.
+    QFile out(cacheFile);
+    if (!out.open(QIODevice::WriteOnly))
+        SpatialTemporalException(QString("Open file %1 error.").arg(cacheFile)).raise();
+    Header header;
+    memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.byteOrder = BYTE_ORDER_MARK;
+    header.count = names.count();
+    header.totalPoints = x.count();
+    header.referenceX = reference.x;
+    header.referenceY = reference.y;
+    bool ok = out.write(reinterpret_cast<const char *>(&header), sizeof(header)) == (qint64)sizeof(header);
+    ok = ok && out.write(reinterpret_cast<const char *>(offsets.constData()), offsets.count()*sizeof(qint64)) ==
+            (qint64)(offsets.count()*sizeof(qint64));
+    const QVector<double> *columns[] = {&x, &y, &t};
+    for (int i=0; i<3; ++i) {
+        qint64 bytes = columns[i]->count()*sizeof(double);
+        ok = ok && out.write(reinterpret_cast<const char *>(columns[i]->constData()), bytes) == bytes;
+    }
+    foreach (QString name, names) {
+        QByteArray utf8 = name.toUtf8();
+        quint32 length = utf8.size();
+        ok = ok && out.write(reinterpret_cast<const char *>(&length), sizeof(length)) == (qint64)sizeof(length);
+        ok = ok && out.write(utf8) == utf8.size();
+    }
+    out.close();
+    if (!ok)
+        SpatialTemporalException(QString("Write file %1 error.").arg(cacheFile)).raise();
+    return names.count();
+}
+
+int TrajectoryCache::count() const
+{
+    return (int)header->count;
+}
+
+SpatialTemporalPoint TrajectoryCache::getReferencePoint() const
+{
+    return SpatialTemporalPoint(header->referenceX, header->referenceY, 0);
+}
+
+QString TrajectoryCache::getFileName(int index) const
+{
+    return fileNames.at(index);
+}
+
+QStringList TrajectoryCache::getFileNames() const
+{
+    return fileNames;
+}
+
+int TrajectoryCache::pointCount(int index) const
+{
+    Q_ASSERT(index >= 0 && index < count());
+    return (int)(offsets[index+1] - offsets[index]);
+}
+
+const double *TrajectoryCache::x(int index) const
+{
+    Q_ASSERT(index >= 0 && index < count());
+    return xs + offsets[index];
+}
+
+const double *TrajectoryCache::y(int index) const
+{
+    Q_ASSERT(index >= 0 && index < count());
+    return ys + offsets[index];
+}
+
+const double *TrajectoryCache::t(int index) const
+{
+    Q_ASSERT(index >= 0 && index < count());
+    return ts + offsets[index];
+}
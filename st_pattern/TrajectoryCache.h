@@ -0,0 +1,71 @@
+/* Copyright © 2015 DynamicFatty. All Rights Reserved. */
+
+#ifndef TRAJECTORYCACHE_H
+#define TRAJECTORYCACHE_H
+
+#include <QFile>
+#include <QString>
+#include <QStringList>
+#include <QtGlobal>
+#include "SpatialTemporalPoint.h"
+
+// A columnar binary file holding a whole dataset. The points are stored already Mercator projected
+// with the reference point of the dataset, and the file is memory mapped when loaded, so that the
+// segmentation phase does not parse any text.
+//
+// Layout (native byte order, every section is 8-byte aligned):
+//   Header
+//   qint64 offsets[count+1]        The first point of each trajectory, followed by the total.
+//   double x[total], y[total], t[total]
+//   quint32 length + UTF-8 bytes   The source file name of each trajectory.
+class TrajectoryCache
+{
+public:
+    // Maps an existing cache file.
+    explicit TrajectoryCache(const QString &cacheFile);
+    ~TrajectoryCache();
+
+    // Parses and projects the files into a new cache file. Returns the number of trajectories stored.
+    static int build(const QStringList &files, const QString &cacheFile);
+
+    // Interfaces for retrieving the cached trajectories.
+    int count() const;
+    SpatialTemporalPoint getReferencePoint() const;
+    QString getFileName(int index) const;
+    QStringList getFileNames() const;
+    int pointCount(int index) const;
+    const double *x(int index) const;
+    const double *y(int index) const;
+    const double *t(int index) const;
+
+public:
+    static const quint32 VERSION;
+
+protected:
+    struct Header
+    {
+        char magic[8];
+        quint32 version;
+        quint32 byteOrder;      // BYTE_ORDER_MARK as written by the producing machine.
+        qint64 count;           // Number of trajectories.
+        qint64 totalPoints;     // Number of points of all the trajectories.
+        double referenceX;      // The longitude of the reference point.
+        double referenceY;      // The latitude of the reference point.
+    };
+    static const char MAGIC[8];
+    static const quint32 BYTE_ORDER_MARK;
+
+    QFile file;
+    const uchar *data;
+    const Header *header;
+    const qint64 *offsets;
+    const double *xs;
+    const double *ys;
+    const double *ts;
+    QStringList fileNames;
+
+private:
+    Q_DISABLE_COPY(TrajectoryCache)
+};
+
+#endif // TRAJECTORYCACHE_H
@@ -45,7 +45,7 @@ public:
         for (int i=from; i<string.count(); ++i) {
             e = string.at(i);
             node = new TrieNode(e);
-            parent->children.insert(node);
+            parent->children.append(node);
             parent = node;
         }
     }
@@ -80,7 +80,8 @@ protected:
 
 protected:
     T element;
-    QSet<TrieNode *> children;
+    // Kept in insertion order, so that the leaves are collected in the same order on every run.
+    QVector<TrieNode *> children;
 };
 
 #endif // TRIENODE
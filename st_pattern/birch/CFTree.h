@@ -24,14 +24,22 @@
 
 #include <vector>
 #include <list>
+#include <set>
+#include <algorithm>
+#include <new>
+#include <cstdlib>
 #include <fstream>
 #include <exception>
 #include <assert.h>
 #include <time.h>
 #include <boost/cstdint.hpp>
-#include <boost/shared_ptr.hpp>
 #include <boost/numeric/ublas/symmetric.hpp>
 #include <boost/numeric/ublas/vector.hpp>
+#if defined(__AVX__)
+	#include <immintrin.h>
+#elif defined(__SSE2__)
+	#include <emmintrin.h>
+#endif
 
 #define PAGE_SIZE			(4*1024) /* assuming 4K page */
 
@@ -45,14 +53,61 @@
 
 #define ARRAY_COUNT(a)		(sizeof(a)/sizeof(a[0]))
 
+/** distance functions between CFEntries, chosen by CFTree at compile time so that they are inlined. */
+struct CFDistD0 {};	/** euclidean distance of centroids */
+struct CFDistD1 {};	/** manhattan distance of centroids */
+struct CFDistD2 {};	/** pairwise intra-cluster distance */
+struct CFDistD3 {};	/** pairwise inter-cluster distance */
+
+/** vectors of doubles for the distance kernels: 4 lanes with AVX, 2 with SSE2, or 1 otherwise. */
+namespace cftree_simd
+{
+#if defined(__AVX__)
+	typedef __m256d vec;
+	enum { width = 4 };
+	inline vec load( const double* p )			{ return _mm256_loadu_pd(p); }
+	inline void store( double* p, vec v )		{ _mm256_storeu_pd(p, v); }
+	inline vec set1( double v )					{ return _mm256_set1_pd(v); }
+	inline vec add( vec a, vec b )				{ return _mm256_add_pd(a, b); }
+	inline vec sub( vec a, vec b )				{ return _mm256_sub_pd(a, b); }
+	inline vec mul( vec a, vec b )				{ return _mm256_mul_pd(a, b); }
+	inline vec div( vec a, vec b )				{ return _mm256_div_pd(a, b); }
+	inline vec abs( vec a )						{ return _mm256_andnot_pd(_mm256_set1_pd(-0.0), a); }
+#elif defined(__SSE2__)
+	typedef __m128d vec;
+	enum { width = 2 };
+	inline vec load( const double* p )			{ return _mm_loadu_pd(p); }
+	inline void store( double* p, vec v )		{ _mm_storeu_pd(p, v); }
+	inline vec set1( double v )					{ return _mm_set1_pd(v); }
+	inline vec add( vec a, vec b )				{ return _mm_add_pd(a, b); }
+	inline vec sub( vec a, vec b )				{ return _mm_sub_pd(a, b); }
+	inline vec mul( vec a, vec b )				{ return _mm_mul_pd(a, b); }
+	inline vec div( vec a, vec b )				{ return _mm_div_pd(a, b); }
+	inline vec abs( vec a )						{ return _mm_andnot_pd(_mm_set1_pd(-0.0), a); }
+#else
+	typedef double vec;
+	enum { width = 1 };
+	inline vec load( const double* p )			{ return *p; }
+	inline void store( double* p, vec v )		{ *p = v; }
+	inline vec set1( double v )					{ return v; }
+	inline vec add( vec a, vec b )				{ return a + b; }
+	inline vec sub( vec a, vec b )				{ return a - b; }
+	inline vec mul( vec a, vec b )				{ return a * b; }
+	inline vec div( vec a, vec b )				{ return a / b; }
+	inline vec abs( vec a )						{ return a < 0 ? -a : a; }
+#endif
+}
+
 /** class CFTree ( clustering feature tree ).
  * 
  * according to the paper,
  * birch maintains btree-like data structure consisting of summarized clusters
  * 
  * @param dim  dimensions of item, this parameter should be fixed before compiling
+ * @param DistFunc  distance function between CFEntries, one of CFDistD0 ... CFDistD3
+ * @param AbsorbDistFunc  distance function testing if a new data-point should be absorbed or not
  */
-template<boost::uint32_t dim>
+template<boost::uint32_t dim, typename DistFunc = CFDistD0, typename AbsorbDistFunc = CFDistD0>
 class CFTree
 {
 public:
@@ -66,14 +121,16 @@ public:
 	struct CFTreeInvalidItemSize : public std::exception {};
 
 	enum { fdim = dim }; /** enum for recognizing dimension outside this class. */
+	/** the sums are padded with zeros to whole vectors, e.g. 8 for 6 dimensions, so that the distance kernels never run a scalar tail. */
+	enum { padded_dim = (dim + 3) / 4 * 4 };
 
 	typedef	double float_type;	/** float type according to a precision - double, float, and so on. */
 	typedef std::vector<float_type>	item_vec_type; /** vector of items. */
-	/** pointer type of CFNode.
-	 * shared_ptr is applied to preventing memory leakage.
-	 * This node pointer is deleted, having no referencers
+	/** handle of a CFNode.
+	 * the nodes are owned by the NodeArena of their CFTree, which frees them all at once,
+	 * so a handle is a plain pointer and copying entries costs no reference counting.
 	 */
-	typedef boost::shared_ptr<CFNode> cfnode_sptr_type;
+	typedef CFNode* cfnode_ptr_type;
 	typedef std::pair<CFEntry*, CFEntry*> cfentry_pair_type; /** pair cfentry pointers. */
 	typedef std::vector<CFEntry*> cfentry_ptr_vec_type; /** vector of cfentry pointers. */
 	typedef float_type (*dist_func_type)(const CFEntry&, const CFEntry&); /** distance function pointer. */
@@ -88,26 +145,27 @@ public:
 	struct CFEntry
 	{
 		/** Empty construct initialized with zeros */
-		CFEntry() : n(0), sum_sq(0.0)
+		CFEntry() : n(0), sum_sq(0.0), child(NULL)
 		{
-			std::fill(sum, sum + dim, 0);
+			std::fill(sum, sum + padded_dim, 0);
 		}
 
 		/** Constructor when array of T type items come.
 		 * initialize CFEntry with one data-point
 		 */
 		template<typename T>
-		CFEntry( T* item ) : n(1), sum_sq(0.0)
+		CFEntry( T* item ) : n(1), sum_sq(0.0), child(NULL)
 		{
 			std::copy( item, item + dim, sum );
+			std::fill( sum + dim, sum + padded_dim, 0 );
 			for( std::size_t i = 0 ; i < dim ; i++ )
 				sum_sq += item[i] * item[i];
 		}
 
 		/** Constructor for root entry with children */
-		CFEntry( const cfnode_sptr_type& in_child ) : n(0), sum_sq(0.0), child(in_child)
+		CFEntry( cfnode_ptr_type in_child ) : n(0), sum_sq(0.0), child(in_child)
 		{
-			std::fill(sum, sum + dim, 0);
+			std::fill(sum, sum + padded_dim, 0);
 		}
 
 		/** Operator returning a new CFEntry merging from two CFEntries */
@@ -147,12 +205,12 @@ public:
 		}
 
 		/** Does this CFEntry have children? */
-		bool HasChild() const	{ return child.get() != NULL; }
+		bool HasChild() const	{ return child != NULL; }
 
 		std::size_t			n;			/* the number of data-points in */
-		float_type			sum[dim];	/* linear sum of each dimension of n data-points */
+		float_type			sum[padded_dim];	/* linear sum of each dimension of n data-points, padded with zeros */
 		float_type			sum_sq;		/* square sum of n data-points */
-		cfnode_sptr_type	child;		/* pointer to a child node */
+		cfnode_ptr_type	child;		/* pointer to a child node */
 	};
 
 	/** CFNode is composed of several CFEntries within page-size, and acts like B-tree node.
@@ -207,8 +265,10 @@ public:
 			return size == 0;
 		}
 
+		/** CFEntries are counted without the padding of sums and with a child pointer of two words, as the shared_ptr of a child used to take,
+		 * so that a CFNode holds as many of them as before and trees are split the same way. */
 		std::size_t		size;	/** # CFEntries this CFNode contains */
-		CFEntry			entries[(PAGE_SIZE - ( sizeof(CFNodeLeaf*)*2 /* 2 leaf node pointers */ + sizeof(std::size_t) /* size */ + sizeof(void*) /* vtptr */ )) / sizeof(CFEntry)/*max_entries*/]; /** Array of CFEntries */
+		CFEntry			entries[(PAGE_SIZE - ( sizeof(CFNodeLeaf*)*2 /* 2 leaf node pointers */ + sizeof(std::size_t) /* size */ + sizeof(void*) /* vtptr */ )) / ( sizeof(CFEntry) + sizeof(void*) - sizeof(float_type)*(padded_dim-dim) )/*max_entries*/]; /** Array of CFEntries */
 	};
 
 	/** CFNode which is intermediate */
@@ -221,25 +281,147 @@ public:
 	/** CFNode which is leaf */
 	struct CFNodeLeaf : public CFNode
 	{
-		CFNodeLeaf() : CFNode() {}
+		CFNodeLeaf() : CFNode(), prev(NULL), next(NULL) {}
 		virtual bool				IsLeaf() const { return true; }
 
-		cfnode_sptr_type prev;	/** previous CFNode */
-		cfnode_sptr_type next;  /** next CFNode */
+		cfnode_ptr_type prev;	/** previous CFNode */
+		cfnode_ptr_type next;  /** next CFNode */
 	};
 	
 
+private:
+	/** NodeArena owns the CFNodes of a CFTree.
+	 *
+	 * nodes are placed in page-aligned chunks, each taking the size of a leaf rounded up to cache lines, so that both kinds share one free list.
+	 * the nodes released by splits are reused by the next ones, and all the nodes are freed at once with the arena.
+	 * CFNodes hold no resources, so they are never destructed one by one.
+	 */
+	class NodeArena
+	{
+	public:
+		enum { node_stride = (sizeof(CFNodeLeaf) + 63) / 64 * 64 };	/** bytes taken by a node */
+		enum { chunk_nodes = 64 };	/** nodes in a chunk */
+		enum { chunk_bytes = (chunk_nodes * node_stride + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE };
+
+		NodeArena() : cursor(NULL), remaining(0), live(0) {}
+		~NodeArena()
+		{
+			for( std::size_t i = 0 ; i < chunks.size() ; i++ )
+				std::free( chunks[i] );
+		}
+
+		cfnode_ptr_type new_leaf() { return new (allocate()) CFNodeLeaf(); }
+		cfnode_ptr_type new_itmd() { return new (allocate()) CFNodeItmd(); }
+
+		/** take back a node which is no longer linked in the tree */
+		void release( cfnode_ptr_type node )
+		{
+			free_nodes.push_back(node);
+			live--;
+		}
+
+		/** bytes of the live nodes */
+		std::size_t bytes() const { return live * node_stride; }
+		/** bytes of the chunks allocated from the heap */
+		std::size_t reserved_bytes() const { return chunks.size() * chunk_bytes; }
+
+		void swap( NodeArena& rhs )
+		{
+			chunks.swap(rhs.chunks);
+			free_nodes.swap(rhs.free_nodes);
+			std::swap(cursor, rhs.cursor);
+			std::swap(remaining, rhs.remaining);
+			std::swap(live, rhs.live);
+		}
+
+	private:
+		NodeArena( const NodeArena& );
+		NodeArena& operator=( const NodeArena& );
+
+		void* allocate()
+		{
+			void* p;
+			if( !free_nodes.empty() )
+			{
+				p = free_nodes.back();
+				free_nodes.pop_back();
+			}
+			else
+			{
+				if( remaining == 0 )
+				{
+					chunks.reserve( chunks.size() + 1 );
+					char* raw = (char*)std::malloc( chunk_bytes + PAGE_SIZE );
+					if( raw == NULL )
+						throw std::bad_alloc();
+					chunks.push_back(raw);
+					cursor = (char*)( ((std::size_t)raw + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE );
+					remaining = chunk_nodes;
+				}
+				p = cursor;
+				cursor += node_stride;
+				remaining--;
+			}
+			live++;
+			return p;
+		}
+
+		std::vector<char*>	chunks;		/* chunks as returned by malloc, before aligning */
+		std::vector<void*>	free_nodes;	/* released nodes to be reused */
+		char*				cursor;		/* next unused node in the last chunk */
+		std::size_t			remaining;	/* # unused nodes in the last chunk */
+		std::size_t			live;		/* # nodes in use */
+	};
+
+	/** Distance kernels.
+	 * the terms of each dimension are computed by vectors, and then added one by one in the order of dimensions,
+	 * so that the distances are exactly the same as the ones of the scalar loops.
+	 */
+
+	/** sum of the first dim terms in the order of dimensions */
+	static float_type sum_terms( const float_type* terms )
+	{
+		float_type total = 0.0;
+		for( std::size_t i = 0 ; i < dim ; i++ )
+			total += terms[i];
+		return total;
+	}
+
+	/** terms[i] = lhs.sum[i]/lhs.n - rhs.sum[i]/rhs.n */
+	static void centroid_diff_terms( const CFEntry& lhs, const CFEntry& rhs, float_type* terms )
+	{
+		cftree_simd::vec ln = cftree_simd::set1( (float_type)lhs.n );
+		cftree_simd::vec rn = cftree_simd::set1( (float_type)rhs.n );
+		for( std::size_t i = 0 ; i < padded_dim ; i += cftree_simd::width )
+			cftree_simd::store( terms + i, cftree_simd::sub( cftree_simd::div(cftree_simd::load(lhs.sum + i), ln),
+															 cftree_simd::div(cftree_simd::load(rhs.sum + i), rn) ) );
+	}
+
+	/** terms[i] = (a[i]/x) * a[i] / y */
+	static void scaled_square_terms( const float_type* a, float_type x, float_type y, float_type* terms )
+	{
+		cftree_simd::vec vx = cftree_simd::set1( x );
+		cftree_simd::vec vy = cftree_simd::set1( y );
+		for( std::size_t i = 0 ; i < padded_dim ; i += cftree_simd::width )
+		{
+			cftree_simd::vec va = cftree_simd::load( a + i );
+			cftree_simd::store( terms + i, cftree_simd::div( cftree_simd::mul(cftree_simd::div(va, vx), va), vy ) );
+		}
+	}
+
 public:
 
 	/** Euclidean Distance of Centroid */
 	static float_type _DistD0( const CFEntry& lhs, const CFEntry& rhs )
 	{
-		float_type dist = 0.0;
-		float_type tmp;
-		for (std::size_t i = 0 ; i < dim ; i++) {
-			tmp =  lhs.sum[i]/lhs.n - rhs.sum[i]/rhs.n;
-			dist += tmp*tmp;
+		float_type terms[padded_dim];
+		centroid_diff_terms( lhs, rhs, terms );
+		for( std::size_t i = 0 ; i < padded_dim ; i += cftree_simd::width )
+		{
+			cftree_simd::vec v = cftree_simd::load( terms + i );
+			cftree_simd::store( terms + i, cftree_simd::mul(v, v) );
 		}
+		float_type dist = sum_terms( terms );
 		//assert(dist >= 0.0);
 		return (std::max)(dist, 0.0);
 	}
@@ -247,12 +429,11 @@ public:
 	/** Manhattan Distance of Centroid */
 	static float_type _DistD1( const CFEntry& lhs, const CFEntry& rhs )
 	{
-		float_type dist = 0.0;
-		float_type tmp;
-		for (std::size_t i = 0 ; i < dim ; i++) {
-			tmp = std::abs(lhs.sum[i]/lhs.n - rhs.sum[i]/rhs.n);
-			dist += tmp;
-		}
+		float_type terms[padded_dim];
+		centroid_diff_terms( lhs, rhs, terms );
+		for( std::size_t i = 0 ; i < padded_dim ; i += cftree_simd::width )
+			cftree_simd::store( terms + i, cftree_simd::abs(cftree_simd::load(terms + i)) );
+		float_type dist = sum_terms( terms );
 		//assert(dist >= 0.0);
 		return (std::max)(dist, 0.0);
 	}
@@ -260,9 +441,10 @@ public:
 	/** Pairwise IntraCluster Distance */
 	static float_type _DistD2( const CFEntry& lhs, const CFEntry& rhs )
 	{
-		float_type dot = 0.0;
-		for(std::size_t i = 0 ; i < dim ; i++)
-			dot += lhs.sum[i] * rhs.sum[i];
+		float_type terms[padded_dim];
+		for( std::size_t i = 0 ; i < padded_dim ; i += cftree_simd::width )
+			cftree_simd::store( terms + i, cftree_simd::mul(cftree_simd::load(lhs.sum + i), cftree_simd::load(rhs.sum + i)) );
+		float_type dot = sum_terms( terms );
 
 		float_type dist = ( rhs.n*lhs.sum_sq + lhs.n*rhs.sum_sq - 2*dot ) / (lhs.n*rhs.n);
 		//assert(dist >= 0.0);
@@ -273,12 +455,11 @@ public:
 	static float_type _DistD3( const CFEntry& lhs, const CFEntry& rhs)
 	{
 		std::size_t tmpn = lhs.n+rhs.n;
-		float_type tmp1, tmp2 = 0.0;
-		for (std::size_t i = 0 ; i < dim ; i++)
-		{
-			tmp1 = lhs.sum[i] + rhs.sum[i];
-			tmp2 += tmp1/tmpn * tmp1/(tmpn-1);
-		}
+		float_type terms[padded_dim];
+		for( std::size_t i = 0 ; i < padded_dim ; i += cftree_simd::width )
+			cftree_simd::store( terms + i, cftree_simd::add(cftree_simd::load(lhs.sum + i), cftree_simd::load(rhs.sum + i)) );
+		scaled_square_terms( terms, (float_type)tmpn, (float_type)(tmpn-1), terms );
+		float_type tmp2 = sum_terms( terms );
 		float_type dist = 2 * ((lhs.sum_sq+rhs.sum_sq)/(tmpn-1) - tmp2);
 		//assert(dist >= 0.0);
 		return std::max(dist,0.0);
@@ -290,9 +471,9 @@ public:
 		if( e.n <= 1 )
 			return 0.0;
 
-		float_type temp = 0.0;
-		for (std::size_t i = 0 ; i < dim ; i++)
-			temp += e.sum[i]/e.n * e.sum[i]/(e.n - 1);
+		float_type terms[padded_dim];
+		scaled_square_terms( e.sum, (float_type)e.n, (float_type)(e.n - 1), terms );
+		float_type temp = sum_terms( terms );
 
 		float_type diameter = 2 * (e.sum_sq/(e.n - 1) - temp);
 
@@ -306,29 +487,79 @@ public:
 		if( e.n <= 1 )
 			return 0.0;
 
-		float_type tmp0, tmp1 = 0.0;
-		for (std::size_t i=0; i < dim ; i++)
+		float_type terms[padded_dim];
+		cftree_simd::vec n = cftree_simd::set1( (float_type)e.n );
+		for( std::size_t i = 0 ; i < padded_dim ; i += cftree_simd::width )
 		{
-			tmp0 = e.sum[i] / e.n;
-			tmp1 += tmp0*tmp0;
+			cftree_simd::vec v = cftree_simd::div( cftree_simd::load(e.sum + i), n );
+			cftree_simd::store( terms + i, cftree_simd::mul(v, v) );
 		}
+		float_type tmp1 = sum_terms( terms );
 		float_type radius = e.sum_sq/e.n - tmp1;
 		
 		//assert(radius >= 0.0);
 		return std::max(radius, 0.0);
 	}
 
+	/** compile-time distance functions, which are inlined */
+	static float_type distance( CFDistD0, const CFEntry& lhs, const CFEntry& rhs )	{ return _DistD0(lhs, rhs); }
+	static float_type distance( CFDistD1, const CFEntry& lhs, const CFEntry& rhs )	{ return _DistD1(lhs, rhs); }
+	static float_type distance( CFDistD2, const CFEntry& lhs, const CFEntry& rhs )	{ return _DistD2(lhs, rhs); }
+	static float_type distance( CFDistD3, const CFEntry& lhs, const CFEntry& rhs )	{ return _DistD3(lhs, rhs); }
+
+	/** distance function pointers of the compile-time ones, for the global clustering */
+	static dist_func_type dist_func_of( CFDistD0 )	{ return _DistD0; }
+	static dist_func_type dist_func_of( CFDistD1 )	{ return _DistD1; }
+	static dist_func_type dist_func_of( CFDistD2 )	{ return _DistD2; }
+	static dist_func_type dist_func_of( CFDistD3 )	{ return _DistD3; }
+
 private:
-	/** Functor is used for choosing the closest one */
-	struct CloseEntryLessThan
+	/** Functor computing the distances DistFunc(entry, base) from entries to a base entry.
+	 * For the distances of centroids, the centroid of the base entry is computed once, the same way as the distance functions do.
+	 */
+	struct CloseDistance
 	{
-		CloseEntryLessThan( const CFEntry& in_base_entry, const dist_func_type& in_dist_func ) : base_entry(in_base_entry), dist_func(in_dist_func) {}
-		bool operator()(const CFEntry& lhs, const CFEntry& rhs)	{ return dist_func(lhs, base_entry) < dist_func(rhs, base_entry); }
+		CloseDistance( const CFEntry& in_base_entry ) : base_entry(in_base_entry)	{ prepare(DistFunc()); }
+		float_type operator()( const CFEntry& e ) const	{ return dist(DistFunc(), e); }
+
+		template<typename Func>
+		void prepare( Func ) {}
+		void prepare( CFDistD0 )	{ prepare_centroid(); }
+		void prepare( CFDistD1 )	{ prepare_centroid(); }
+
+		template<typename Func>
+		float_type dist( Func, const CFEntry& e ) const	{ return distance(Func(), e, base_entry); }
+		float_type dist( CFDistD0, const CFEntry& e ) const	{ return centroid_dist(CFDistD0(), e); }
+		float_type dist( CFDistD1, const CFEntry& e ) const	{ return centroid_dist(CFDistD1(), e); }
+
+		void prepare_centroid()
+		{
+			cftree_simd::vec n = cftree_simd::set1( (float_type)base_entry.n );
+			for( std::size_t i = 0 ; i < padded_dim ; i += cftree_simd::width )
+				cftree_simd::store( centroid + i, cftree_simd::div(cftree_simd::load(base_entry.sum + i), n) );
+		}
+
+		template<typename Func>
+		float_type centroid_dist( Func, const CFEntry& e ) const
+		{
+			float_type terms[padded_dim];
+			cftree_simd::vec n = cftree_simd::set1( (float_type)e.n );
+			for( std::size_t i = 0 ; i < padded_dim ; i += cftree_simd::width )
+			{
+				cftree_simd::vec v = cftree_simd::sub( cftree_simd::div(cftree_simd::load(e.sum + i), n), cftree_simd::load(centroid + i) );
+				cftree_simd::store( terms + i, centroid_term(Func(), v) );
+			}
+			return (std::max)( sum_terms(terms), 0.0 );
+		}
 
 		const CFEntry& base_entry;
-		const dist_func_type& dist_func;
+		float_type centroid[padded_dim];
 	};
 
+	static cftree_simd::vec centroid_term( CFDistD0, cftree_simd::vec v )	{ return cftree_simd::mul(v, v); }
+	static cftree_simd::vec centroid_term( CFDistD1, cftree_simd::vec v )	{ return cftree_simd::abs(v); }
+
+
 public:
 	/** leaf iterator */
 	struct leaf_iterator : public std::forward_iterator_tag
@@ -341,7 +572,7 @@ public:
 		typedef std::ptrdiff_t	difference_type;
 
 		leaf_iterator( CFNodeLeaf* in_leaf ) : leaf( in_leaf ) {}
-		leaf_iterator	operator++() { leaf = (CFNodeLeaf*)leaf->next.get(); return leaf_iterator(leaf); }
+		leaf_iterator	operator++() { leaf = (CFNodeLeaf*)leaf->next; return leaf_iterator(leaf); }
 		bool			operator!=( const leaf_iterator rhs ) const { return !(leaf == rhs.leaf); }
 		reference		operator*() { return *leaf; }
 		pointer			operator->() { return leaf; }
@@ -349,18 +580,17 @@ public:
 		pointer leaf;
 	};
 
-	/** CFTree construct with memory limit and designated distance functions
+	/** CFTree construct with memory limit, using the distance functions of the template parameters
 	 *
 	 * @param in_dist_threshold range within a CFEntry
-	 * @param in_mem_limit memory limit to which CFTree can utilize, if CFTree overflows this limit, then distance threshold become larger to rebuild more compact CFTree
-	 * @param in_dist_func distance function between CFEntries
-	 * @param in_dist_func distance function tests if a new data-point should be absorbed or not
+	 * @param in_mem_limit memory limit in bytes of nodes to which CFTree can utilize, if CFTree overflows this limit, then distance threshold become larger to rebuild more compact CFTree
 	 **/
-	CFTree( float_type in_dist_threshold, std::size_t in_mem_limit, dist_func_type in_dist_func = _DistD0, dist_func_type in_absorb_dist_func = _DistD0  ) :
-		mem_limit(in_mem_limit), dist_threshold(in_dist_threshold), root( new CFNodeLeaf() ), dist_func(in_dist_func), absorb_dist_func(in_absorb_dist_func), node_cnt(1/* root node */),
-		leaf_dummy( new CFNodeLeaf() )
+	CFTree( float_type in_dist_threshold, std::size_t in_mem_limit ) :
+		mem_limit(in_mem_limit), dist_threshold(in_dist_threshold), dist_func(dist_func_of(DistFunc()))
 	{
-		((CFNodeLeaf*)leaf_dummy.get())->next = root;
+		root = arena.new_leaf();
+		leaf_dummy = arena.new_leaf();
+		((CFNodeLeaf*)leaf_dummy)->next = root;
 	}
 	~CFTree(void) {}
 
@@ -388,7 +618,7 @@ public:
 	void insert( CFEntry& e )
 	{
 		bool bsplit;
-		insert(root.get(), e, bsplit);
+		insert(root, e, bsplit);
 
 		// there's no exception for the root as regard to splitting, indeed
 		if( bsplit )
@@ -396,15 +626,14 @@ public:
 			split_root( e );
 		}
 
-        //std::size_t curr_mem = node_cnt * sizeof(CFNode);
-		if( mem_limit > 0 && node_cnt * sizeof(CFNode) > mem_limit )
+		if( mem_limit > 0 && arena.bytes() > mem_limit )
 		{
 			rebuild();
 		}
 	}
 
 	/** get the beginning of leaf iterators */
-	leaf_iterator leaf_begin() { return leaf_iterator( (CFNodeLeaf*)((CFNodeLeaf*)leaf_dummy.get())->next.get()); }
+	leaf_iterator leaf_begin() { return leaf_iterator( (CFNodeLeaf*)((CFNodeLeaf*)leaf_dummy)->next ); }
 	/** get the end of leaf iterators  */
 	leaf_iterator leaf_end() { return leaf_iterator(NULL); }
 
@@ -439,7 +668,7 @@ private:
 		// non-leaf
 		if( close_entry.HasChild() )
 		{
-			insert( close_entry.child.get(), new_entry, bsplit );
+			insert( close_entry.child, new_entry, bsplit );
 
 			// no more split
 			if( !bsplit )
@@ -452,7 +681,7 @@ private:
 		else
 		{
 			// absorb
-			if ( absorb_dist_func(close_entry, new_entry) < dist_threshold  )
+			if ( distance(AbsorbDistFunc(), close_entry, new_entry) < dist_threshold  )
 			{
 				close_entry += (new_entry);
 				bsplit = false;
@@ -471,17 +700,31 @@ private:
 		}
 	}
 
+	/** the first closest entry, as std::min_element() over the distances finds, computing each distance once */
 	CFEntry* find_close( CFNode* node, CFEntry& new_entry )
 	{
 		CFEntry* begin = node->entries;
 		CFEntry* end = begin + node->size;
-		CFEntry* e = std::min_element( begin, end, CloseEntryLessThan(new_entry, dist_func) );
-		return e != end ? e : NULL;
+		if( begin == end )
+			return NULL;
+		CloseDistance dist( new_entry );
+		CFEntry* close = begin;
+		float_type close_dist = dist( *begin );
+		for( CFEntry* e = begin + 1 ; e != end ; e++ )
+		{
+			float_type d = dist( *e );
+			if( d < close_dist )
+			{
+				close = e;
+				close_dist = d;
+			}
+		}
+		return close;
 	}
 
 	void split( CFNode& node, CFEntry& close_entry, CFEntry& new_entry, bool& bsplit )
 	{
-		CFNode* old_node = close_entry.child.get();
+		CFNode* old_node = close_entry.child;
 		assert( old_node != NULL );
 
 		// make the list of entries, old entries
@@ -498,8 +741,8 @@ private:
 		bool node_is_leaf = old_node->IsLeaf();
 
 		// make two split nodes
-		cfnode_sptr_type node_lhs( node_is_leaf ? (CFNode*) new CFNodeLeaf() : (CFNode*) new CFNodeItmd() );
-		cfnode_sptr_type node_rhs( node_is_leaf ? (CFNode*) new CFNodeLeaf() : (CFNode*) new CFNodeItmd() );
+		cfnode_ptr_type node_lhs = node_is_leaf ? arena.new_leaf() : arena.new_itmd();
+		cfnode_ptr_type node_rhs = node_is_leaf ? arena.new_leaf() : arena.new_itmd();
 
 		// two entries for new root node
 		// and connect child node to the entries
@@ -512,18 +755,18 @@ private:
 			
 			CFNodeLeaf* leaf_node = (CFNodeLeaf*)old_node;
 
-			cfnode_sptr_type prev = leaf_node->prev;
-			cfnode_sptr_type next = leaf_node->next;
+			cfnode_ptr_type prev = leaf_node->prev;
+			cfnode_ptr_type next = leaf_node->next;
 
 			if( prev != NULL )
-				((CFNodeLeaf*)prev.get())->next = node_lhs;
+				((CFNodeLeaf*)prev)->next = node_lhs;
 			if( next != NULL )
-				((CFNodeLeaf*)next.get())->prev = node_rhs;
+				((CFNodeLeaf*)next)->prev = node_rhs;
 
-			((CFNodeLeaf*)node_lhs.get())->prev = prev;
-			((CFNodeLeaf*)node_lhs.get())->next = node_rhs;
-			((CFNodeLeaf*)node_rhs.get())->prev = node_lhs;
-			((CFNodeLeaf*)node_rhs.get())->next = next;
+			((CFNodeLeaf*)node_lhs)->prev = prev;
+			((CFNodeLeaf*)node_lhs)->next = node_rhs;
+			((CFNodeLeaf*)node_rhs)->prev = node_lhs;
+			((CFNodeLeaf*)node_rhs)->next = next;
 		}
 
 		// rearrange old entries to new entries
@@ -533,6 +776,9 @@ private:
 		// so the first one is included instead of old ones
 		node.Replace(close_entry, entry_lhs);
 
+		// the old node has been replaced by the two new ones
+		arena.release(old_node);
+
 		// the full node indicates that this node have to be split as well
 		bsplit = node.IsFull();
 
@@ -542,9 +788,6 @@ private:
 		// if affordable, not split, add the second entry to the node
 		else
 			node.Add(entry_rhs);
-
-		// for statistics and mornitoring memory usage
-		node_cnt++;
 	}
 
 	void split_root( CFEntry& e )
@@ -563,8 +806,8 @@ private:
 		bool root_is_leaf = root->IsLeaf();
 
 		// make two split nodes
-		cfnode_sptr_type node_lhs( root_is_leaf ? (CFNode*) new CFNodeLeaf() : (CFNode*) new CFNodeItmd() );
-		cfnode_sptr_type node_rhs( root_is_leaf ? (CFNode*) new CFNodeLeaf() : (CFNode*) new CFNodeItmd() );
+		cfnode_ptr_type node_lhs = root_is_leaf ? arena.new_leaf() : arena.new_itmd();
+		cfnode_ptr_type node_rhs = root_is_leaf ? arena.new_leaf() : arena.new_itmd();
 
 		// two entries for new root node
 		// and connect child node to the entries
@@ -572,16 +815,16 @@ private:
 		CFEntry entry_rhs( node_rhs );
 
 		// new root node result in two entries each of which has split node respectively
-		cfnode_sptr_type new_root( new CFNodeItmd() );
+		cfnode_ptr_type new_root = arena.new_itmd();
 
 		// update prev/next links of newly created leaves
 		if( root_is_leaf )
 		{
 			assert( node_lhs->IsLeaf() && node_rhs->IsLeaf() );
-			((CFNodeLeaf*)leaf_dummy.get())->next = node_lhs;
-			((CFNodeLeaf*)node_lhs.get())->prev = leaf_dummy;
-			((CFNodeLeaf*)node_lhs.get())->next = node_rhs;
-			((CFNodeLeaf*)node_rhs.get())->prev = node_lhs;
+			((CFNodeLeaf*)leaf_dummy)->next = node_lhs;
+			((CFNodeLeaf*)node_lhs)->prev = leaf_dummy;
+			((CFNodeLeaf*)node_lhs)->next = node_rhs;
+			((CFNodeLeaf*)node_rhs)->prev = node_lhs;
 		}
 
 		// rearrange old entries to new entries
@@ -590,10 +833,8 @@ private:
 		// substitute new_root to 'root' variable
 		new_root->Add(entry_lhs);
 		new_root->Add(entry_rhs);
+		arena.release(root);
 		root = new_root;
-
-		// for statistics and mornitoring memory usage
-		node_cnt++;
 	}
 
 	void rearrange( cfentry_ptr_vec_type& entries, cfentry_pair_type& far_pair, CFEntry& entry_lhs, CFEntry& entry_rhs )
@@ -609,8 +850,8 @@ private:
 			if( &e == far_pair.first || &e == far_pair.second )
 				continue;
 
-			float_type dist_first = dist_func( *far_pair.first, e );
-			float_type dist_second = dist_func( *far_pair.second, e );
+			float_type dist_first = distance( DistFunc(), *far_pair.first, e );
+			float_type dist_second = distance( DistFunc(), *far_pair.second, e );
 
 			CFEntry& e_update = dist_first < dist_second ? entry_lhs : entry_rhs;
 			e_update.child->Add(e);
@@ -630,7 +871,7 @@ private:
 				CFEntry& e1 = *entries[i];
 				CFEntry& e2 = *entries[j];
 
-				float_type dist = dist_func( e1, e2 );
+				float_type dist = distance( DistFunc(), e1, e2 );
 				if( max_dist < dist )
 				{
 					max_dist = dist;
@@ -648,7 +889,7 @@ private:
 		float_type	dist;
 
 		// determine new threshold
-		CFNodeLeaf* leaf = (CFNodeLeaf*)leaf_dummy.get();
+		CFNodeLeaf* leaf = (CFNodeLeaf*)leaf_dummy;
 		while( leaf != NULL )
 		{
 			if( leaf->size >= 2 )
@@ -658,7 +899,7 @@ private:
 				{
 					for( std::size_t j = i+1 ; j < leaf->size ; j++ )
 					{
-						dist = dist_func( leaf->entries[i], leaf->entries[j] );
+						dist = distance( DistFunc(), leaf->entries[i], leaf->entries[j] );
 						dist = dist >= 0.0 ? sqrt(dist) : 0.0;
 						if( min_dists[i] > dist )	min_dists[i] = dist;
 						if( min_dists[j] > dist )	min_dists[j] = dist;
@@ -670,7 +911,7 @@ private:
 			}
 
 			// next leaf
-			leaf = (CFNodeLeaf*)leaf->next.get();
+			leaf = (CFNodeLeaf*)leaf->next;
 		}
 		return total_d / total_n;
 	}
@@ -693,42 +934,44 @@ public:
 		}
 
 		// construct a new tree by inserting all the node from the previous tree
-		CFTree<dim> new_tree( dist_threshold, mem_limit );
+		CFTree<dim, DistFunc, AbsorbDistFunc> new_tree( dist_threshold, mem_limit );
 		
-		CFNodeLeaf* leaf = (CFNodeLeaf*)leaf_dummy.get();
+		CFNodeLeaf* leaf = (CFNodeLeaf*)leaf_dummy;
 		while( leaf != NULL )
 		{
 			for( std::size_t i = 0 ; i < leaf->size ; i++ )
 				new_tree.insert(leaf->entries[i]);
 
 			// next leaf
-			leaf = (CFNodeLeaf*)leaf->next.get();
+			leaf = (CFNodeLeaf*)leaf->next;
 		}
 
 		// really I'd like to replace the previous tree to the new one by
 		// stating " *this = new_tree; ", but it doesn't work because 'this' is const pointer
-		// copy root and dummy_node
-		// copy statistics variable
+		// take root, dummy_node and their arena, and the old nodes are freed at once with new_tree
 
 		root = new_tree.root;
 		leaf_dummy = new_tree.leaf_dummy;
-		node_cnt = new_tree.node_cnt;
+		arena.swap(new_tree.arena);
 	}
 
+	/** distance threshold, which grows when the tree is rebuilt to fit in the memory limit */
+	float_type threshold() const { return dist_threshold; }
+
+	/** bytes taken by the nodes of this CFTree, which are compared to the memory limit */
+	std::size_t memory_usage() const { return arena.bytes(); }
+
 private:
 
 	// data structure
-	cfnode_sptr_type	root;
-	cfnode_sptr_type	leaf_dummy;	/* start node of leaves */
+	NodeArena			arena;		/* owner of all the nodes */
+	cfnode_ptr_type		root;
+	cfnode_ptr_type		leaf_dummy;	/* start node of leaves */
 	
 	// parameters
 	std::size_t			mem_limit;
 	float_type			dist_threshold;
-	dist_func_type		dist_func;
-	dist_func_type		absorb_dist_func;
-
-	// statistics
-	std::size_t			node_cnt;
+	dist_func_type		dist_func;	/* the pointer to DistFunc */
 
 /* phase 3 - applying a global clustering algorithm to subclusters */
 #include "CFTree_CFCluster.h"
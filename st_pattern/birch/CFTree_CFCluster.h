@@ -29,10 +29,20 @@
 // {
 
 	public:
-		void cluster( cfentry_vec_type& entries )
+		/** global clustering algorithms of the leaf entries */
+		enum cluster_method
+		{
+			CLUSTER_DEFAULT,	/** refining entries for D0/D1, or hierarchical clustering with a distance matrix for D2/D3 */
+			CLUSTER_NN_CHAIN	/** ward hierarchical clustering by nearest-neighbor chains, in linear memory */
+		};
+
+		void cluster( cfentry_vec_type& entries, cluster_method method = CLUSTER_DEFAULT )
 		{
 			get_entries(entries);
-			_cluster(entries);
+			if( method == CLUSTER_NN_CHAIN )
+				_cluster_nn_chain(entries);
+			else
+				_cluster(entries);
 		}
 
 	private:
@@ -256,6 +266,218 @@
 			dist_func_type&			dist_func;
 		};
 
+		/** ward hierarchical clustering by nearest-neighbor chains.
+		 *
+		 * unlike HierarchicalClustering, no distance matrix is kept: the ward distances are computed from the centroids and sizes of the active clusters,
+		 * so that memory is linear in the number of entries.
+		 * ward linkage is reducible, so merging reciprocal nearest neighbors builds the same hierarchy as merging the closest pair at each step does.
+		 * the hierarchy is then split from the top, like HierarchicalClustering::split(), until the diameters are within the threshold.
+		 *
+		 * the active clusters are kept sorted by the first coordinate of their centroids, and the merged ones are kept aside until there are enough of them to sort again.
+		 * nearest neighbors are searched outwards from a cluster in the sorted ones, since the ward distance to a cluster of n entries
+		 * is at least n/(n+1) times the square of the difference in that coordinate, and among all the ones kept aside.
+		 */
+		struct NNChainClustering
+		{
+			NNChainClustering( cfentry_vec_type& in_entries ) : entries(in_entries), n((int)in_entries.size()) {}
+
+			void merge()
+			{
+				alive.assign( 2*n-1, false );
+				loc.assign( 2*n-1, 0 );
+				for( int i = 0 ; i < n ; i++ )
+				{
+					alive[i] = true;
+					add_pending( i, entries[i] );
+				}
+				sort_active();
+				cf.reserve( n-1 );
+				lhs.reserve( n-1 );
+				rhs.reserve( n-1 );
+
+				int nactive = n;
+				int first = 0;	/* no node below it is alive */
+				std::vector<int> chain;
+				chain.reserve( n );
+				while( nactive > 1 )
+				{
+					if( chain.empty() )
+					{
+						while( !alive[first] )
+							first++;
+						chain.push_back( first );
+					}
+					int curr = chain.back();
+					int prev = chain.size() >= 2 ? chain[chain.size()-2] : -1;
+
+					// the nearest neighbor of curr, preferring prev and then the lowest node among equally near ones so that the chain never cycles
+					const float_type* c = centroid( curr );
+					float_type nc = count( curr );
+					int next = prev;
+					float_type next_dist = prev >= 0 ? ward( c, nc, centroid(prev), count(prev) ) : (std::numeric_limits<float_type>::max)();
+					float_type scale = nc / (nc + 1);
+					int nsorted = (int)sorted_ids.size();
+					int right = loc[curr] >= 0 ? loc[curr] + 1 : lower_bound( c[0] );
+					int left = loc[curr] >= 0 ? loc[curr] - 1 : right - 1;
+					for( int k = right ; k < nsorted && scale * square( sorted_rows[k*padded_dim] - c[0] ) <= next_dist ; k++ )
+						closer( curr, prev, c, nc, sorted_ids[k], &sorted_rows[k*padded_dim], sorted_counts[k], next, next_dist );
+					for( int k = left ; k >= 0 && scale * square( sorted_rows[k*padded_dim] - c[0] ) <= next_dist ; k-- )
+						closer( curr, prev, c, nc, sorted_ids[k], &sorted_rows[k*padded_dim], sorted_counts[k], next, next_dist );
+					for( std::size_t k = 0 ; k < pending_ids.size() ; k++ )
+						closer( curr, prev, c, nc, pending_ids[k], &pending_rows[k*padded_dim], pending_counts[k], next, next_dist );
+					if( next != prev )
+					{
+						chain.push_back( next );
+						continue;
+					}
+
+					// curr and prev are reciprocal nearest neighbors
+					chain.pop_back();
+					chain.pop_back();
+					int merged = n + (int)cf.size();
+					cf.push_back( node(prev) + node(curr) );
+					lhs.push_back( prev );
+					rhs.push_back( curr );
+					alive[prev] = false;
+					alive[curr] = false;
+					alive[merged] = true;
+					add_pending( merged, cf.back() );
+					nactive--;
+					if( pending_ids.size() > (std::max)( (std::size_t)256, (std::size_t)(4 * std::sqrt((double)nactive)) ) )
+						sort_active();
+				}
+				std::vector<float_type>().swap( sorted_rows );
+				std::vector<float_type>().swap( pending_rows );
+			}
+
+			/** replace the entries by the clusters of diameters within ft, or by the original entries which cannot be split */
+			void split( float_type ft )
+			{
+				cfentry_vec_type clusters;
+				std::vector<int> stack( 1, 2*n-2 /* root */ );
+				while( !stack.empty() )
+				{
+					int id = stack.back();
+					stack.pop_back();
+					if( id >= n && _Diameter(cf[id-n]) > ft )
+					{
+						stack.push_back( rhs[id-n] );
+						stack.push_back( lhs[id-n] );
+					}
+					else
+						clusters.push_back( node(id) );
+				}
+				entries.swap( clusters );
+			}
+
+		private:
+			/** entries are nodes 0..n-1, and the merged clusters n..2n-2 */
+			CFEntry& node( int id ) { return id < n ? entries[id] : cf[id-n]; }
+
+			const float_type* centroid( int id ) const { return loc[id] >= 0 ? &sorted_rows[loc[id]*padded_dim] : &pending_rows[(-loc[id]-1)*padded_dim]; }
+			float_type count( int id ) const { return loc[id] >= 0 ? sorted_counts[loc[id]] : pending_counts[-loc[id]-1]; }
+
+			static float_type square( float_type v ) { return v * v; }
+
+			/** ward distance, the increase of the sum of squared errors by merging two clusters */
+			static float_type ward( const float_type* ca, float_type na, const float_type* cb, float_type nb )
+			{
+				float_type d = 0.0;
+				for( std::size_t i = 0 ; i < padded_dim ; i++ )
+					d += (ca[i] - cb[i]) * (ca[i] - cb[i]);
+				return na * nb / (na + nb) * d;
+			}
+
+			/** take the cluster id as the nearest neighbor of curr if it is closer than next */
+			void closer( int curr, int prev, const float_type* c, float_type nc, int id, const float_type* row, float_type nrow, int& next, float_type& next_dist ) const
+			{
+				if( id == curr || id == prev || !alive[id] )
+					return;
+				float_type d = ward( c, nc, row, nrow );
+				if( d < next_dist || ( d == next_dist && next != prev && id < next ) )
+				{
+					next = id;
+					next_dist = d;
+				}
+			}
+
+			/** first sorted cluster whose centroid is not before x in the first coordinate */
+			int lower_bound( float_type x ) const
+			{
+				int lo = 0, hi = (int)sorted_ids.size();
+				while( lo < hi )
+				{
+					int mid = (lo + hi) / 2;
+					if( sorted_rows[mid*padded_dim] < x )
+						lo = mid + 1;
+					else
+						hi = mid;
+				}
+				return lo;
+			}
+
+			void add_pending( int id, const CFEntry& e )
+			{
+				loc[id] = -(int)pending_ids.size() - 1;
+				pending_ids.push_back( id );
+				pending_counts.push_back( (float_type)e.n );
+				for( std::size_t i = 0 ; i < padded_dim ; i++ )
+					pending_rows.push_back( i < dim ? e.sum[i] / e.n : 0.0 );
+			}
+
+			struct KeyLessThan
+			{
+				bool operator()( const std::pair<float_type, int>& l, const std::pair<float_type, int>& r ) const { return l < r; }
+			};
+
+			/** sort the alive clusters, including the ones kept aside, by the first coordinate of their centroids */
+			void sort_active()
+			{
+				std::vector< std::pair<float_type, int> > keys;
+				for( std::size_t k = 0 ; k < sorted_ids.size() ; k++ )
+					if( alive[sorted_ids[k]] )
+						keys.push_back( std::make_pair( sorted_rows[k*padded_dim], sorted_ids[k] ) );
+				for( std::size_t k = 0 ; k < pending_ids.size() ; k++ )
+					if( alive[pending_ids[k]] )
+						keys.push_back( std::make_pair( pending_rows[k*padded_dim], pending_ids[k] ) );
+				std::sort( keys.begin(), keys.end(), KeyLessThan() );
+
+				std::vector<float_type> rows( keys.size()*padded_dim ), counts( keys.size() );
+				std::vector<int> ids( keys.size() );
+				for( std::size_t k = 0 ; k < keys.size() ; k++ )
+				{
+					int id = keys[k].second;
+					const float_type* c = centroid( id );
+					std::copy( c, c + padded_dim, &rows[k*padded_dim] );
+					counts[k] = count( id );
+					ids[k] = id;
+				}
+				for( std::size_t k = 0 ; k < ids.size() ; k++ )
+					loc[ids[k]] = (int)k;
+				sorted_rows.swap( rows );
+				sorted_counts.swap( counts );
+				sorted_ids.swap( ids );
+				pending_rows.clear();
+				pending_counts.clear();
+				pending_ids.clear();
+			}
+
+			cfentry_vec_type&		entries;
+			int						n;
+			std::vector<CFEntry>	cf;		/* merged clusters */
+			std::vector<int>		lhs;	/* the two nodes of each merged cluster */
+			std::vector<int>		rhs;
+
+			std::vector<bool>		alive;	/* whether a node is an active cluster */
+			std::vector<int>		loc;	/* index of an active cluster in the sorted ones, or -1-index in the ones kept aside */
+			std::vector<float_type>	sorted_rows;	/* centroids padded like the sums */
+			std::vector<float_type>	sorted_counts;
+			std::vector<int>		sorted_ids;
+			std::vector<float_type>	pending_rows;
+			std::vector<float_type>	pending_counts;
+			std::vector<int>		pending_ids;
+		};
+
 		void refine_cluster( cfentry_vec_type& entries )
 		{
 			std::vector<bool> merged(entries.size(), false);
@@ -341,6 +563,16 @@
 			}
 		}
 
+		void _cluster_nn_chain( cfentry_vec_type& entries )
+		{
+			if( entries.size() <= 1 )
+				return;
+
+			NNChainClustering h( entries );
+			h.merge();
+			h.split( dist_threshold );
+		}
+
 // };
 
 
@@ -8,21 +8,49 @@
 #include "Apps.h"
 #include <QVector>
 
+// Checks if the i-th optional argument is given, rather than missing or - for its default.
+bool hasArg(const QStringList &args, int i) {
+    return args.count() > i && args[i].compare("-") != 0;
+}
+
 void printUsage() {
     qDebug()<<"The st-pattern mining tool consists of 3 phases:\n"
            <<"The SEG phase converts trajectory into segments with multi-threshold.\n"
           <<"The CLUSTER-TRANS phase clusters the generated segments and then converts trajectories into transactional data.\n"
         <<"The MINE phase mines frequent pattern from the transactional data.\n";
     qDebug()<<"Usage:\n"
-           <<"st_pattern seg dataset_dir dataset_suffix output segmentation_step use_temporal min_seg_length use_SEST dotsTh\n"
-          <<"e.g.: st_pattern seg path_to_mopsi .txt mopsi_100 1.6 1 100.0 1 1000\n\n"
-         <<"st_pattern cluster segment_file w1:w2:w3:w4:w5:w6 output threshold [mem_lim_in_MB]\n"
+           <<"st_pattern seg dataset_dir dataset_suffix output segmentation_step use_temporal min_seg_length use_SEST dotsTh [num_threads] [pipeline_SEST]\n"
+          <<"The num_threads is 1 by default, and 0 means using all the available cores.\n"
+          <<"Set pipeline_SEST to 1 to run each SEST level on its own thread, which helps very long trajectories.\n"
+          <<"e.g.: st_pattern seg path_to_mopsi .txt mopsi_100 1.6 1 100.0 1 1000 4\n"
+          <<"The dataset_dir could also be a *.trc cache made by the import command, then dataset_suffix is ignored.\n\n"
+          <<"st_pattern import dataset_dir dataset_suffix output\n"
+          <<"e.g.: st_pattern import path_to_mopsi .txt mopsi\n\n"
+         <<"st_pattern cluster segment_file w1:w2:w3:w4:w5:w6 output threshold [mem_lim_in_MB] [num_threads] [method] [num_shards]\n"
+        <<"The num_threads redistributing the segments is 1 by default, and 0 means using all the available cores.\n"
+        <<"The method clustering the leaf entries is refine by default, or nnchain for the ward hierarchical clustering\n"
+        <<"by nearest-neighbor chains, which takes linear memory and suits the trees of many leaves.\n"
+        <<"Set num_shards to build the tree by that many threads, 0 for all the available cores, each one building a\n"
+        <<"tree of its own from a share of the segments before their leaf entries are merged into one tree.\n"
+        <<"The clusters then differ from the ones built by one thread.\n"
         <<"e.g.: st_pattern cluster mopsi_100 0.0001:0.0001:0.0001:0.0001:0:0 mopsi_100_50 50.0 100\n\n"
        //<<"st_pattern trans tins_file s2c_file [output_tinc_file]\n"
       //<<"The output_tinc_file is equal to s2c_file by default.\n"
       //<<"e.g.: st_pattern trans mopsi_100 mopsi_100_50 mopsi_100_50"
-     <<"st_pattern mine cluster_file tinc_file output_pattern_file scpm_radius min_sup [min_pattern_length]\n"
-    <<"e.g.: st_pattern mine mopsi_100_50 mopsi_100_50 mopsi_100_50_50_5 50.0 5 3";
+     <<"st_pattern mine cluster_file tinc_file output_pattern_file scpm_radius min_sup [min_pattern_length] [num_threads] [engine] [top_k] [mem_budget_in_MB]\n"
+    <<"The num_threads is 1 by default, and 0 means using all the available cores.\n"
+    <<"The engine is prefixspan by default, or bitmap for the SPAM-like one, which always runs on one thread.\n"
+    <<"Set top_k to keep only the k patterns of the highest supports and lengths, which are streamed to the output\n"
+    <<"while mining on one thread. Those patterns are not cleaned, and shorter than min_pattern_length are skipped.\n"
+    <<"Set mem_budget_in_MB to keep the projected databases of prefixspan within it while mining on one thread,\n"
+    <<"spilling the rest into temporary files. It could not be combined with the bitmap engine, top_k or more\n"
+    <<"threads. Any optional argument could be - to keep its default, so the budget alone is set by\n"
+    <<"st_pattern mine mopsi_100_50 mopsi_100_50 mopsi_100_50_50_5 50.0 5 - - - - 512\n"
+    <<"e.g.: st_pattern mine mopsi_100_50 mopsi_100_50 mopsi_100_50_50_5 50.0 5 3 4\n\n"
+    <<"st_pattern mineinc cluster_file tinc_file state_file output_pattern_file scpm_radius min_sup\n"
+    <<"Mines the tinc of newly appended trajectories, translated against the same clusters, without re-mining\n"
+    <<"the old ones. The state_file keeps the mined transactions and patterns, and is created by the first run.\n"
+    <<"e.g.: st_pattern mineinc mopsi_100_50 mopsi_day2_50 mopsi_100_50.sps mopsi_day2_50_50_5 50.0 5";
 }
 
 int main(int argc, char *argv[])
@@ -46,13 +74,18 @@ int main(int argc, char *argv[])
             qDebug("\nPress any key to continue ...");
             return 0;
         }
-        if (args[1].compare("seg") == 0 && args.count() == 10) {
+        if (args[1].compare("seg") == 0 && args.count() >= 10 && args.count() <= 12) {
             qDebug()<<"\n============> The "<<args[1]<<" begins <============";
             Apps::segmentTrajectories(args[2], args[3], args[4],
                     args[5].toDouble(), (bool)(args[6].toInt()), args[7].toDouble(),
-                    args[8].toInt(), args[9].toDouble());
+                    args[8].toInt(), args[9].toDouble(), args.count() > 10 ? args[10].toInt() : 1,
+                    args.count() > 11 ? (bool)(args[11].toInt()) : false);
             qDebug()<<"\n============>  The "<<args[1]<<" ends  <============";
             //ret = a.exec();
+        } else if (args[1].compare("import") == 0 && args.count() == 5) {
+            qDebug()<<"\n============> The "<<args[1]<<" begins <============";
+            Apps::importTrajectories(args[2], args[3], args[4]);
+            qDebug()<<"\n============>  The "<<args[1]<<" ends  <============";
         } else if (args[1].compare("visualize") == 0 && args.count() >= 4) {
             qDebug()<<"\n============> The "<<args[1]<<" begins <============";
             //Apps::visualizeDataset(args[2], args[3], args.count() > 4 ? args[4].toDouble() : 40000.0);
@@ -71,8 +104,15 @@ int main(int argc, char *argv[])
             foreach (QString w, strW) {
                 weights << w.toDouble();
             }
+            if (args.count() > 8 && args[8].compare("refine") != 0 && args[8].compare("nnchain") != 0) {
+                qDebug()<<"Unknown clustering method "<<args[8];
+                printUsage();
+                return 0;
+            }
             Apps::clusterSegments(args[2], weights, args[4],
-                        args[5].toDouble(), args.count() > 6 ? (args[6].toInt())<<20 : 0);
+                        args[5].toDouble(), args.count() > 6 ? (args[6].toInt())<<20 : 0,
+                        args.count() > 7 ? args[7].toInt() : 1, args.count() > 8 && args[8].compare("nnchain") == 0,
+                        args.count() > 9 ? args[9].toInt() : 1);
             Apps::transTrajectories(args[2], args[4], args[4]);
             qDebug()<<"\n============>  The "<<args[1]<<" ends  <============";
             //ret = a.exec();
@@ -82,10 +122,28 @@ int main(int argc, char *argv[])
             qDebug()<<"\n============>  The "<<args[1]<<" ends  <============";
         } else if (args[1].compare("mine") == 0 && args.count() >= 7) {
             qDebug()<<"\n============> The "<<args[1]<<" begins <============";
+            if (hasArg(args, 9) && args[9].compare("prefixspan") != 0 && args[9].compare("bitmap") != 0) {
+                qDebug()<<"Unknown mining engine "<<args[9];
+                printUsage();
+                return 0;
+            }
+            int numThreads = hasArg(args, 8) ? args[8].toInt() : 1;
+            bool useBitmap = hasArg(args, 9) && args[9].compare("bitmap") == 0;
+            int topK = hasArg(args, 10) ? args[10].toInt() : 0;
+            qint64 memoryBudget = hasArg(args, 11) ? ((qint64)args[11].toInt())<<20 : 0;
+            if (memoryBudget > 0 && (useBitmap || topK > 0 || numThreads != 1)) {
+                qDebug()<<"The mem_budget_in_MB only applies to the prefixspan engine without top_k, on one thread.";
+                printUsage();
+                return 0;
+            }
             Apps::scpm(args[2], args[3], args[4], args[5].toDouble(), args[6].toInt(),
-                    args.count() > 7 ? args[7].toInt() : 1);
+                    hasArg(args, 7) ? args[7].toInt() : 1, numThreads, useBitmap, topK, memoryBudget);
             qDebug()<<"\n============>  The "<<args[1]<<" ends  <============";
             //ret = a.exec();
+        } else if (args[1].compare("mineinc") == 0 && args.count() == 8) {
+            qDebug()<<"\n============> The "<<args[1]<<" begins <============";
+            Apps::scpmIncremental(args[2], args[3], args[4], args[5], args[6].toDouble(), args[7].toInt());
+            qDebug()<<"\n============>  The "<<args[1]<<" ends  <============";
         } else if (args[1].compare("evaluate") == 0 && args.count() == 5) {
             qDebug()<<"\n============> The "<<args[1]<<" begins <============";
             Apps::evaluateMiningResults(args[2], args[3], args[4]);
@@ -96,6 +154,55 @@ int main(int argc, char *argv[])
             Apps::generateDataSet(args[2], args[3], args[4], args[5]);
             qDebug()<<"\n============>  The "<<args[1]<<" ends  <============";
             //ret = a.exec();
+        } else if (args[1].compare("benchparse") == 0 && args.count() >= 4) {
+            qDebug()<<"\n============> The "<<args[1]<<" begins <============";
+            Apps::benchParsers(args[2], args[3], args.count() > 4 ? args[4].toInt() : 10);
+            qDebug()<<"\n============>  The "<<args[1]<<" ends  <============";
+        } else if (args[1].compare("benchdots") == 0 && args.count() >= 5) {
+            qDebug()<<"\n============> The "<<args[1]<<" begins <============";
+            Apps::benchDots(args[2], args[3], args[4].toDouble(), args.count() > 5 ? args[5].toInt() : 10);
+            qDebug()<<"\n============>  The "<<args[1]<<" ends  <============";
+        } else if (args[1].compare("benchfleet") == 0 && args.count() >= 5) {
+            qDebug()<<"\n============> The "<<args[1]<<" begins <============";
+            Apps::benchFleet(args[2].toInt(), args[3].toInt(), args[4].toDouble(), args.count() > 5 ? args[5].toInt() : 0);
+            qDebug()<<"\n============>  The "<<args[1]<<" ends  <============";
+        } else if (args[1].compare("teststream") == 0 && args.count() >= 5) {
+            qDebug()<<"\n============> The "<<args[1]<<" begins <============";
+            Apps::testDotsStreaming(args[2], args[3], args[4].toDouble(), args.count() > 5 ? args[5].toInt() : 1,
+                                    args.count() > 6 && args[6].toInt() != 0);
+            qDebug()<<"\n============>  The "<<args[1]<<" ends  <============";
+        } else if (args[1].compare("benchtrie") == 0 && args.count() >= 3) {
+            qDebug()<<"\n============> The "<<args[1]<<" begins <============";
+            Apps::benchTrie(args[2].toInt(), args.count() > 3 ? args[3].toInt() : 1);
+            qDebug()<<"\n============>  The "<<args[1]<<" ends  <============";
+        } else if (args[1].compare("testtopk") == 0 && args.count() == 8) {
+            qDebug()<<"\n============> The "<<args[1]<<" begins <============";
+            Apps::testTopK(args[2], args[3], args[4].toDouble(), args[5].toInt(), args[6].toInt(), args[7].toInt());
+            qDebug()<<"\n============>  The "<<args[1]<<" ends  <============";
+        } else if (args[1].compare("testinc") == 0 && args.count() == 7) {
+            qDebug()<<"\n============> The "<<args[1]<<" begins <============";
+            Apps::testIncrementalMining(args[2], args[3], args[4].toDouble(), args[5].toInt(), args[6].toInt());
+            qDebug()<<"\n============>  The "<<args[1]<<" ends  <============";
+        } else if (args[1].compare("checkmine") == 0 && args.count() == 6) {
+            qDebug()<<"\n============> The "<<args[1]<<" begins <============";
+            Apps::checkMiningEngines(args[2], args[3], args[4].toDouble(), args[5].toInt());
+            qDebug()<<"\n============>  The "<<args[1]<<" ends  <============";
+        } else if (args[1].compare("benchcftree") == 0 && args.count() >= 4) {
+            qDebug()<<"\n============> The "<<args[1]<<" begins <============";
+            Apps::benchCFTree(args[2].toInt(), args[3].toDouble(), args.count() > 4 ? args[4].toInt() : 1);
+            qDebug()<<"\n============>  The "<<args[1]<<" ends  <============";
+        } else if (args[1].compare("testnnchain") == 0 && args.count() == 4) {
+            qDebug()<<"\n============> The "<<args[1]<<" begins <============";
+            Apps::testNNChain(args[2].toInt(), args[3].toDouble());
+            qDebug()<<"\n============>  The "<<args[1]<<" ends  <============";
+        } else if (args[1].compare("testredist") == 0 && args.count() >= 4) {
+            qDebug()<<"\n============> The "<<args[1]<<" begins <============";
+            Apps::testRedist(args[2].toInt(), args[3].toInt(), args.count() > 4 ? args[4].toInt() : 1);
+            qDebug()<<"\n============>  The "<<args[1]<<" ends  <============";
+        } else if (args[1].compare("testscmap") == 0 && args.count() == 4) {
+            qDebug()<<"\n============> The "<<args[1]<<" begins <============";
+            Apps::testSpatialContinuityMap(args[2], args[3].toDouble());
+            qDebug()<<"\n============>  The "<<args[1]<<" ends  <============";
         } else if (args[1].compare("test") == 0 && args.count() == 2) {
             qDebug()<<"\n============> The "<<args[1]<<" begins <============";
             Apps::testPrefixSpan();
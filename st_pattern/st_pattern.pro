@@ -16,6 +16,9 @@ TEMPLATE = app
 
 INCLUDEPATH += /Users/fatty/Downloads/birch-clustering-algorithm/boost_1_61_0
 
+# The BIRCH distance kernels use SSE2 by default. Uncomment to use AVX on the machines supporting it.
+#QMAKE_CXXFLAGS += -mavx
+
 SOURCES += main.cpp \
     DotsException.cpp \
     DotsSimplifier.cpp \
@@ -27,7 +30,16 @@ SOURCES += main.cpp \
     SpatialTemporalException.cpp \
     RobustnessTester.cpp \
     SpatialTemporalSegment.cpp \
-    Apps.cpp
+    Apps.cpp \
+    TrajectoryCache.cpp \
+    DotsFleet.cpp \
+    DotsStreamArena.cpp \
+    DotsCascade.cpp \
+    TincIndex.cpp \
+    BitmapMiner.cpp \
+    BudgetedMiner.cpp \
+    CentroidIndex.cpp \
+    IncrementalMiner.cpp
 
 HEADERS += \
     DotsException.h \
@@ -44,7 +56,17 @@ HEADERS += \
     birch/CFTree_Redist.h \
     birch/CFTree_CFCluster.h \
     Apps.h \
-    TrieNode.h
+    TrieNode.h \
+    CompactTrie.h \
+    TrajectoryCache.h \
+    DotsFleet.h \
+    DotsStreamArena.h \
+    DotsCascade.h \
+    TincIndex.h \
+    BitmapMiner.h \
+    BudgetedMiner.h \
+    CentroidIndex.h \
+    IncrementalMiner.h
 
 FORMS += \
     mainwindow.ui